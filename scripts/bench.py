@@ -0,0 +1,296 @@
+#!/usr/bin/env python3
+#
+# bench.py
+#
+# Cross engine benchmark runner
+#
+# Runs the target benchmarks from src/test under rv-sim, rv-jit with
+# each of its code generation options, rv-sys and natively on the host.
+# Every workload is run --repeat times per engine and the wall times and
+# exit status are recorded. One additional untimed profile run samples
+# the peak resident set size and, for the emulators, collects retired
+# instructions, JIT traces and JIT compile time from the statistics
+# export, which is kept out of the timed runs because it implies
+# --update-instret for rv-jit.
+#
+# Results are written as JSON. With --baseline the median wall times are
+# compared against an earlier results file and the runner exits with
+# status 1 if any workload is slower than --threshold percent.
+#
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import resource
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# proxy ABI workloads ( name, arguments )
+WORKLOADS = [
+    ("test-dhrystone", []),
+    ("test-nbody", ["200000"]),
+    ("test-miniz", []),
+    ("test-sha512", []),
+    ("test-aes", []),
+    ("test-qsort", []),
+    ("test-primes", []),
+    ("test-norx", []),
+    ("test-int-fib", []),
+]
+
+# rv-sys has no proxy ABI, so it runs the machine mode programs
+SYS_WORKLOADS = [
+    ("test-m-sbi-calls", []),
+    ("test-m-sv39", []),
+    ("test-m-mmio-timer", []),
+]
+
+# engine name, emulator, emulator options, workload kind
+ENGINES = [
+    ("rv-sim", "rv-sim", [], "proxy"),
+    ("rv-jit", "rv-jit", [], "proxy"),
+    ("rv-jit-no-fusion", "rv-jit", ["--no-fusion"], "proxy"),
+    ("rv-jit-no-trace", "rv-jit", ["--no-trace"], "proxy"),
+    ("rv-jit-mmr", "rv-jit", ["--memory-mapped-registers"], "proxy"),
+    ("rv-jit-instret", "rv-jit", ["--update-instret"], "proxy"),
+    ("rv-sys", "rv-sys", [], "sys"),
+    ("native", None, [], "native"),
+]
+
+
+def host_dir(subdir):
+    """build/$(OS)_$(CPU)/<subdir> as in the Makefile"""
+    os_name = platform.system().replace(" ", "_").lower()
+    cpu = platform.machine().replace(" ", "_").lower()
+    return os.path.join("build", "%s_%s" % (os_name, cpu), subdir)
+
+
+def run(cmd, timeout):
+    """run a command, returning ( status, seconds ), status -1 on timeout"""
+    start = time.perf_counter()
+    try:
+        status = subprocess.run(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL,
+                                stderr=subprocess.DEVNULL, timeout=timeout).returncode
+    except subprocess.TimeoutExpired:
+        status = -1
+    return status, time.perf_counter() - start
+
+
+def peak_rss(pid):
+    """VmHWM of a running process in kilobytes, None if unavailable or not yet exec'd"""
+    try:
+        if os.readlink("/proc/%d/exe" % pid) == os.path.realpath(sys.executable):
+            return None
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except (OSError, ValueError):
+        pass
+    return None
+
+
+def profile(cmd, stats, timeout):
+    """
+    run once, sampling the peak resident set size, and return
+    ( status, peak rss kb, final statistics snapshot or None )
+
+    ru_maxrss from wait4 includes the high water mark of this
+    interpreter, which the child inherits across fork and exec,
+    so on Linux VmHWM of the new image is sampled every millisecond
+    and ru_maxrss is only used when it is above our own high water
+    mark. Runs shorter than a few milliseconds may be under reported.
+    """
+    path = None
+    if stats:
+        fd, path = tempfile.mkstemp(prefix="rv8-bench-", suffix=".json")
+        os.close(fd)
+        cmd = cmd[:1] + ["--stats", path] + cmd[1:]
+    try:
+        proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL,
+                                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        deadline = time.perf_counter() + timeout
+        rss = None
+        while True:
+            sample = peak_rss(proc.pid)
+            if sample is not None:
+                rss = max(rss or 0, sample)
+            pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+            if pid != 0:
+                break
+            if time.perf_counter() > deadline:
+                proc.kill()
+                os.wait4(proc.pid, 0)
+                return -1, 0, None
+            time.sleep(0.001)
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        scale = 1024 if platform.system() == "Darwin" else 1
+        inherited = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss // scale
+        if rss is None or usage.ru_maxrss // scale > inherited:
+            rss = max(rss or 0, usage.ru_maxrss // scale)
+        snapshot = None
+        if path and proc.returncode == 0:
+            try:
+                with open(path) as f:
+                    snapshot = json.load(f)
+            except (OSError, ValueError):
+                pass
+        return proc.returncode, rss, snapshot
+    finally:
+        for name in (path, path and path + ".tmp"):
+            if name and os.path.exists(name):
+                os.unlink(name)
+
+
+def bench(args):
+    engines = [e for e in ENGINES if e[0] in args.engines]
+    emulators = {"rv-sim": args.rv_sim, "rv-jit": args.rv_jit, "rv-sys": args.rv_sys}
+    results = []
+    for name, emulator, options, kind in engines:
+        if emulator and not os.path.exists(emulators[emulator]):
+            print("%-18s skipped: %s not found" % (name, emulators[emulator]))
+            continue
+        workloads = SYS_WORKLOADS if kind == "sys" else WORKLOADS
+        for workload, wargs in workloads:
+            if args.workloads and workload not in args.workloads:
+                continue
+            binary = os.path.join(args.host_dir if kind == "native" else args.target_dir, workload)
+            if not os.path.exists(binary):
+                continue
+            cmd = ([emulators[emulator]] + options if emulator else []) + [binary] + wargs
+            result = {"engine": name, "workload": workload, "command": cmd}
+            runs, status = [], 0
+            for i in range(args.repeat):
+                status, elapsed = run(cmd, args.timeout)
+                if status != 0:
+                    break
+                runs.append(elapsed)
+            result["status"] = status
+            result["runs"] = runs
+            if status == 0:
+                result["wall_median"] = statistics.median(runs)
+                result["wall_min"] = min(runs)
+                result["wall_stdev"] = statistics.stdev(runs) if len(runs) > 1 else 0.0
+            if status == 0 and not args.no_profile:
+                status, rss, snapshot = profile(cmd, emulator is not None, args.timeout)
+                if status == 0:
+                    result["peak_rss_kb"] = rss
+                if snapshot:
+                    result["instret"] = snapshot.get("instret", 0)
+                    result["mips"] = result["instret"] / result["wall_median"] / 1e6
+                    if emulator == "rv-jit":
+                        result["jit_traces"] = snapshot.get("jit_traces", 0)
+                        result["jit_compile_ns"] = snapshot.get("jit_compile_ns", 0)
+            results.append(result)
+            print_result(result)
+    return {
+        "version": 1,
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "host": {"system": platform.system(), "machine": platform.machine(),
+                 "node": platform.node(), "cpus": os.cpu_count()},
+        "repeat": args.repeat,
+        "results": results,
+    }
+
+
+def print_result(r):
+    if r["status"] != 0:
+        print("%-18s %-18s %s" % (r["engine"], r["workload"],
+              "timeout" if r["status"] == -1 else "exit %d" % r["status"]))
+        return
+    line = "%-18s %-18s %9.4f s %8.2f%%" % (r["engine"], r["workload"], r["wall_median"],
+            r["wall_stdev"] * 100.0 / r["wall_median"] if r["wall_median"] else 0.0)
+    if "peak_rss_kb" in r:
+        line += " %8d KiB" % r["peak_rss_kb"]
+    if "mips" in r:
+        line += " %10.2f MIPS" % r["mips"]
+    if "jit_traces" in r:
+        line += " %6d traces %8.3f ms jit" % (r["jit_traces"], r["jit_compile_ns"] / 1e6)
+    print(line)
+
+
+def compare(current, baseline, threshold):
+    """print the change in median wall time, returns the number of regressions"""
+    base = {(r["engine"], r["workload"]): r for r in baseline["results"] if "wall_median" in r}
+    regressions = 0
+    print()
+    print("%-18s %-18s %10s %10s %8s" % ("engine", "workload", "baseline", "current", "change"))
+    for r in current["results"]:
+        b = base.get((r["engine"], r["workload"]))
+        if not b:
+            continue
+        if "wall_median" not in r:
+            regressions += 1
+            print("%-18s %-18s %10.4f %10s %8s regression" % (r["engine"], r["workload"],
+                  b["wall_median"], "failed", ""))
+            continue
+        change = (r["wall_median"] / b["wall_median"] - 1.0) * 100.0
+        regressed = change > threshold
+        regressions += regressed
+        print("%-18s %-18s %10.4f %10.4f %+7.2f%%%s" % (r["engine"], r["workload"],
+              b["wall_median"], r["wall_median"], change, " regression" if regressed else ""))
+    print()
+    print("%d regressions over %.1f%%" % (regressions, threshold))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the rv8 cross engine benchmarks")
+    parser.add_argument("-e", "--engines", default=",".join(e[0] for e in ENGINES),
+                        help="comma separated engines ( default all )")
+    parser.add_argument("-w", "--workloads", default="",
+                        help="comma separated workloads ( default all )")
+    parser.add_argument("-r", "--repeat", type=int, default=5,
+                        help="timed runs per workload ( default 5 )")
+    parser.add_argument("-o", "--output", default="build/bench/results.json",
+                        help="results file ( default build/bench/results.json )")
+    parser.add_argument("-b", "--baseline",
+                        help="compare against an earlier results file")
+    parser.add_argument("-t", "--threshold", type=float, default=5.0,
+                        help="regression threshold in percent ( default 5 )")
+    parser.add_argument("-c", "--compare",
+                        help="compare an existing results file with the baseline without running")
+    parser.add_argument("-T", "--timeout", type=float, default=600,
+                        help="seconds before a run is killed ( default 600 )")
+    parser.add_argument("-n", "--no-profile", action="store_true",
+                        help="skip the profile run ( no peak RSS, MIPS or JIT counters )")
+    parser.add_argument("--rv-sim", default=os.path.join(host_dir("bin"), "rv-sim"))
+    parser.add_argument("--rv-jit", default=os.path.join(host_dir("bin"), "rv-jit"))
+    parser.add_argument("--rv-sys", default=os.path.join(host_dir("bin"), "rv-sys"))
+    parser.add_argument("--target-dir", default="build/riscv64-unknown-elf/bin",
+                        help="target benchmark binaries")
+    parser.add_argument("--host-dir", default=host_dir("test"),
+                        help="native benchmark binaries")
+    args = parser.parse_args()
+    args.engines = args.engines.split(",")
+    args.workloads = [w for w in args.workloads.split(",") if w]
+    if args.repeat < 1:
+        parser.error("--repeat must be at least 1")
+    if args.compare and not args.baseline:
+        parser.error("--compare requires --baseline")
+
+    if args.compare:
+        with open(args.compare) as f:
+            current = json.load(f)
+    else:
+        current = bench(args)
+        os.makedirs(os.path.dirname(args.output) or ".", exist_ok=True)
+        with open(args.output, "w") as f:
+            json.dump(current, f, indent=2)
+            f.write("\n")
+        print("results written to %s" % args.output)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(current, baseline, args.threshold) > 0:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
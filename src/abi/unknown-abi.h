@@ -29,6 +29,8 @@ namespace riscv {
 		abi_syscall_exit = 93,
 		abi_syscall_exit_group = 94,
 		abi_syscall_set_tid_address = 96,
+		abi_syscall_futex = 98,
+		abi_syscall_set_robust_list = 99,
 		abi_syscall_clock_gettime = 113,
 		abi_syscall_rt_sigaction = 134,
 		abi_syscall_rt_sigprocmask = 135,
@@ -53,6 +55,81 @@ namespace riscv {
 		abi_syscall_chown = 1039,
 	};
 
+	/* proxied syscalls in ascending number order, indexed by profile slot */
+
+	struct abi_syscall_info
+	{
+		u64 num;
+		const char *name;
+	};
+
+	enum { abi_syscall_count = 44 };
+
+	inline const abi_syscall_info* abi_syscall_table()
+	{
+		static const abi_syscall_info table[abi_syscall_count] = {
+			{ abi_syscall_getcwd,          "getcwd" },
+			{ abi_syscall_fcntl,           "fcntl" },
+			{ abi_syscall_ioctl,           "ioctl" },
+			{ abi_syscall_unlinkat,        "unlinkat" },
+			{ abi_syscall_faccessat,       "faccessat" },
+			{ abi_syscall_openat,          "openat" },
+			{ abi_syscall_close,           "close" },
+			{ abi_syscall_lseek,           "lseek" },
+			{ abi_syscall_read,            "read" },
+			{ abi_syscall_write,           "write" },
+			{ abi_syscall_readv,           "readv" },
+			{ abi_syscall_writev,          "writev" },
+			{ abi_syscall_pread,           "pread" },
+			{ abi_syscall_pwrite,          "pwrite" },
+			{ abi_syscall_readlinkat,      "readlinkat" },
+			{ abi_syscall_fstatat,         "fstatat" },
+			{ abi_syscall_fstat,           "fstat" },
+			{ abi_syscall_exit,            "exit" },
+			{ abi_syscall_exit_group,      "exit_group" },
+			{ abi_syscall_set_tid_address, "set_tid_address" },
+			{ abi_syscall_futex,           "futex" },
+			{ abi_syscall_set_robust_list, "set_robust_list" },
+			{ abi_syscall_clock_gettime,   "clock_gettime" },
+			{ abi_syscall_rt_sigaction,    "rt_sigaction" },
+			{ abi_syscall_rt_sigprocmask,  "rt_sigprocmask" },
+			{ abi_syscall_times,           "times" },
+			{ abi_syscall_uname,           "uname" },
+			{ abi_syscall_getrusage,       "getrusage" },
+			{ abi_syscall_gettimeofday,    "gettimeofday" },
+			{ abi_syscall_gettid,          "gettid" },
+			{ abi_syscall_sysinfo,         "sysinfo" },
+			{ abi_syscall_brk,             "brk" },
+			{ abi_syscall_munmap,          "munmap" },
+			{ abi_syscall_clone,           "clone" },
+			{ abi_syscall_execve,          "execve" },
+			{ abi_syscall_mmap,            "mmap" },
+			{ abi_syscall_mprotect,        "mprotect" },
+			{ abi_syscall_madvise,         "madvise" },
+			{ abi_syscall_wait4,           "wait4" },
+			{ abi_syscall_prlimit64,       "prlimit64" },
+			{ abi_syscall_open,            "open" },
+			{ abi_syscall_unlink,          "unlink" },
+			{ abi_syscall_stat,            "stat" },
+			{ abi_syscall_chown,           "chown" },
+		};
+		return table;
+	}
+
+	/* returns the profile slot of a syscall number or -1 */
+	inline int abi_syscall_slot(u64 num)
+	{
+		const abi_syscall_info *table = abi_syscall_table();
+		int lo = 0, hi = abi_syscall_count - 1;
+		while (lo <= hi) {
+			int mid = (lo + hi) >> 1;
+			if (table[mid].num == num) return mid;
+			if (table[mid].num < num) lo = mid + 1;
+			else hi = mid - 1;
+		}
+		return -1;
+	}
+
 	enum
 	{
 		abi_clock_CLOCK_REALTIME = 0,
@@ -96,6 +173,7 @@ namespace riscv {
 		abi_errno_ENAMETOOLONG = 36,
 		abi_errno_ENOLCK = 37,
 		abi_errno_ENOSYS = 38,
+		abi_errno_ETIMEDOUT = 110,
 
 		abi_fcntl_F_DUPFD = 0,
 		abi_fcntl_F_GETFD = 1,
@@ -177,6 +255,19 @@ namespace riscv {
 		abi_signal_SIGSYS = 31,
 		abi_signal_NSIG = 65,
 
+		abi_clone_VM = 0x00000100,
+		abi_clone_FS = 0x00000200,
+		abi_clone_FILES = 0x00000400,
+		abi_clone_SIGHAND = 0x00000800,
+		abi_clone_THREAD = 0x00010000,
+		abi_clone_SYSVSEM = 0x00040000,
+		abi_clone_SETTLS = 0x00080000,
+		abi_clone_PARENT_SETTID = 0x00100000,
+		abi_clone_CHILD_CLEARTID = 0x00200000,
+		abi_clone_CHILD_SETTID = 0x01000000,
+
+		abi_robust_list_limit = 2048,
+
 		abi_wait_WNOHANG = 1,
 		abi_wait_WUNTRACED = 2,
 		abi_wait_WSTOPPED = 2,
@@ -192,6 +283,30 @@ namespace riscv {
 		abi_NEW_UTS_LEN = 64,
 	};
 
+	/* futex operations and robust futex word bits */
+	enum : u32
+	{
+		abi_futex_WAIT = 0,
+		abi_futex_WAKE = 1,
+		abi_futex_REQUEUE = 3,
+		abi_futex_CMP_REQUEUE = 4,
+		abi_futex_WAKE_OP = 5,
+		abi_futex_LOCK_PI = 6,
+		abi_futex_UNLOCK_PI = 7,
+		abi_futex_TRYLOCK_PI = 8,
+		abi_futex_WAIT_BITSET = 9,
+		abi_futex_WAKE_BITSET = 10,
+		abi_futex_WAIT_REQUEUE_PI = 11,
+		abi_futex_CMP_REQUEUE_PI = 12,
+		abi_futex_PRIVATE_FLAG = 128,
+		abi_futex_CLOCK_REALTIME = 256,
+		abi_futex_CMD_MASK = ~u32(abi_futex_PRIVATE_FLAG | abi_futex_CLOCK_REALTIME),
+
+		abi_futex_WAITERS = 0x80000000,
+		abi_futex_OWNER_DIED = 0x40000000,
+		abi_futex_TID_MASK = 0x3fffffff
+	};
+
 	template <typename P> struct abi_iovec
 	{
 		typename P::ulong_t iov_base;
@@ -419,6 +534,7 @@ namespace riscv {
 			case ENAMETOOLONG: return -abi_errno_ENAMETOOLONG;
 			case ENOLCK:   return -abi_errno_ENOLCK;
 			case ENOSYS:   return -abi_errno_ENOSYS;
+			case ETIMEDOUT: return -abi_errno_ETIMEDOUT;
 			default:       return -abi_errno_EINVAL;
 		}
 	}
@@ -803,23 +919,139 @@ namespace riscv {
 		proc.ireg[rv_ireg_a0] = cvt_error(ret);
 	}
 
+	int abi_host_gettid()
+	{
+	#if defined(__linux__)
+		return syscall(SYS_gettid);
+	#else
+		return getpid();
+	#endif
+	}
+
+	long abi_host_futex(void *uaddr, int op, int val, const struct timespec *ts, void *uaddr2, int val3)
+	{
+	#if defined(__linux__)
+		return syscall(SYS_futex, uaddr, op, val, ts, uaddr2, val3);
+	#else
+		errno = ENOSYS;
+		return -1;
+	#endif
+	}
+
+	/* mark a robust futex held by an exiting thread as owner died */
+	template <typename P> void abi_release_robust_futex(P &proc, addr_t addr)
+	{
+		u32 *futex = (u32*)addr, val = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+		do {
+			if ((val & abi_futex_TID_MASK) != u32(proc.tid)) return;
+		} while (!__atomic_compare_exchange_n(futex, &val,
+			(val & abi_futex_WAITERS) | abi_futex_OWNER_DIED,
+			false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		if (val & abi_futex_WAITERS) {
+			abi_host_futex(futex, abi_futex_WAKE, 1, nullptr, nullptr, 0);
+		}
+	}
+
+	/* walk the robust list and clear the child tid of an exiting thread */
+	template <typename P> void abi_exit_thread_futexes(P &proc)
+	{
+		if (proc.robust_list) {
+			typename P::ulong_t *head = (typename P::ulong_t*)proc.robust_list;
+			typename P::long_t futex_offset = head[1];
+			addr_t pending = head[2] & ~1ULL, entry = head[0] & ~1ULL;
+			for (size_t limit = abi_robust_list_limit; entry != proc.robust_list && limit > 0; limit--) {
+				addr_t next = *(typename P::ulong_t*)entry & ~1ULL;
+				if (entry != pending) abi_release_robust_futex(proc, entry + futex_offset);
+				entry = next;
+			}
+			if (pending) abi_release_robust_futex(proc, pending + futex_offset);
+		}
+		if (proc.clear_child_tid) {
+			__atomic_store_n((s32*)proc.clear_child_tid, 0, __ATOMIC_RELEASE);
+			abi_host_futex((void*)proc.clear_child_tid, abi_futex_WAKE, 1, nullptr, nullptr, 0);
+		}
+	}
+
 	template <typename P> void abi_sys_exit(P &proc)
 	{
 		if (proc.log & proc_log_syscall) {
 			printf("exit(%ld)\n", (long)proc.ireg[rv_ireg_a0]);
 		}
+		abi_exit_thread_futexes(proc);
+		proc.exit_thread(proc.ireg[rv_ireg_a0]);
+	}
+
+	template <typename P> void abi_sys_exit_group(P &proc)
+	{
+		if (proc.log & proc_log_syscall) {
+			printf("exit_group(%ld)\n", (long)proc.ireg[rv_ireg_a0]);
+		}
 		proc.exit(proc.ireg[rv_ireg_a0]);
 		exit(proc.ireg[rv_ireg_a0]);
 	}
 
 	template <typename P> void abi_sys_set_tid_address(P &proc)
 	{
-		proc.clear_child_tid = *(int*)(uintptr_t)proc.ireg[rv_ireg_a0].r.xu.val;
+		proc.clear_child_tid = proc.ireg[rv_ireg_a0].r.xu.val;
+		if (proc.log & proc_log_syscall) {
+			printf("set_tid_address(0x%lx) = %d\n",
+				(long)proc.ireg[rv_ireg_a0], proc.tid);
+		}
+		proc.ireg[rv_ireg_a0] = proc.tid;
+	}
+
+	template <typename P> void abi_sys_futex(P &proc)
+	{
+		void *uaddr = (void*)(addr_t)proc.ireg[rv_ireg_a0].r.xu.val;
+		int op = proc.ireg[rv_ireg_a1], val = proc.ireg[rv_ireg_a2];
+		void *uaddr2 = (void*)(addr_t)proc.ireg[rv_ireg_a4].r.xu.val;
+		int val3 = proc.ireg[rv_ireg_a5];
+		long ret;
+		switch (op & abi_futex_CMD_MASK) {
+			case abi_futex_WAIT:
+			case abi_futex_WAIT_BITSET:
+			case abi_futex_LOCK_PI:
+			case abi_futex_WAIT_REQUEUE_PI:
+			{
+				/* convert the guest timeout */
+				abi_timespec<P> *abi_ts = (abi_timespec<P>*)(addr_t)proc.ireg[rv_ireg_a3].r.xu.val;
+				struct timespec ts;
+				if (abi_ts) {
+					ts.tv_sec = abi_ts->tv_sec;
+					ts.tv_nsec = abi_ts->tv_nsec;
+				}
+				ret = abi_host_futex(uaddr, op, val, abi_ts ? &ts : nullptr, uaddr2, val3);
+				break;
+			}
+			default:
+				/* timeout argument is val2 for requeue and wake_op */
+				ret = abi_host_futex(uaddr, op, val,
+					(const struct timespec*)(addr_t)proc.ireg[rv_ireg_a3].r.xu.val, uaddr2, val3);
+				break;
+		}
+		if (proc.log & proc_log_syscall) {
+			printf("futex(0x%lx,%ld,%ld,0x%lx,0x%lx,%ld) = %d\n",
+				(long)proc.ireg[rv_ireg_a0], (long)proc.ireg[rv_ireg_a1],
+				(long)proc.ireg[rv_ireg_a2], (long)proc.ireg[rv_ireg_a3],
+				(long)proc.ireg[rv_ireg_a4], (long)proc.ireg[rv_ireg_a5],
+				cvt_error(ret));
+		}
+		proc.ireg[rv_ireg_a0] = cvt_error(ret);
+	}
+
+	template <typename P> void abi_sys_set_robust_list(P &proc)
+	{
+		int ret = 0;
+		if (proc.ireg[rv_ireg_a1] != sizeof(typename P::ulong_t) * 3) {
+			ret = -abi_errno_EINVAL;
+		} else {
+			proc.robust_list = proc.ireg[rv_ireg_a0].r.xu.val;
+		}
 		if (proc.log & proc_log_syscall) {
-			printf("sys_set_tid_address(0x%lx) = %d\n",
-				(long)proc.ireg[rv_ireg_a0], 1);
+			printf("set_robust_list(0x%lx,%ld) = %d\n",
+				(long)proc.ireg[rv_ireg_a0], (long)proc.ireg[rv_ireg_a1], ret);
 		}
-		proc.ireg[rv_ireg_a0].r.xu.val = 1; /* tid is 1 for now */
+		proc.ireg[rv_ireg_a0] = ret;
 	}
 
 	template <typename P> void abi_sys_clock_gettime(P &proc)
@@ -935,7 +1167,7 @@ namespace riscv {
 
 	template <typename P> void abi_sys_gettid(P &proc)
 	{
-		int tid = getpid();
+		int tid = proc.tid;
 		if (proc.log & proc_log_syscall) {
 			printf("gettid() = %d\n", tid);
 		}
@@ -955,6 +1187,9 @@ namespace riscv {
 
 	template <typename P> void abi_sys_brk(P &proc)
 	{
+		// threads share the program break
+		std::lock_guard<std::mutex> lock(proc.threads->lock);
+
 		// calculate the new heap address rounded up to the nearest page
 		addr_t new_brk = proc.ireg[rv_ireg_a0];
 		addr_t new_heap_end = round_up(new_brk, page_size);
@@ -1025,22 +1260,23 @@ namespace riscv {
 	template <typename P> void abi_sys_clone(P &proc)
 	{
 		int flags = proc.ireg[rv_ireg_a0];
+		int thread_flags = abi_clone_VM | abi_clone_THREAD | abi_clone_SIGHAND;
+		int ret;
 		if (flags == abi_signal_SIGCHLD) {
-			int ret = fork();
-			if (proc.log & proc_log_syscall) {
-				printf("clone(%ld,%ld) = %d\n",
-					(long)proc.ireg[rv_ireg_a0], (long)proc.ireg[rv_ireg_a1],
-					cvt_error(ret));
-			}
-			proc.ireg[rv_ireg_a0] = cvt_error(ret);
+			ret = cvt_error(fork());
+		} else if ((flags & thread_flags) == thread_flags && proc.clone_thread) {
+			/* thread sharing the address space: clone(flags, stack, ptid, tls, ctid) */
+			ret = proc.clone_thread(proc, flags,
+				proc.ireg[rv_ireg_a1], proc.ireg[rv_ireg_a2],
+				proc.ireg[rv_ireg_a3], proc.ireg[rv_ireg_a4]);
 		} else {
-			if (proc.log & proc_log_syscall) {
-				printf("clone(%ld,%ld) = %d\n",
-					(long)proc.ireg[rv_ireg_a0], (long)proc.ireg[rv_ireg_a1],
-					abi_errno_EINVAL);
-			}
-			proc.ireg[rv_ireg_a0] = -abi_errno_EINVAL;
+			ret = -abi_errno_EINVAL;
+		}
+		if (proc.log & proc_log_syscall) {
+			printf("clone(0x%lx,0x%lx) = %d\n",
+				(long)proc.ireg[rv_ireg_a0], (long)proc.ireg[rv_ireg_a1], ret);
 		}
+		proc.ireg[rv_ireg_a0] = ret;
 	}
 
 	template <typename P> void abi_sys_execve(P &proc)
@@ -1062,7 +1298,7 @@ namespace riscv {
 		flags |= (abi_flags & abi_mmap_MAP_ANON)    ? MAP_ANON    : 0;
 		uintptr_t ret = (uintptr_t)guest_mmap(
 			(void*)(uintptr_t)proc.ireg[rv_ireg_a0], proc.ireg[rv_ireg_a1],
-			prot, flags, proc.ireg[rv_ireg_a4], proc.ireg[rv_ireg_a5]);
+			prot, flags, proc.ireg[rv_ireg_a4], proc.ireg[rv_ireg_a5], proc.mmap_limit());
 		if (proc.log & proc_log_syscall) {
 			printf("mmap(0x%lx,%ld,%ld,%ld,%ld,%ld) = 0x%lx\n",
 				(long)proc.ireg[rv_ireg_a0], (long)proc.ireg[rv_ireg_a1],
@@ -1203,8 +1439,10 @@ namespace riscv {
 			case abi_syscall_fstatat:         abi_sys_fstatat(proc); break;
 			case abi_syscall_fstat:           abi_sys_fstat(proc); break;
 			case abi_syscall_exit:            abi_sys_exit(proc); break;
-			case abi_syscall_exit_group:      abi_sys_exit(proc); break;
+			case abi_syscall_exit_group:      abi_sys_exit_group(proc); break;
 			case abi_syscall_set_tid_address: abi_sys_set_tid_address(proc); break;
+			case abi_syscall_futex:           abi_sys_futex(proc); break;
+			case abi_syscall_set_robust_list: abi_sys_set_robust_list(proc); break;
 			case abi_syscall_clock_gettime:   abi_sys_clock_gettime(proc); break;
 			case abi_syscall_rt_sigaction:    abi_sys_rt_sigaction(proc); break;
 			case abi_syscall_rt_sigprocmask:  abi_sys_rt_sigprocmask(proc); break;
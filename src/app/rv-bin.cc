@@ -24,6 +24,8 @@ typedef int(*rv_cmd_fn)(int argc, const char **argv);
 int rv_dump_main(int argc, const char **argv);
 int rv_histogram_main(int argc, const char **argv);
 int rv_pte_main(int argc, const char **argv);
+int rv_snapshot_main(int argc, const char **argv);
+int rv_trace_main(int argc, const char **argv);
 
 struct rv_cmd {
 	const char* name;
@@ -34,6 +36,8 @@ static rv_cmd cmds[] = {
 	{ "dump",      rv_dump_main },
 	{ "histogram", rv_histogram_main },
 	{ "pte",       rv_pte_main },
+	{ "snapshot",  rv_snapshot_main },
+	{ "trace",     rv_trace_main },
 	{ nullptr,     nullptr },
 };
 
@@ -26,7 +26,10 @@
 #include <random>
 #include <deque>
 #include <map>
+#include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <type_traits>
 
@@ -46,6 +49,9 @@
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "host-endian.h"
 #include "types.h"
@@ -70,12 +76,21 @@
 #include "amo.h"
 #include "processor-logging.h"
 #include "processor-base.h"
+#include "processor-trace.h"
+#include "processor-window.h"
+#include "processor-profile.h"
+#include "processor-bbv.h"
+#include "processor-wss.h"
+#include "processor-phase.h"
+#include "processor-stats.h"
+#include "processor-roi.h"
 #include "processor-impl.h"
 #include "interp.h"
 #include "processor-model.h"
 #include "mmu-proxy.h"
 #include "mmap-core.h"
 #include "unknown-abi.h"
+#include "processor-syscall.h"
 #include "processor-histogram.h"
 #include "processor-proxy.h"
 #include "debug-cli.h"
@@ -169,6 +184,17 @@ struct rv_jit_emulator
 	uint64_t initial_seed = 0;
 	std::string elf_filename;
 	std::string stats_dirname;
+	std::string fork_point;
+	std::string profile_filename;
+	u64 profile_interval = profile_default_interval;
+	bool profile_host_time = false;
+	std::string wss_prefix = "wss";
+	u64 wss_interval = 0;
+	std::string stats_target;
+	stats_format stats_output_format = stats_format_json;
+	u64 stats_interval = stats_default_interval_ms;
+	bool roi_gate = false;
+	bool syscall_histogram = false;
 
 	std::vector<std::string> host_cmdline;
 	std::vector<std::string> host_env;
@@ -185,6 +211,34 @@ struct rv_jit_emulator
 			{ "-o", "--log-operands", cmdline_arg_type_none,
 				"Log Instructions and Operands",
 				[&](std::string s) { return (proc_logs |= (proc_log_inst | proc_log_trap | proc_log_operands)); } },
+			{ "-g", "--profile", cmdline_arg_type_string,
+				"Write a sampled call stack profile in folded stack format",
+				[&](std::string s) { profile_filename = s; return (proc_logs |= proc_log_profile); } },
+			{ "-G", "--profile-interval", cmdline_arg_type_string,
+				"Profile sample interval ( <instructions> or <n>us, default 10007 )",
+				[&](std::string s) { return guest_profile::parse_interval(s, profile_interval, profile_host_time); } },
+			{ "-U", "--wss", cmdline_arg_type_string,
+				"Profile the working set every <interval> instructions with a page heatmap",
+				[&](std::string s) {
+					wss_interval = strtoull(s.c_str(), nullptr, 10);
+					proc_logs |= proc_log_wss;
+					return wss_interval > 0;
+				} },
+			{ "-V", "--wss-file", cmdline_arg_type_string,
+				"Working set file prefix ( default wss, writes wss.csv and wss-heat.csv )",
+				[&](std::string s) { wss_prefix = s; return true; } },
+			{ "-e", "--stats", cmdline_arg_type_string,
+				"Export runtime statistics periodically to a file or unix:<socket>",
+				[&](std::string s) { stats_target = s; return true; } },
+			{ "-A", "--stats-format", cmdline_arg_type_string,
+				"Statistics export format ( json or prometheus, default json )",
+				[&](std::string s) { return stats_export::parse_format(s, stats_output_format); } },
+			{ "-y", "--stats-interval", cmdline_arg_type_string,
+				"Statistics export interval in milliseconds ( default 1000 )",
+				[&](std::string s) { stats_interval = strtoull(s.c_str(), nullptr, 10); return stats_interval > 0; } },
+			{ "-q", "--roi", cmdline_arg_type_none,
+				"Collect statistics and logs only inside guest regions of interest",
+				[&](std::string s) { return (roi_gate = true); } },
 			{ "-S", "--symbolicate", cmdline_arg_type_none,
 				"Symbolicate addresses in instruction log",
 				[&](std::string s) { return (symbolicate = true); } },
@@ -194,6 +248,12 @@ struct rv_jit_emulator
 			{ "-c", "--log-syscalls", cmdline_arg_type_none,
 				"Log System Calls",
 				[&](std::string s) { return (proc_logs |= proc_log_syscall); } },
+			{ "-Y", "--syscall-profile", cmdline_arg_type_none,
+				"Profile System Call Latency and Transfer Sizes at Exit",
+				[&](std::string s) { return (proc_logs |= proc_log_syscall_profile); } },
+			{ "-H", "--syscall-histogram", cmdline_arg_type_none,
+				"Profile System Calls with a Histogram of Transfer Sizes",
+				[&](std::string s) { return (syscall_histogram = true) && (proc_logs |= proc_log_syscall_profile); } },
 			{ "-r", "--log-registers", cmdline_arg_type_none,
 				"Log Registers (defaults to integer registers)",
 				[&](std::string s) { return (proc_logs |= proc_log_int_reg); } },
@@ -242,6 +302,9 @@ struct rv_jit_emulator
 			{ "-I", "--trace-iters", cmdline_arg_type_string,
 				"Trace iterations",
 				[&](std::string s) { trace_iters = strtoull(s.c_str(), nullptr, 10); return true; } },
+			{ "-F", "--fork-server", cmdline_arg_type_string,
+				"Run to a fork point ( entry, main, <symbol>, <address> ) then fork a run per stdin line",
+				[&](std::string s) { fork_point = s; return true; } },
 			{ "-s", "--seed", cmdline_arg_type_string,
 				"Random seed",
 				[&](std::string s) { initial_seed = strtoull(s.c_str(), nullptr, 10); return true; } },
@@ -259,6 +322,21 @@ struct rv_jit_emulator
 			help_or_error = true;
 		}
 
+		if ((profile_filename.size() > 0 || wss_interval > 0 ||
+			stats_target.size() > 0) && fork_point.size() > 0)
+		{
+			printf("%s: --profile, --wss and --stats can't be used with --fork-server\n", argv[0]);
+			help_or_error = true;
+		}
+
+		if (wss_interval > 0 && mode == jit_mode_audit) {
+			printf("%s: --wss can't be used with --audit\n", argv[0]);
+			help_or_error = true;
+		}
+
+		/* loads and stores in traces bypass the MMU, so --wss is interpreted */
+		if (wss_interval > 0) mode = jit_mode_none;
+
 		if (help_or_error) {
 			printf("usage: %s [<emulator_options>] [--] <elf_file> [<options>]\n", argv[0]);
 			cmdline_option::print_options(options);
@@ -285,6 +363,7 @@ struct rv_jit_emulator
 	{
 		/* setup floating point exception mask */
 		fenv_init();
+		u64 start_ns = cpu.get_time_ns();
 
 		/* JIT mode */
 		switch (mode) {
@@ -303,24 +382,49 @@ struct rv_jit_emulator
 		proc.log = proc_logs;
 		proc.mmu.mem->log = (proc.log & proc_log_memory);
 		proc.stats_dirname = stats_dirname;
+		proc.sysprof_histogram = syscall_histogram;
 		if (symbolicate) proc.symlookup = [&](addr_t va) { return proc.symlookup_elf(va); };
+		proc.clone_thread = proxy_thread<P>::clone;
 
 		/* set JIT options */
 		proc.trace_iters = trace_iters;
-		proc.update_instret = update_instret;
+		/* profile samples, exported statistics and regions are measured with instret */
+		proc.update_instret = update_instret || profile_filename.size() > 0 ||
+			stats_target.size() > 0 || roi_gate;
 		proc.memory_registers = memory_registers;
 
 		/* randomise integer register state with 512 bits of entropy */
 		proc.seed_registers(cpu, initial_seed, 512);
 
 		/* Map ELF executable and setup the stack */
-		proc.map_executable(elf_filename, host_cmdline, symbolicate);
+		proc.map_executable(elf_filename, host_cmdline, symbolicate || profile_filename.size() > 0 || wss_interval > 0);
 		proc.map_proxy_stack(P::mmu_type::memory_top, P::mmu_type::stack_size);
 		proc.setup_proxy_stack(cpu, host_cmdline, host_env,
 			P::mmu_type::memory_top, P::mmu_type::stack_size);
 
 		/* Initialize and run the processor */
 		proc.init();
+		proc.roi_init(roi_gate);
+
+		/* calls inside JIT traces are not seen so JIT samples have no call stack */
+		if (profile_filename.size() > 0) {
+			proc.profile = std::make_shared<guest_profile>(profile_filename,
+				[&](addr_t pc) { return proc.symfunction_elf(pc); },
+				profile_interval, profile_host_time, mode != jit_mode_trace);
+		}
+		if (wss_interval > 0) {
+			proc.wss = std::make_shared<guest_wss>(wss_prefix, wss_interval,
+				[&] { return proc.wss_regions(); });
+		}
+		if (stats_target.size() > 0) {
+			proc.stats_attach(std::make_shared<stats_export>("rv-jit", stats_target,
+				stats_output_format, stats_interval));
+			proc.stats->start();
+		}
+		if (fork_point.size() > 0) {
+			proxy_fork_server<P>::serve(proc,
+				proxy_fork_server<P>::resolve(proc, elf_filename, fork_point), start_ns);
+		}
 		proc.run(proc.log & proc_log_ebreak_cli ? exit_cause_cli : exit_cause_continue);
 		proc.destroy();
 	}
@@ -0,0 +1,86 @@
+//
+//  rv-snapshot.cc
+//
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "host-endian.h"
+#include "types.h"
+#include "bits.h"
+#include "util.h"
+#include "host.h"
+#include "pma.h"
+#include "mmu-memory.h"
+#include "processor-snapshot.h"
+
+using namespace riscv;
+
+static void print_snapshot(std::string filename)
+{
+	snapshot_index index(filename);
+	u64 pages = 0;
+	for (auto &ext : index.extents) {
+		pages += ext.size >> page_shift;
+	}
+	printf("%s: rv%u %s%s state=%llu segments=%llu extents=%llu pages=%llu\n",
+		filename.c_str(), index.hdr.xlen,
+		index.hdr.base[0] ? "delta" : "full",
+		(index.hdr.devices & snapshot_device_disk) ? " disk" : "",
+		index.hdr.state_size, index.hdr.num_segments,
+		index.hdr.num_extents, pages);
+	for (auto &ss : index.segments) {
+		printf("  segment %016llx-%016llx %s\n",
+			ss.mpa, ss.mpa + ss.size, ss.name);
+	}
+	if (index.hdr.base[0]) {
+		print_snapshot(snapshot_base_path(filename, index.hdr.base));
+	}
+}
+
+static void merge_snapshot(std::string in_filename, std::string out_filename)
+{
+	/* map the delta chain then write the state of the newest delta as a full snapshot */
+	user_memory<u64> mem;
+	snapshot_index index(in_filename);
+	snapshot_map_segments(mem, in_filename);
+	snapshot_stats stats;
+	if (!snapshot_write(mem, index.state, index.hdr.xlen, index.hdr.devices, out_filename, std::string(), &stats)) {
+		exit(1);
+	}
+	printf("%s: pages=%llu time=%.3fs\n", out_filename.c_str(),
+		stats.pages, stats.time_ns / 1e9);
+}
+
+/* main */
+
+int rv_snapshot_main(int argc, const char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "info") == 0) {
+		print_snapshot(argv[2]);
+	} else if (argc == 4 && strcmp(argv[1], "merge") == 0) {
+		merge_snapshot(argv[2], argv[3]);
+	} else {
+		printf("usage: %s info <snapshot>\n", argv[0]);
+		printf("usage: %s merge <delta> <output>\n", argv[0]);
+		exit(1);
+	}
+	exit(0);
+}
@@ -24,6 +24,7 @@
 #include <memory>
 #include <random>
 #include <deque>
+#include <queue>
 #include <map>
 #include <thread>
 #include <mutex>
@@ -31,6 +32,7 @@
 #include <condition_variable>
 #include <atomic>
 #include <type_traits>
+#include <fstream>
 
 #include "dense_hash_map"
 
@@ -41,6 +43,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "host-endian.h"
 #include "types.h"
@@ -66,6 +70,15 @@
 #include "amo.h"
 #include "processor-logging.h"
 #include "processor-base.h"
+#include "processor-trace.h"
+#include "processor-window.h"
+#include "processor-profile.h"
+#include "processor-bbv.h"
+#include "processor-wss.h"
+#include "processor-hpm.h"
+#include "processor-phase.h"
+#include "processor-stats.h"
+#include "processor-roi.h"
 #include "processor-impl.h"
 #include "mmu-memory.h"
 #include "tlb-soft.h"
@@ -73,6 +86,7 @@
 #include "interp.h"
 #include "processor-model.h"
 #include "queue.h"
+#include "scheduler.h"
 #include "console.h"
 #include "device-rom-boot.h"
 #include "device-rom-sbi.h"
@@ -86,10 +100,13 @@
 #include "device-gpio.h"
 #include "device-rand.h"
 #include "device-htif.h"
+#include "device-virtio-blk.h"
 #include "processor-histogram.h"
+#include "processor-snapshot.h"
 #include "processor-priv-1.9.h"
 #include "debug-cli.h"
 #include "processor-runloop.h"
+#include "node.h"
 
 #if defined (ENABLE_GPERFTOOL)
 #include "gperftools/profiler.h"
@@ -121,6 +138,25 @@ static bool allow_env_var(const char *var)
 }
 
 
+/*
+ * Farm boot image
+ *
+ * Each distinct boot image in a --farm job list is parsed once. Its
+ * read-only ELF segments are mapped once and shared by every guest
+ * running the image, and the first guest to load it decodes the text
+ * into an instruction cache image that later guests start with.
+ */
+
+struct farm_image
+{
+	std::string filename;
+	elf_file elf;
+	std::map<size_t,std::shared_ptr<void>> mappings; /* phdr index -> shared mapping */
+	std::once_flag decode_once;
+	std::shared_ptr<void> inst_cache;                /* P::rv_inst_cache_ent[] */
+};
+
+
 /* RISC-V Emulator */
 
 struct rv_emulator
@@ -141,6 +177,7 @@ struct rv_emulator
 	static const uintmax_t default_ram_size = 0x40000000ULL; /* 1GiB */
 
 	elf_file elf;
+	elf_file symbols;
 	host_cpu &cpu;
 	int proc_logs = 0;
 	bool help_or_error = false;
@@ -149,6 +186,29 @@ struct rv_emulator
 	uint64_t initial_seed = 0;
 	std::string boot_filename;
 	std::string stats_dirname;
+	std::vector<std::pair<std::string,s64>> load_blobs;
+	std::string snapshot_filename;
+	std::string restore_filename;
+	std::string disk_filename;
+	std::string disk_overlay;
+	std::string trace_filename;
+	std::vector<std::pair<std::string,bool>> log_triggers;
+	std::string profile_filename;
+	u64 profile_interval = profile_default_interval;
+	bool profile_host_time = false;
+	std::string wss_prefix = "wss";
+	u64 wss_interval = 0;
+	std::string stats_target;
+	stats_format stats_output_format = stats_format_json;
+	u64 stats_interval = stats_default_interval_ms;
+	bool roi_gate = false;
+	std::shared_ptr<stats_export> stats;
+	bool native_sbi = false;
+	s64 snapshot_instret = 0;
+	s64 checkpoint_interval = 0;
+	s64 num_harts = 1;
+	std::string farm_filename;
+	s64 farm_workers = 0;
 
 	std::vector<std::string> host_cmdline;
 	std::vector<std::string> host_env;
@@ -204,6 +264,64 @@ struct rv_emulator
 			pma_type_main | elf_pma_flags(phdr.p_flags));
 	}
 
+	/* Map a read-only ELF load segment once for sharing between farm guests */
+	std::shared_ptr<void> map_shared_segment(const char* filename, Elf64_Phdr &phdr)
+	{
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) {
+			panic("map_executable: error: open: %s: %s", filename, strerror(errno));
+		}
+
+		addr_t map_delta = phdr.p_offset & (page_size-1);
+		addr_t map_offset = phdr.p_offset - map_delta;
+		addr_t map_len = round_up(phdr.p_memsz + map_delta, page_size);
+		addr_t file_end = phdr.p_filesz + map_delta;
+		addr_t file_len = round_up(file_end, page_size);
+
+		/* zero pages for the whole segment with the file contents mapped over them */
+		void *addr = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED || (file_len > 0 && mmap(addr, file_len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_FIXED, fd, map_offset) == MAP_FAILED)) {
+			panic("map_executable: error: mmap: %s: %s", filename, strerror(errno));
+		}
+		close(fd);
+
+		/* zero bss in the last file page then make the segment read-only */
+		memset((void*)((uintptr_t)addr + file_end), 0, file_len - file_end);
+		if (mprotect(addr, map_len, PROT_READ) != 0) {
+			panic("map_executable: error: mprotect: %s: %s", filename, strerror(errno));
+		}
+
+		return std::shared_ptr<void>(addr, [map_len](void *addr) { munmap(addr, map_len); });
+	}
+
+	/* Parse blob argument in the form <filename>@<physical address> */
+	bool parse_load_blob(std::string s)
+	{
+		size_t at = s.rfind('@');
+		s64 addr = 0;
+		if (at == std::string::npos || at == 0 || !parse_integral(s.substr(at + 1), addr)) {
+			printf("--load: expected <filename>@<address>: %s\n", s.c_str());
+			return false;
+		}
+		load_blobs.push_back(std::pair<std::string,s64>(s.substr(0, at), addr));
+		return true;
+	}
+
+	/* Parse snapshot argument in the form <filename>@<instret> */
+	bool parse_snapshot(std::string s, const char *option)
+	{
+		size_t at = s.rfind('@');
+		if (at == std::string::npos || at == 0 ||
+			!parse_integral(s.substr(at + 1), snapshot_instret) || snapshot_instret <= 0)
+		{
+			printf("%s: expected <filename>@<instret>: %s\n", option, s.c_str());
+			return false;
+		}
+		snapshot_filename = s.substr(0, at);
+		return true;
+	}
+
 	void parse_commandline(int argc, const char* argv[], const char* envp[])
 	{
 		cmdline_option options[] =
@@ -214,9 +332,56 @@ struct rv_emulator
 			{ "-o", "--log-operands", cmdline_arg_type_none,
 				"Log Instructions and Operands",
 				[&](std::string s) { return (proc_logs |= (proc_log_inst | proc_log_trap | proc_log_operands)); } },
+			{ "-X", "--trace", cmdline_arg_type_string,
+				"Write a binary instruction trace ( decode with rv-bin trace )",
+				[&](std::string s) { trace_filename = s; return (proc_logs |= proc_log_trace); } },
+			{ "-g", "--profile", cmdline_arg_type_string,
+				"Write a sampled call stack profile in folded stack format",
+				[&](std::string s) { profile_filename = s; return (proc_logs |= proc_log_profile); } },
+			{ "-G", "--profile-interval", cmdline_arg_type_string,
+				"Profile sample interval ( <instructions> or <n>us, default 10007 )",
+				[&](std::string s) { return guest_profile::parse_interval(s, profile_interval, profile_host_time); } },
+			{ "-U", "--wss", cmdline_arg_type_string,
+				"Profile the working set every <interval> instructions with a page heatmap",
+				[&](std::string s) {
+					wss_interval = strtoull(s.c_str(), nullptr, 10);
+					proc_logs |= proc_log_wss;
+					return wss_interval > 0;
+				} },
+			{ "-V", "--wss-file", cmdline_arg_type_string,
+				"Working set file prefix ( default wss, writes wss.csv and wss-heat.csv )",
+				[&](std::string s) { wss_prefix = s; return true; } },
+			{ "-e", "--stats", cmdline_arg_type_string,
+				"Export runtime statistics periodically to a file or unix:<socket>",
+				[&](std::string s) { stats_target = s; return true; } },
+			{ "-A", "--stats-format", cmdline_arg_type_string,
+				"Statistics export format ( json or prometheus, default json )",
+				[&](std::string s) { return stats_export::parse_format(s, stats_output_format); } },
+			{ "-y", "--stats-interval", cmdline_arg_type_string,
+				"Statistics export interval in milliseconds ( default 1000 )",
+				[&](std::string s) { stats_interval = strtoull(s.c_str(), nullptr, 10); return stats_interval > 0; } },
+			{ "-q", "--roi", cmdline_arg_type_none,
+				"Collect statistics and logs only inside guest regions of interest",
+				[&](std::string s) { return (roi_gate = true); } },
+			{ "-w", "--log-on", cmdline_arg_type_string,
+				"Start logging at a trigger ( instret:<n>, pc:<addr>, entry:<symbol>, exit:<symbol>, marker:<n> )",
+				[&](std::string s) { log_triggers.push_back({ s, true }); return true; } },
+			{ "-u", "--log-off", cmdline_arg_type_string,
+				"Stop logging at a trigger",
+				[&](std::string s) { log_triggers.push_back({ s, false }); return true; } },
+			{ "-f", "--log-function", cmdline_arg_type_string,
+				"Log calls to a function ( <symbol> or <address> )",
+				[&](std::string s) {
+					log_triggers.push_back({ "entry:" + s, true });
+					log_triggers.push_back({ "exit:" + s, false });
+					return true;
+				} },
 			{ "-O", "--log-mmio", cmdline_arg_type_none,
 				"Log Memory Mapped IO",
 				[&](std::string s) { return (proc_logs |= proc_log_mmio); } },
+			{ "-Q", "--log-mmio-summary", cmdline_arg_type_none,
+				"Count Memory Mapped IO per device register and print at exit",
+				[&](std::string s) { return (proc_logs |= proc_log_mmio_summary); } },
 			{ "-m", "--log-memory-map", cmdline_arg_type_none,
 				"Log Memory Map Information",
 				[&](std::string s) { return (proc_logs |= proc_log_memory); } },
@@ -268,6 +433,40 @@ struct rv_emulator
 			{ "-b", "--binary", cmdline_arg_type_string,
 				"Boot Binary ( 32, 64 )",
 				[&](std::string s) { return parse_integral(s, ram_boot); } },
+			{ "-L", "--load", cmdline_arg_type_string,
+				"Load blob into RAM ( <file>@<address> e.g. initrd, dtb )",
+				[&](std::string s) { return parse_load_blob(s); } },
+			{ "-z", "--snapshot", cmdline_arg_type_string,
+				"Save snapshot at instret ( <file>@<instret> )",
+				[&](std::string s) { return parse_snapshot(s, "--snapshot"); } },
+			{ "-C", "--checkpoint", cmdline_arg_type_string,
+				"Save incremental checkpoints ( <file>@<interval> -> <file>.N )",
+				[&](std::string s) {
+					if (!parse_snapshot(s, "--checkpoint")) return false;
+					checkpoint_interval = snapshot_instret;
+					return true;
+				} },
+			{ "-Z", "--restore", cmdline_arg_type_string,
+				"Restore snapshot",
+				[&](std::string s) { restore_filename = s; return true; } },
+			{ "-k", "--disk", cmdline_arg_type_string,
+				"Attach a virtio block device backed by an image file",
+				[&](std::string s) { disk_filename = s; return true; } },
+			{ "-K", "--disk-overlay", cmdline_arg_type_string,
+				"Keep --disk writes in a copy-on-write overlay file",
+				[&](std::string s) { disk_overlay = s; return true; } },
+			{ "-N", "--native-sbi", cmdline_arg_type_none,
+				"Handle SBI calls from S-mode in the emulator instead of M-mode firmware",
+				[&](std::string s) { return (native_sbi = true); } },
+			{ "-H", "--harts", cmdline_arg_type_string,
+				"Number of harts each running on a host thread ( 1 - 4 )",
+				[&](std::string s) { return parse_integral(s, num_harts) && num_harts >= 1; } },
+			{ "-F", "--farm", cmdline_arg_type_string,
+				"Run the boot images listed in a file, one guest per image",
+				[&](std::string s) { farm_filename = s; return true; } },
+			{ "-W", "--workers", cmdline_arg_type_string,
+				"Number of host threads running --farm guests ( default: host cores )",
+				[&](std::string s) { return parse_integral(s, farm_workers) && farm_workers >= 1; } },
 			{ "-s", "--seed", cmdline_arg_type_string,
 				"Random seed",
 				[&](std::string s) { initial_seed = strtoull(s.c_str(), nullptr, 10); return true; } },
@@ -280,19 +479,49 @@ struct rv_emulator
 		auto result = cmdline_option::process_options(options, argc, argv);
 		if (!result.second) {
 			help_or_error = true;
-		} else if (result.first.size() < 1 && !help_or_error) {
+		} else if (result.first.size() < 1 && restore_filename.size() == 0 &&
+			farm_filename.size() == 0 && !help_or_error) {
 			printf("%s: wrong number of arguments\n", argv[0]);
 			help_or_error = true;
 		}
 
+		if (num_harts > 1 && (snapshot_filename.size() > 0 || restore_filename.size() > 0)) {
+			printf("%s: snapshots are not supported with --harts\n", argv[0]);
+			help_or_error = true;
+		}
+
+		if (num_harts > 1 && (proc_logs & proc_log_ebreak_cli)) {
+			printf("%s: --debug is not supported with --harts\n", argv[0]);
+			help_or_error = true;
+		}
+
+		if (disk_overlay.size() > 0 && disk_filename.size() == 0) {
+			printf("%s: --disk-overlay requires --disk\n", argv[0]);
+			help_or_error = true;
+		}
+
+		if (farm_filename.size() > 0 && (num_harts > 1 || result.first.size() > 0 ||
+			snapshot_filename.size() > 0 || restore_filename.size() > 0 ||
+			disk_filename.size() > 0 || trace_filename.size() > 0 ||
+			profile_filename.size() > 0 || wss_interval > 0 || log_triggers.size() > 0 ||
+			(proc_logs & proc_log_ebreak_cli)))
+		{
+			printf("%s: --farm does not take an image, --harts, --disk, --trace, --profile, --wss, log triggers, snapshots or --debug\n", argv[0]);
+			help_or_error = true;
+		}
+
 		if (help_or_error) {
 			printf("usage: %s [<options>] <elf_file>\n", argv[0]);
+			printf("       %s [<options>] --restore <snapshot>\n", argv[0]);
+			printf("       %s [<options>] --farm <job_list>\n", argv[0]);
 			cmdline_option::print_options(options);
 			exit(9);
 		}
 
 		/* get command line options */
-		boot_filename = result.first[0];
+		if (result.first.size() > 0) {
+			boot_filename = result.first[0];
+		}
 		for (size_t i = 0; i < result.first.size(); i++) {
 			host_cmdline.push_back(result.first[i]);
 		}
@@ -305,61 +534,43 @@ struct rv_emulator
 		}
 
 		/* load ELF */
-		if (ram_boot == 0) {
+		if (ram_boot == 0 && restore_filename.size() == 0 && farm_filename.size() == 0) {
 			elf.load(boot_filename, elf_load_headers);
 		}
 	}
 
-	/* Start the execuatable with the given privileged processor template */
-	template <typename P>
-	void start_priv()
+	/* load boot image symbols on first use, false for binary images and snapshots */
+	bool load_symbols()
 	{
-		/* setup floating point exception mask */
-		fenv_init();
-
-		/* instantiate processor, set log options and program counter to entry address */
-		P proc;
-		proc.log = proc_logs;
-		proc.mmu.mem->log = (proc.log & proc_log_memory);
-		proc.stats_dirname = stats_dirname;
-
-		/* randomise integer register state with 512 bits of entropy */
-		proc.seed_registers(cpu, initial_seed, 512);
+		if (ram_boot || boot_filename.size() == 0) return false;
+		if (symbols.symbols.size() == 0) symbols.load(boot_filename, elf_load_all);
+		return true;
+	}
 
+	/*
+	 * Map the boot image into the emulator mmu and initialize the processor
+	 *
+	 * Farm guests map the shared read-only segments of the image.
+	 */
+	template <typename P>
+	void load_priv(P &proc, elf_file &elf, std::string boot_filename, farm_image *image = nullptr)
+	{
 		/* ROM/FLASH exposed in the Config MMIO region */
 		typename P::ux rom_base = 0, rom_size = 0, rom_entry = 0;
 
 		if (ram_boot == 32 || ram_boot == 64) {
-			struct stat statbuf;
-			FILE *file = nullptr;
-			memory_segment<typename P::ux> *segment = nullptr;
-
 			/* Add 1GB RAM to the mmu */
 			proc.mmu.mem->add_ram(default_ram_base, default_ram_size);
 
-			addr_t ram_base = proc.mmu.mem->mpa_to_uva(segment, default_ram_base);
-			if (segment == nullptr) {
-				panic("unable to locate ram");
-			}
-			if (stat(boot_filename.c_str(), &statbuf) < 0) {
-				panic("unable to stat boot file: %s", boot_filename.c_str());
-			}
-			if (!(file = fopen(boot_filename.c_str(), "r"))) {
-				panic("unable to open boot file: %s", boot_filename.c_str());
-			}
-			ssize_t len = fread((void*)ram_base, 1, statbuf.st_size, file);
-			if (len != statbuf.st_size) {
-				panic("unable to read boot file: %s", boot_filename.c_str());
-			}
-			fclose(file);
+			/* Map boot image copy-on-write at the base of RAM */
 			rom_base = default_ram_base;
-			rom_size = statbuf.st_size;
+			rom_size = proc.mmu.mem->map_file(default_ram_base, boot_filename.c_str());
 			rom_entry = default_ram_base;
 		} else {
 			/* Find the ELF executable PT_LOAD segment base address */
 			for (size_t i = 0; i < elf.phdrs.size(); i++) {
 				Elf64_Phdr &phdr = elf.phdrs[i];
-				if (phdr.p_flags & (PT_LOAD | PT_DYNAMIC)) {
+				if (phdr.p_type == PT_LOAD) {
 					if (rom_base == 0) rom_base = phdr.p_vaddr;
 					rom_size = phdr.p_vaddr + phdr.p_memsz - rom_base;
 				}
@@ -369,7 +580,13 @@ struct rv_emulator
 			typename P::ux map_offset = map_physical == 0 ? 0 : rom_base - map_physical;
 			for (size_t i = 0; i < elf.phdrs.size(); i++) {
 				Elf64_Phdr &phdr = elf.phdrs[i];
-				if (phdr.p_flags & (PT_LOAD | PT_DYNAMIC)) {
+				if (phdr.p_type != PT_LOAD) continue;
+				if (image && image->mappings.find(i) != image->mappings.end()) {
+					addr_t map_delta = phdr.p_offset & (page_size-1);
+					proc.mmu.mem->add_shared_mmap(phdr.p_vaddr - map_offset - map_delta,
+						image->mappings[i], round_up(phdr.p_memsz + map_delta, page_size),
+						pma_type_main | elf_pma_flags(phdr.p_flags));
+				} else {
 					map_load_segment_priv(proc, boot_filename.c_str(), phdr, phdr.p_vaddr - map_offset);
 				}
 			}
@@ -380,16 +597,95 @@ struct rv_emulator
 			proc.mmu.mem->add_ram(default_ram_base, default_ram_size);
 		}
 
+		/* Map additional blobs (initrd, device tree) copy-on-write into RAM */
+		for (auto &blob : load_blobs) {
+			proc.mmu.mem->map_file(blob.second, blob.first.c_str());
+		}
+
 		/* Initialize interpreter */
 		proc.init();
 		proc.reset(); /* Reset code calls mapped ROM image */
-		proc.device_config->num_harts = 1;
+		proc.device_config->num_harts = proc.num_harts;
 		proc.device_config->time_base = 1000000000;
 		proc.device_config->rom_base = rom_base;
 		proc.device_config->rom_size = rom_size;
 		proc.device_config->rom_entry = rom_entry;
 		proc.device_config->ram_base = default_ram_base;
 		proc.device_config->ram_size = default_ram_size;
+	}
+
+	/* Start the execuatable with the given privileged processor template */
+	template <typename P>
+	void start_priv()
+	{
+		/* setup floating point exception mask */
+		fenv_init();
+
+		/* check the number of harts supported by the devices */
+		if (num_harts > P::max_harts) {
+			panic("--harts: maximum number of harts is %d", P::max_harts);
+		}
+
+		/* instantiate node, set log options and program counter to entry address */
+		node<P> machine(num_harts);
+		P &proc = machine.primary();
+		proc.log = proc_logs;
+		proc.mmu.mem->log = (proc.log & proc_log_memory);
+		proc.mmu.mem->mmio_summary = (proc.log & proc_log_mmio_summary);
+		proc.stats_dirname = stats_dirname;
+		proc.disk_filename = disk_filename;
+		proc.disk_overlay = disk_overlay;
+		proc.native_sbi = native_sbi;
+
+		/* randomise integer register state with 512 bits of entropy */
+		proc.seed_registers(cpu, initial_seed, 512);
+
+		if (restore_filename.size() > 0) {
+			/* Map snapshot memory, initialize devices then restore state */
+			snapshot_map_memory(proc, restore_filename);
+			proc.init();
+			proc.reset();
+			snapshot_load_state(proc, restore_filename);
+		} else {
+			load_priv(proc, elf, boot_filename);
+		}
+
+		/* resolve logging window symbols in the boot image */
+		proc.window.resolve = [&](std::string name, addr_t &addr) {
+			auto sym = load_symbols() ? symbols.sym_by_name(name.c_str()) : nullptr;
+			if (!sym) return false;
+			addr = sym->st_value;
+			return true;
+		};
+		proc.window.init(log_triggers, proc.log);
+		proc.roi_init(roi_gate);
+		if (profile_filename.size() > 0) {
+			proc.profile = std::make_shared<guest_profile>(profile_filename,
+				[&](addr_t pc) {
+					auto sym = load_symbols() ? symbols.sym_by_nearest_addr(pc) : nullptr;
+					return sym ? std::string(symbols.sym_name(sym)) : format_string("0x%llx", pc);
+				}, profile_interval, profile_host_time, true);
+		}
+		if (wss_interval > 0) {
+			proc.wss = std::make_shared<guest_wss>(wss_prefix, wss_interval, [&] {
+				std::vector<wss_region> regions;
+				for (auto &seg : proc.mmu.mem->segments) {
+					regions.push_back(wss_region{ seg->name, seg->mpa, seg->mpa + seg->size });
+				}
+				return regions;
+			});
+		}
+
+		/* secondary harts share memory and devices with the first hart */
+		if (trace_filename.size() > 0) proc.trace_open(trace_filename);
+		if (stats) proc.stats_attach(stats);
+		machine.attach();
+
+		/* snapshot at instret or checkpoint at intervals from the current instret */
+		proc.snapshot_filename = snapshot_filename;
+		proc.checkpoint_interval = checkpoint_interval;
+		proc.snapshot_instret = checkpoint_interval ?
+			proc.instret + checkpoint_interval : snapshot_instret;
 
 #if defined (ENABLE_GPERFTOOL)
 		ProfilerStart("test-emulate.out");
@@ -400,14 +696,177 @@ struct rv_emulator
 		 *
 		 * when --debug flag is present we start in the debugger
 		 */
-		proc.run(proc.log & proc_log_ebreak_cli
+		machine.run(proc.log & proc_log_ebreak_cli
 			? exit_cause_cli : exit_cause_continue);
 
+		for (auto &hart : machine.harts) {
+			hart->trace_close();
+			hart->profile_close();
+			hart->wss_close();
+			hart->print_phase_profile(format_string("hart %d", int(hart->hart_id)));
+			hart->print_roi(format_string("hart %d", int(hart->hart_id)));
+		}
+		if (stats) stats->close();
+
+		if (proc.log & proc_log_mmio_summary) {
+			proc.mmu.mem->print_mmio_summary();
+		}
+
 #if defined (ENABLE_GPERFTOOL)
 		ProfilerStop();
 #endif
 	}
 
+	/* Run one farm guest to completion on the calling thread */
+	template <typename P>
+	void run_farm_guest(farm_image &image, size_t job)
+	{
+		node<P> machine(1);
+		P &proc = machine.primary();
+		proc.log = proc_logs;
+		proc.mmu.mem->log = (proc.log & proc_log_memory);
+		proc.stats_dirname = stats_dirname;
+		proc.console_interactive = false;
+		proc.native_sbi = native_sbi;
+		proc.seed_registers(cpu, initial_seed, 512);
+		load_priv(proc, image.elf, image.filename, &image);
+		proc.roi_init(roi_gate);
+		if (stats) proc.stats_attach(stats);
+		machine.attach();
+
+		/* the first guest decodes the shared text segments, the rest copy the result */
+		std::call_once(image.decode_once, [&] {
+			auto cache = new typename P::rv_inst_cache_ent[P::inst_cache_size]();
+			for (auto &ent : image.mappings) {
+				Elf64_Phdr &phdr = image.elf.phdrs[ent.first];
+				if (phdr.p_flags & PF_X) {
+					proc.decode_inst_cache(cache, addr_t(ent.second.get()) +
+						(phdr.p_offset & (page_size-1)), phdr.p_filesz);
+				}
+			}
+			image.inst_cache = std::shared_ptr<void>(cache,
+				[](void *p) { delete [] static_cast<typename P::rv_inst_cache_ent*>(p); });
+		});
+		proc.load_inst_cache(static_cast<typename P::rv_inst_cache_ent*>(image.inst_cache.get()));
+
+		u64 start = cpu.get_time_ns();
+		machine.run(exit_cause_continue);
+		u64 elapsed = cpu.get_time_ns() - start;
+		printf("farm: job %zu: %s instret %llu time %.3f s\n", job, image.filename.c_str(),
+			(u64)proc.instret, elapsed / 1e9);
+		proc.print_roi(format_string("job %zu", job));
+
+		/* block signals until the next guest on this thread unblocks them in init */
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGTERM);
+		sigaddset(&set, SIGQUIT);
+		sigaddset(&set, SIGINT);
+		sigaddset(&set, SIGHUP);
+		sigaddset(&set, SIGUSR1);
+		if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+			panic("can't set thread signal mask: %s", strerror(errno));
+		}
+		processor_singleton::current = nullptr;
+	}
+
+	/* Read the farm job list: one boot image per line, # comments */
+	std::vector<std::string> read_farm_jobs()
+	{
+		std::vector<std::string> jobs;
+		std::ifstream in(farm_filename);
+		if (!in.is_open()) {
+			panic("--farm: error: can't open %s", farm_filename.c_str());
+		}
+		std::string line;
+		while (std::getline(in, line)) {
+			size_t hash = line.find('#');
+			if (hash != std::string::npos) line.erase(hash);
+			size_t first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos) continue;
+			size_t last = line.find_last_not_of(" \t\r");
+			jobs.push_back(line.substr(first, last - first + 1));
+		}
+		return jobs;
+	}
+
+	/*
+	 * Run many independent guests on a pool of worker threads
+	 *
+	 * Each guest has its own memory, devices and batch console. Workers
+	 * take the next job from the list until it is exhausted.
+	 */
+	void exec_farm()
+	{
+		/* parse each distinct image once and map its read-only segments */
+		std::vector<std::string> jobs = read_farm_jobs();
+		std::map<std::string,std::shared_ptr<farm_image>> images;
+		for (auto &filename : jobs) {
+			if (images.find(filename) != images.end()) continue;
+			auto image = std::make_shared<farm_image>();
+			image->filename = filename;
+			if (ram_boot == 0) {
+				image->elf.load(filename, elf_load_headers);
+				if (image->elf.ei_class != ELFCLASS32 && image->elf.ei_class != ELFCLASS64) {
+					panic("--farm: error: unsupported ELF class: %s", filename.c_str());
+				}
+				for (size_t i = 0; i < image->elf.phdrs.size(); i++) {
+					Elf64_Phdr &phdr = image->elf.phdrs[i];
+					if (phdr.p_type == PT_LOAD && !(phdr.p_flags & PF_W)) {
+						image->mappings[i] = map_shared_segment(filename.c_str(), phdr);
+					}
+				}
+			} else if (ram_boot != 32 && ram_boot != 64) {
+				panic("--boot option must be 32 or 64");
+			}
+			images[filename] = image;
+		}
+
+		/*
+		 * block signals on this thread and the workers it starts. Each guest
+		 * unblocks them on its worker in init and they are blocked again when
+		 * it powers off, so a signal is delivered to one running guest and is
+		 * handled by that guest alone.
+		 */
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGTERM);
+		sigaddset(&set, SIGQUIT);
+		sigaddset(&set, SIGINT);
+		sigaddset(&set, SIGHUP);
+		sigaddset(&set, SIGUSR1);
+		if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+			panic("can't set thread signal mask: %s", strerror(errno));
+		}
+
+		size_t num_workers = farm_workers > 0 ? size_t(farm_workers)
+			: std::max(1U, std::thread::hardware_concurrency());
+		num_workers = std::min(num_workers, jobs.size());
+
+		std::atomic<size_t> next_job(0);
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < num_workers; i++) {
+			workers.push_back(std::thread([&] {
+				fenv_init();
+				size_t job;
+				while ((job = next_job++) < jobs.size()) {
+					farm_image &image = *images[jobs[job]];
+					int xlen = ram_boot ? int(ram_boot) :
+						image.elf.ei_class == ELFCLASS32 ? 32 : 64;
+					if (xlen == 32) {
+						run_farm_guest<priv_emulator_rv32imafdc>(image, job);
+					} else {
+						run_farm_guest<priv_emulator_rv64imafdc>(image, job);
+					}
+				}
+			}));
+		}
+		for (auto &worker : workers) {
+			worker.join();
+		}
+		if (stats) stats->close();
+	}
+
 	/* Start a specific processor implementation based on ELF type and ISA extensions */
 	void exec()
 	{
@@ -418,8 +877,28 @@ struct rv_emulator
 		}
 		#endif
 
+		/* harts and farm guests share one exporter */
+		if (stats_target.size() > 0) {
+			stats = std::make_shared<stats_export>("rv-sys", stats_target,
+				stats_output_format, stats_interval);
+			stats->start();
+		}
+
 		/* execute */
-		if (ram_boot == 0) {
+		if (farm_filename.size() > 0) {
+			exec_farm();
+		}
+		else if (restore_filename.size() > 0) {
+			switch (snapshot_xlen(restore_filename)) {
+				case 32:
+					start_priv<priv_emulator_rv32imafdc>(); break;
+				case 64:
+					start_priv<priv_emulator_rv64imafdc>(); break;
+				default:
+					panic("--restore: unsupported snapshot xlen");
+			}
+		}
+		else if (ram_boot == 0) {
 			switch (elf.ei_class) {
 				case ELFCLASS32:
 					start_priv<priv_emulator_rv32imafdc>(); break;
@@ -0,0 +1,202 @@
+//
+//  rv-trace.cc
+//
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "host-endian.h"
+#include "types.h"
+#include "bits.h"
+#include "format.h"
+#include "meta.h"
+#include "util.h"
+#include "cmdline.h"
+#include "codec.h"
+#include "strings.h"
+#include "disasm.h"
+#include "processor-trace.h"
+
+using namespace riscv;
+
+struct rv_trace_range
+{
+	u64 start = 0;
+	u64 end = u64(-1);
+
+	bool contains(u64 v) { return v >= start && v < end; }
+
+	/* <start>[-<end>] or <start>+<length> */
+	bool parse(std::string s)
+	{
+		char *p;
+		start = strtoull(s.c_str(), &p, 0);
+		if (p == s.c_str()) return false;
+		if (*p == '-') end = strtoull(p + 1, &p, 0);
+		else if (*p == '+') end = start + strtoull(p + 1, &p, 0);
+		else end = start + 1;
+		return *p == '\0' && end > start;
+	}
+};
+
+struct rv_trace
+{
+	std::string filename;
+	bool help_or_error = false;
+	bool info = false;
+	bool memory_only = false;
+	bool no_pseudo = false;
+	bool addr_filter = false;
+	rv_trace_range instret;
+	rv_trace_range pc;
+	rv_trace_range addr;
+
+	std::string format_inst(inst_t inst)
+	{
+		switch (inst_length(inst)) {
+			case 2:  return format_string("%04llx    ", inst);
+			case 4:  return format_string("%08llx", inst);
+			default: return format_string("%016llx", inst);
+		}
+	}
+
+	void print_record(trace_reader &reader, trace_record &r)
+	{
+		decode dec;
+		switch (reader.hdr.xlen) {
+			case 32: decode_inst_rv32(dec, r.inst); break;
+			default: decode_inst_rv64(dec, r.inst); break;
+		}
+		if (!no_pseudo) decode_pseudo_inst(dec);
+		std::string args = disasm_inst_simple(dec);
+		std::string result;
+		if (r.flags & trace_ireg) {
+			result += format_string("%s=0x%llx", rv_ireg_name_sym[r.rd], r.val);
+		} else if (r.flags & trace_freg) {
+			result += format_string("%s=0x%llx", rv_freg_name_sym[r.rd], r.val);
+		}
+		if (r.flags & trace_addr) {
+			if (result.size() > 0) result += " ";
+			result += format_string("[0x%llx]", r.addr);
+		}
+		printf(reader.hdr.xlen == 32 ?
+			"%019llu core-%-4llu:%08llx (%s) %-30s %s\n" :
+			"%019llu core-%-4llu:%016llx (%s) %-30s %s\n",
+			r.instret, reader.hdr.hart_id, r.pc, format_inst(r.inst).c_str(),
+			args.c_str(), result.c_str());
+	}
+
+	void print_info()
+	{
+		trace_reader reader(filename);
+		u64 chunks = 0, records = 0, raw_bytes = 0, comp_bytes = 0;
+		u64 first = 0, last = 0;
+		while (reader.next_chunk()) {
+			if (chunks++ == 0) first = reader.chunk.instret;
+			last = reader.chunk.instret_end;
+			records += reader.chunk.count;
+			raw_bytes += reader.chunk.raw_size;
+			comp_bytes += reader.chunk.comp_size;
+		}
+		printf("%s: rv%u hart=%llu chunks=%llu records=%llu instret=%llu-%llu\n",
+			filename.c_str(), reader.hdr.xlen, reader.hdr.hart_id,
+			chunks, records, first, last);
+		printf("%s: raw=%llu compressed=%llu ratio=%.2f bytes/inst=%.2f\n",
+			filename.c_str(), raw_bytes, comp_bytes,
+			comp_bytes ? double(raw_bytes) / comp_bytes : 0.0,
+			records ? double(comp_bytes) / records : 0.0);
+	}
+
+	void print_trace()
+	{
+		trace_reader reader(filename);
+		trace_record r;
+		while (reader.next_chunk()) {
+			if (reader.chunk.instret_end <= instret.start) continue;
+			if (reader.chunk.instret >= instret.end) break;
+			reader.load_chunk();
+			while (reader.next(r)) {
+				if (!instret.contains(r.instret) || !pc.contains(r.pc)) continue;
+				if ((memory_only || addr_filter) &&
+					(!(r.flags & trace_addr) || !addr.contains(r.addr))) continue;
+				print_record(reader, r);
+			}
+		}
+	}
+
+	void parse_commandline(int argc, const char *argv[])
+	{
+		cmdline_option options[] =
+		{
+			{ "-i", "--info", cmdline_arg_type_none,
+				"Print trace summary",
+				[&](std::string s) { return (info = true); } },
+			{ "-s", "--instret", cmdline_arg_type_string,
+				"Instructions retired in range ( <start>[-<end>] or <start>+<count> )",
+				[&](std::string s) { return instret.parse(s); } },
+			{ "-p", "--pc", cmdline_arg_type_string,
+				"Program counter in range ( <start>[-<end>] or <start>+<length> )",
+				[&](std::string s) { return pc.parse(s); } },
+			{ "-a", "--address", cmdline_arg_type_string,
+				"Load or store address in range ( <start>[-<end>] or <start>+<length> )",
+				[&](std::string s) { return (addr_filter = addr.parse(s)); } },
+			{ "-m", "--memory", cmdline_arg_type_none,
+				"Only loads and stores",
+				[&](std::string s) { return (memory_only = true); } },
+			{ "-x", "--no-pseudo", cmdline_arg_type_none,
+				"Disable Pseudoinstruction decoding",
+				[&](std::string s) { return (no_pseudo = true); } },
+			{ "-h", "--help", cmdline_arg_type_none,
+				"Show help",
+				[&](std::string s) { return (help_or_error = true); } },
+			{ nullptr, nullptr, cmdline_arg_type_none,   nullptr, nullptr }
+		};
+
+		auto result = cmdline_option::process_options(options, argc, argv);
+		if (!result.second) {
+			help_or_error = true;
+		} else if (result.first.size() != 1 && !help_or_error) {
+			printf("%s: wrong number of arguments\n", argv[0]);
+			help_or_error = true;
+		}
+
+		if (help_or_error) {
+			printf("usage: %s [<options>] <trace_file>\n", argv[0]);
+			cmdline_option::print_options(options);
+			exit(9);
+		}
+
+		filename = result.first[0];
+	}
+
+	void run()
+	{
+		if (info) {
+			print_info();
+		} else {
+			print_trace();
+		}
+	}
+};
+
+int rv_trace_main(int argc, const char *argv[])
+{
+	rv_trace trace;
+	trace.parse_commandline(argc, argv);
+	trace.run();
+	return 0;
+}
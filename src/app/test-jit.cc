@@ -26,7 +26,10 @@
 #include <random>
 #include <deque>
 #include <map>
+#include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <type_traits>
 
@@ -46,6 +49,9 @@
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "host-endian.h"
 #include "types.h"
@@ -70,12 +76,21 @@
 #include "amo.h"
 #include "processor-logging.h"
 #include "processor-base.h"
+#include "processor-trace.h"
+#include "processor-window.h"
+#include "processor-profile.h"
+#include "processor-bbv.h"
+#include "processor-wss.h"
+#include "processor-phase.h"
+#include "processor-stats.h"
+#include "processor-roi.h"
 #include "processor-impl.h"
 #include "interp.h"
 #include "processor-model.h"
 #include "mmu-proxy.h"
 #include "mmap-core.h"
 #include "unknown-abi.h"
+#include "processor-syscall.h"
 #include "processor-histogram.h"
 #include "processor-proxy.h"
 #include "debug-cli.h"
@@ -5,11 +5,16 @@
 #include <cstdint>
 
 #include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 
+#include "mmap-core.h"
+
 #if defined (__APPLE__)
 typedef char mincore_char_t;
 #else
@@ -69,10 +74,66 @@ void scan_memory(std::vector<mem_range_t> &map, uintptr_t start, size_t length)
 #endif
 }
 
+/*
+ * each thread keeps a window of live guest mappings of random sizes and
+ * replaces a random one per cycle so the free space stays fragmented
+ */
+void bench_thread(size_t id, size_t cycles, size_t window)
+{
+	std::vector<std::pair<void*,size_t>> live(window, std::make_pair(nullptr, 0));
+	std::mt19937 rng(id);
+	for (size_t i = 0; i < cycles; i++) {
+		auto &ent = live[rng() % window];
+		if (ent.first && guest_munmap(ent.first, ent.second) != 0) {
+			printf("guest_munmap failed: %s\n", strerror(errno));
+			exit(9);
+		}
+		ent.second = (1 + rng() % 16) * page_size;
+		ent.first = guest_mmap(nullptr, ent.second, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0, GUEST_MMAP_LIMIT_64);
+		if (ent.first == MAP_FAILED) {
+			printf("guest_mmap failed: %s\n", strerror(errno));
+			exit(9);
+		}
+	}
+	for (auto &ent : live) {
+		if (ent.first) guest_munmap(ent.first, ent.second);
+	}
+}
+
+void bench_mmap(size_t num_threads, size_t cycles, size_t window)
+{
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < num_threads; i++) {
+		threads.push_back(std::thread(bench_thread, i, cycles, window));
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	auto end = std::chrono::steady_clock::now();
+	double secs = std::chrono::duration<double>(end - start).count();
+	size_t ops = num_threads * cycles;
+	printf("threads=%zu cycles=%zu window=%zu time=%.3fs %.0f ns/cycle %.0f cycles/s\n",
+		num_threads, cycles, window, secs, secs * 1e9 / ops, ops / secs);
+}
+
 int main(int argc, char **argv)
 {
-	std::vector<mem_range_t> map;
 	page_size = getpagesize();
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		size_t num_threads = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1;
+		size_t cycles = argc > 3 ? strtoull(argv[3], nullptr, 10) : 100000;
+		size_t window = argc > 4 ? strtoull(argv[4], nullptr, 10) : 1024;
+		if (num_threads == 0 || cycles == 0 || window == 0) {
+			printf("usage: %s bench [<threads> [<cycles> [<window>]]]\n"
+				"threads, cycles and window must be greater than zero\n", argv[0]);
+			return 9;
+		}
+		bench_mmap(num_threads, cycles, window);
+		return 0;
+	}
+	std::vector<mem_range_t> map;
 	scan_memory(map, 0, 0x100000000UL);
 	print_map(map);
 	return 0;
@@ -17,8 +17,13 @@
 #include <vector>
 #include <limits>
 #include <map>
+#include <mutex>
+#include <atomic>
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "host-endian.h"
 #include "types.h"
@@ -31,6 +36,8 @@
 #include "codec.h"
 #include "processor-logging.h"
 #include "processor-base.h"
+#include "processor-hpm.h"
+#include "processor-phase.h"
 #include "pte.h"
 #include "pma.h"
 #include "amo.h"
@@ -772,11 +772,9 @@ const char* elf_file::sym_name(const Elf64_Sym *sym)
 
 const Elf64_Sym* elf_file::sym_by_nearest_addr(Elf64_Addr addr)
 {
-	auto ai = addr_symbol_map.lower_bound(addr);
-	if (ai == addr_symbol_map.end()) return nullptr;
-	if (ai->second == addr) return &symbols[ai->second];
-	if (ai != addr_symbol_map.begin()) ai--;
-	return &symbols[ai->second];
+	auto ai = addr_symbol_map.upper_bound(addr);
+	if (ai == addr_symbol_map.begin()) return nullptr;
+	return &symbols[(--ai)->second];
 }
 
 const Elf64_Sym* elf_file::sym_by_addr(Elf64_Addr addr)
@@ -61,6 +61,49 @@ namespace riscv {
 		}
 		return 0;
 	}
+
+	/*
+	 * Host atomic operations on RAM-backed guest memory
+	 *
+	 * The host address is accessed as std::atomic<T> so AMOs issued by harts
+	 * or guest threads running on different host threads are atomic with
+	 * respect to each other. AMOs without a native host operation use a
+	 * compare and swap loop. Both return the original memory value.
+	 */
+
+	template <typename T> std::atomic<T>* amo_host_ptr(addr_t uva)
+	{
+		static_assert(sizeof(std::atomic<T>) == sizeof(T), "std::atomic<T> is not lock free");
+		return reinterpret_cast<std::atomic<T>*>(uva);
+	}
+
+	template <typename T> T amo_atomic(amo_op op, addr_t uva, T val)
+	{
+		typedef typename std::make_unsigned<T>::type U;
+		std::atomic<T> *ptr = amo_host_ptr<T>(uva);
+		switch (op) {
+			case amoswap: return ptr->exchange(val);
+			case amoadd:  return ptr->fetch_add(val);
+			case amoxor:  return ptr->fetch_xor(val);
+			case amoor:   return ptr->fetch_or(val);
+			case amoand:  return ptr->fetch_and(val);
+			default: break;
+		}
+		T old = ptr->load(std::memory_order_relaxed);
+		while (!ptr->compare_exchange_weak(old, T(amo_fn<U>(op, U(old), U(val)))));
+		return old;
+	}
+
+	template <typename T> T lr_atomic(addr_t uva)
+	{
+		return amo_host_ptr<T>(uva)->load();
+	}
+
+	/* store conditional succeeds if memory still holds the value loaded by lr */
+	template <typename T> bool sc_atomic(addr_t uva, T expect, T val)
+	{
+		return amo_host_ptr<T>(uva)->compare_exchange_strong(expect, val);
+	}
 }
 
 #endif
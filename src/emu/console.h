@@ -7,7 +7,13 @@
 
 namespace riscv {
 
-	/* Console Thread */
+	/*
+	 * Console Thread
+	 *
+	 * An interactive console puts the terminal in raw mode and reads
+	 * input from stdin. A batch console (used by --farm) only writes
+	 * output to stdout and leaves the terminal alone.
+	 */
 
 	template <typename P>
 	struct console_device
@@ -19,15 +25,19 @@ namespace riscv {
 		queue_atomic<char> queue;
 		volatile bool running;
 		volatile bool suspended;
+		bool interactive;
+		bool input_eof;
 		std::thread thread;
 
-		console_device(P &proc) :
+		console_device(P &proc, bool interactive = true) :
 			proc(proc),
 			pipefds{0},
 			pollfds(),
 			queue(1024),
 			running(true),
 			suspended(false),
+			interactive(interactive),
+			input_eof(false),
 			thread(&console_device::mainloop, this)
 		{}
 
@@ -44,7 +54,7 @@ namespace riscv {
 			if (pollfds[0].revents & POLLIN) {
 				if ((ret = read(pipefds[0], buf, (sizeof(buf)))) < 0) {
 					debug("console: socket: read: %s", strerror(errno));
-				} else if (write(STDIN_FILENO, buf, ret) < 0) {
+				} else if (write(interactive ? STDIN_FILENO : STDOUT_FILENO, buf, ret) < 0) {
 					debug("console: socket: write: %s", strerror(errno));
 				}
 			}
@@ -55,9 +65,12 @@ namespace riscv {
 			char buf[256];
 			ssize_t ret;
 
-			if (pollfds[1].revents & POLLIN) {
+			if (pollfds[1].revents & (POLLIN | POLLHUP)) {
 				if ((ret = read(STDIN_FILENO, buf, (sizeof(buf)))) < 0) {
 					debug("console: stdin: read: %s", strerror(errno));
+				} else if (ret == 0) {
+					/* stop polling stdin at end of file */
+					input_eof = true;
 				} else {
 					proc.intr_mutex.lock();
 					for (ssize_t i = 0; i < ret; i++) {
@@ -65,6 +78,7 @@ namespace riscv {
 					}
 					proc.intr_cond.notify_one();
 					proc.intr_mutex.unlock();
+					proc.sched.post(0);
 				}
 			}
 		}
@@ -75,19 +89,22 @@ namespace riscv {
 			open_pipe();
 			configure_console();
 			while (running) {
-				pollfds.resize(2);
+				bool input = interactive && !input_eof;
+				pollfds.resize(input ? 2 : 1);
 				pollfds[0].fd = pipefds[0];
 				pollfds[0].events = POLLIN;
 				pollfds[0].revents = 0;
-				pollfds[1].fd = STDIN_FILENO;
-				pollfds[1].events = POLLIN;
-				pollfds[1].revents = 0;
+				if (input) {
+					pollfds[1].fd = STDIN_FILENO;
+					pollfds[1].events = POLLIN;
+					pollfds[1].revents = 0;
+				}
 				if (poll(pollfds.data(), pollfds.size(), -1) < 0 && errno != EINTR) {
 					panic("console poll failed: %s", strerror(errno));
 				}
 				process_output();
 				if (!running) break;
-				if (suspended) continue;
+				if (suspended || !input) continue;
 				process_input();
 			}
 			restore_console();
@@ -140,6 +157,7 @@ namespace riscv {
 		/* setup console */
 		void configure_console()
 		{
+			if (!interactive) return;
 			tcgetattr(STDIN_FILENO, &old_tio);
 			new_tio = old_tio;
 			new_tio.c_lflag &=(~ICANON & ~ECHO);
@@ -150,6 +168,7 @@ namespace riscv {
 		void restore_console()
 		{
 			/* restore settings */
+			if (!interactive) return;
 			tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
 		}
 
@@ -59,11 +59,14 @@ namespace riscv {
 			add_command(cmd_hex,    2, 3, "hex",    "<addr> [b|s|w|d]", "Hex Dump Memory");
 			add_command(cmd_ascii,  2, 2, "ascii",  "<addr>",           "ASCII Dump Memory");
 			add_command(cmd_break,  1, 2, "break",  "[<addr>]",         "Set or display breakpoint");
+			add_command(cmd_log,    1, 3, "log",    "[on|off [<trig>]|clear]",  "Show or set logging window");
 			add_command(cmd_mem,    1, 1, "map",    "",                 "Show memory map");
 			add_command(cmd_hist,   2, 3, "hist",   "reg|pc [rev]",     "Show histogram");
+			add_command(cmd_hpm,    1, 1, "hpm",    "",                 "Show performance counters");
 			add_command(cmd_quit,   1, 1, "quit",   "",                 "End Simulation");
 			add_command(cmd_reg,    1, 1, "reg",    "",                 "Show Registers");
 			add_command(cmd_run,    1, 2, "run",    "[count]",          "Step processor");
+			add_command(cmd_snap,   2, 2, "snapshot", "<file>",         "Save machine snapshot");
 		}
 
 		void add_command(cmd_fn fn, size_t min_args, size_t max_args,
@@ -134,6 +137,12 @@ namespace riscv {
 			return 0;
 		}
 
+		static size_t cmd_hpm(cmd_state &st, args_t &args)
+		{
+			st.proc->print_hpm_counters();
+			return 0;
+		}
+
 		static size_t cmd_help(cmd_state &st, args_t &args)
 		{
 			st.cli->help();
@@ -247,6 +256,27 @@ namespace riscv {
 			return 0;
 		}
 
+		static size_t cmd_log(cmd_state &st, args_t &args)
+		{
+			auto &window = st.proc->window;
+			std::string err;
+			if (args.size() == 1) {
+				window.print();
+			} else if (args.size() == 2 && args[1] == "clear") {
+				window.clear(st.proc->log);
+			} else if (args[1] != "on" && args[1] != "off") {
+				printf("%s: expected on, off or clear\n", args[0].c_str());
+			} else if (args.size() == 2) {
+				window.set(args[1] == "on", st.proc->log);
+			} else {
+				window.default_flags();
+				if (!window.add(args[2], args[1] == "on", err)) {
+					printf("%s: %s\n", args[0].c_str(), err.c_str());
+				}
+			}
+			return 0;
+		}
+
 		static size_t cmd_mem(cmd_state &st, args_t &args)
 		{
 			st.proc->mmu.mem->print_memory_map();
@@ -266,6 +296,18 @@ namespace riscv {
 			return size_t(inst_count);
 		}
 
+		static size_t cmd_snap(cmd_state &st, args_t &args)
+		{
+			if (st.proc->save_snapshot(args[1])) {
+				printf("snapshot saved to %s at instret %llu\n",
+					args[1].c_str(), (u64)st.proc->instret);
+			} else {
+				printf("%s: unable to save snapshot: %s\n",
+					args[0].c_str(), args[1].c_str());
+			}
+			return 0;
+		}
+
 		static size_t cmd_reg(cmd_state &st, args_t &args)
 		{
 			st.proc->print_csr_registers();
@@ -57,6 +57,18 @@ namespace riscv {
 			debug("cfg_mmio :ram_size         0x%llx", ram_size);
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(num_harts);
+			s(time_base);
+			s(rom_base);
+			s(rom_size);
+			s(rom_entry);
+			s(ram_base);
+			s(ram_size);
+		}
+
 		/* Config MMIO */
 
 		buserror_t load_8 (UX va, u8  &val)
@@ -63,6 +63,12 @@ namespace riscv {
 			debug("gpio_mmio:out              0x%08x", gpio.out);
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(gpio);
+		}
+
 		void service()
 		{
 			plic->set_irq(irq, (gpio.ie & gpio.ip) ? 1 : 0);
@@ -71,7 +77,7 @@ namespace riscv {
 		void trigger()
 		{
 			if (gpio.out & OUT_POWER_OFF) {
-				proc.raise(P::internal_cause_poweroff, proc.pc);
+				proc.poweroff();
 			}
 			if (gpio.out & OUT_RESET) {
 				proc.reset();
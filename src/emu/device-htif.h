@@ -47,6 +47,13 @@ namespace riscv {
 			debug("htif_mmio:htif_fromhost    %llu", htif_fromhost);
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(htif_tohost);
+			s(htif_fromhost);
+		}
+
 		inline u64 htif_device_command(u8 device, u8 command) {
 			return ((u64)device << 56) | ((u64)command << 48);
 		}
@@ -57,11 +64,16 @@ namespace riscv {
 		void handle_output()
 		{
 			if (htif_tohost == 1) {
-				proc.raise(P::internal_cause_poweroff, proc.pc);
+				proc.poweroff();
 			}
 			u8 device = htif_device(htif_tohost);
 			u8 command = htif_command(htif_tohost);
-			if (device == 1) {
+			if (device == roi_htif_device) {
+				proc.roi_command(proc, command);
+				htif_tohost = 0;
+				htif_fromhost = htif_device_command(device, command);
+			}
+			else if (device == 1) {
 				switch (command) {
 					case 0:
 						htif_tohost = 0;
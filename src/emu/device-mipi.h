@@ -17,7 +17,7 @@ namespace riscv {
 		enum {
 			bits_per_word = sizeof(u32) << 3,
 			num_harts = NUM_HARTS,
-			total_size = bits_per_word * num_harts
+			total_size = sizeof(u32) * num_harts
 		};
 
 		P &proc;
@@ -47,10 +47,25 @@ namespace riscv {
 			}
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(hart);
+		}
+
 		void signal_ipi(UX hart_id, u32 value)
 		{
 			if (hart_id >= num_harts) return;
-			hart[num_harts] |= (1ULL << (hart_id & (bits_per_word-1)));
+			hart[hart_id] |= value;
+			proc.wake_hart(hart_id);
+		}
+
+		/* wake harts sleeping in wfi that have an ipi pending */
+		void wake_pending()
+		{
+			for (size_t i = 0; i < num_harts; i++) {
+				if (hart[i]) proc.wake_hart(i);
+			}
 		}
 
 		bool ipi_pending(UX hart_id)
@@ -103,6 +118,7 @@ namespace riscv {
 				printf("mipi_mmio:0x%04llx <- 0x%02hhx\n", addr_t(va), val);
 			}
 			if (va < total_size) *(as_u8() + va) = val;
+			wake_pending();
 			return 0;
 		}
 
@@ -112,6 +128,7 @@ namespace riscv {
 				printf("mipi_mmio:0x%04llx <- 0x%04hx\n", addr_t(va), val);
 			}
 			if (va < total_size - 1) *(as_u16() + (va>>1)) = val;
+			wake_pending();
 			return 0;
 		}
 
@@ -121,6 +138,7 @@ namespace riscv {
 				printf("mipi_mmio:0x%04llx <- 0x%08x\n", addr_t(va), val);
 			}
 			if (va < total_size - 3) *(as_u32() + (va>>2)) = val;
+			wake_pending();
 			return 0;
 		}
 
@@ -130,6 +148,7 @@ namespace riscv {
 				printf("mipi_mmio:0x%04llx <- 0x%016llx\n", addr_t(va), val);
 			}
 			if (va < total_size - 7) *(as_u64() + (va>>3)) = val;
+			wake_pending();
 			return 0;
 		}
 
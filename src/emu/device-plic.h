@@ -38,6 +38,13 @@ namespace riscv {
 			debug("plic_mmio:served           0b%016llx", served);
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(pending);
+			s(served);
+		}
+
 		void set_irq(UX irq, int val)
 		{
 			if (val) {
@@ -15,7 +15,7 @@ namespace riscv {
 		typedef typename P::ux UX;
 
 		enum {
-			total_size = sizeof(u64)
+			total_size = sizeof(u64) * 2
 		};
 
 		P &proc;
@@ -24,13 +24,20 @@ namespace riscv {
 
 		u64 mtime;
 
+		/* host clock at start to measure the tick rate */
+
+		u64 start_ns;
+		u64 start_time;
+
 		/* Timer constructor */
 
 		rtc_mmio_device(P &proc, UX mpa) :
 			memory_segment<UX>("RTC", mpa, /*uva*/0, /*size*/total_size,
 				pma_type_io | pma_prot_read | pma_prot_write),
 			proc(proc),
-			mtime(0)
+			mtime(0),
+			start_ns(host_cpu::get_instance().get_time_ns()),
+			start_time(cpu_cycle_clock())
 		{}
 
 		/* Timer interface */
@@ -40,21 +47,39 @@ namespace riscv {
 			debug("rtc_mmio:time              0x%llx", mtime);
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(mtime);
+		}
+
 		void update_time(UX time)
 		{
 			mtime = time;
 		}
 
+		/* ticks per second measured since start (read-only register at offset 8) */
+		u64 frequency()
+		{
+			u64 ns = host_cpu::get_instance().get_time_ns() - start_ns;
+			u64 ticks = cpu_cycle_clock() - start_time;
+			return ns ? u64(double(ticks) * 1e9 / double(ns)) : 0;
+		}
+
 		/* Timer MMIO */
 
 		buserror_t load_32(UX va, u32 &val)
 		{
+			update_time(cpu_cycle_clock());
 			if (va == 0) {
 				val = u32(mtime);
 			}
 			else if (va == 4) {
 				val = u32(mtime >> 32);
 			}
+			else if (va == 8) {
+				val = u32(frequency());
+			}
 			if (proc.log & proc_log_mmio) {
 				printf("rtc_mmio:0x%04llx -> 0x%08x\n", addr_t(va), val);
 			}
@@ -63,9 +88,13 @@ namespace riscv {
 
 		buserror_t load_64(UX va, u64 &val)
 		{
+			update_time(cpu_cycle_clock());
 			if (va == 0) {
 				val = mtime;
 			}
+			else if (va == 8) {
+				val = frequency();
+			}
 			if (proc.log & proc_log_mmio) {
 				printf("rtc_mmio:0x%04llx -> 0x%016llx\n", addr_t(va), val);
 			}
@@ -17,7 +17,7 @@ namespace riscv {
 		enum {
 			bits_per_word = sizeof(u64) << 3,
 			num_harts = NUM_HARTS,
-			total_size = bits_per_word * num_harts
+			total_size = sizeof(u64) * num_harts
 		};
 
 		P &proc;
@@ -54,6 +54,13 @@ namespace riscv {
 			}
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(timecmp);
+			s(claimed);
+		}
+
 		bool timer_pending(UX hart_id, u64 time)
 		{
 			if (hart_id >= num_harts || claimed[hart_id] > 0) return false;
@@ -65,6 +72,14 @@ namespace riscv {
 			}
 		}
 
+		/* compare time of a timer that has not fired yet */
+		bool timer_armed(UX hart_id, u64 &time)
+		{
+			if (hart_id >= num_harts || claimed[hart_id] > 0) return false;
+			time = timecmp[hart_id];
+			return true;
+		}
+
 		/* Timer MMIO */
 
 		buserror_t load_8 (UX va, u8  &val)
@@ -111,6 +126,7 @@ namespace riscv {
 			if (va < total_size) {
 				*(as_u8() + va) = val;
 				claimed[va >> 3] = 0;
+				proc.wake_hart(va >> 3);
 			}
 			return 0;
 		}
@@ -123,6 +139,7 @@ namespace riscv {
 			if (va < total_size - 1) {
 				*(as_u16() + (va>>1)) = val;
 				claimed[va >> 3] = 0;
+				proc.wake_hart(va >> 3);
 			}
 			return 0;
 		}
@@ -135,6 +152,7 @@ namespace riscv {
 			if (va < total_size - 3) {
 				*(as_u32() + (va>>2)) = val;
 				claimed[va >> 3] = 0;
+				proc.wake_hart(va >> 3);
 			}
 			return 0;
 		}
@@ -147,6 +165,7 @@ namespace riscv {
 			if (va < total_size - 7) {
 				*(as_u64() + (va>>3)) = val;
 				claimed[va >> 3] = 0;
+				proc.wake_hart(va >> 3);
 			}
 			return 0;
 		}
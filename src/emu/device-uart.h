@@ -154,6 +154,12 @@ namespace riscv {
 			debug("uart_mmio:dlm              %d", com.dlm);
 		}
 
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(com);
+		}
+
 		/* UART MMIO interface */
 
 		buserror_t load_8 (UX va, u8  &val)
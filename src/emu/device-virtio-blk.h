@@ -0,0 +1,741 @@
+//
+//  device-virtio-blk.h
+//
+
+#ifndef rv_device_virtio_blk_h
+#define rv_device_virtio_blk_h
+
+namespace riscv {
+
+	/*
+	 * Block device image
+	 *
+	 * The image is mmapped so requests are served with a single copy
+	 * between guest memory and the mapping. Without an overlay the image
+	 * is mapped MAP_SHARED and writes reach the file through the page cache.
+	 *
+	 * With an overlay the image is mapped MAP_PRIVATE and is never written.
+	 * Written pages are saved in the overlay file on flush and when the
+	 * device is destroyed, and are read back over the image on the next
+	 * start. The overlay file is a header, a bitmap of the pages present
+	 * and a sparse data area holding each page at its image offset.
+	 */
+
+	struct block_image
+	{
+		enum : u64 {
+			overlay_magic = 0x79616c7265766f38ULL, /* "8overlay" */
+			overlay_header_size = page_size
+		};
+
+		struct overlay_header
+		{
+			u64 magic;
+			u64 image_size;
+			u64 page_size;
+			u64 bitmap_offset;
+			u64 data_offset;
+		};
+
+		std::string filename;
+		std::string overlay_filename;
+		int fd;
+		int overlay_fd;
+		u8 *data;
+		size_t size;
+		size_t map_len;
+		bool read_only;
+		overlay_header header;
+		std::vector<u64> present;  /* pages saved in the overlay */
+		std::vector<u64> dirty;    /* pages written since the last flush */
+
+		block_image(std::string filename, std::string overlay_filename) :
+			filename(filename), overlay_filename(overlay_filename),
+			fd(-1), overlay_fd(-1), data(nullptr), size(0), map_len(0),
+			read_only(false), header{}
+		{
+			bool overlay = overlay_filename.size() > 0;
+			if (!overlay) {
+				fd = open(filename.c_str(), O_RDWR);
+			}
+			if (fd < 0) {
+				fd = open(filename.c_str(), O_RDONLY);
+				read_only = !overlay;
+			}
+			if (fd < 0) {
+				panic("disk: error: open: %s: %s", filename.c_str(), strerror(errno));
+			}
+			struct stat statbuf;
+			if (fstat(fd, &statbuf) < 0) {
+				panic("disk: error: fstat: %s: %s", filename.c_str(), strerror(errno));
+			}
+			size = statbuf.st_size & ~size_t(511);
+			if (size == 0) {
+				panic("disk: error: %s is smaller than one sector", filename.c_str());
+			}
+			map_len = round_up(size, page_size);
+			void *addr = mmap(nullptr, map_len,
+				PROT_READ | (read_only ? 0 : PROT_WRITE),
+				overlay ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+			if (addr == MAP_FAILED) {
+				panic("disk: error: mmap: %s: %s", filename.c_str(), strerror(errno));
+			}
+			data = (u8*)addr;
+			if (overlay) {
+				open_overlay();
+			}
+		}
+
+		~block_image()
+		{
+			flush();
+			if (data) munmap(data, map_len);
+			if (overlay_fd >= 0) close(overlay_fd);
+			if (fd >= 0) close(fd);
+		}
+
+		size_t num_pages() { return map_len >> page_shift; }
+
+		void open_overlay()
+		{
+			const char *name = overlay_filename.c_str();
+			overlay_fd = open(name, O_RDWR | O_CREAT, 0644);
+			if (overlay_fd < 0) {
+				panic("disk: error: open: %s: %s", name, strerror(errno));
+			}
+			present.assign((num_pages() + 63) >> 6, 0);
+			dirty.assign(present.size(), 0);
+			size_t bitmap_len = present.size() * sizeof(u64);
+
+			struct stat statbuf;
+			if (fstat(overlay_fd, &statbuf) < 0) {
+				panic("disk: error: fstat: %s: %s", name, strerror(errno));
+			}
+			if (statbuf.st_size == 0) {
+				header.magic = overlay_magic;
+				header.image_size = size;
+				header.page_size = page_size;
+				header.bitmap_offset = sizeof(header);
+				header.data_offset = round_up(overlay_header_size + bitmap_len, page_size);
+				if (pwrite(overlay_fd, &header, sizeof(header), 0) != sizeof(header) ||
+					pwrite(overlay_fd, present.data(), bitmap_len, header.bitmap_offset) != ssize_t(bitmap_len))
+				{
+					panic("disk: error: write: %s: %s", name, strerror(errno));
+				}
+				return;
+			}
+
+			if (pread(overlay_fd, &header, sizeof(header), 0) != sizeof(header) ||
+				header.magic != overlay_magic || header.page_size != page_size)
+			{
+				panic("disk: error: %s is not an overlay", name);
+			}
+			if (header.image_size != size) {
+				panic("disk: error: %s was created for a %llu byte image", name, header.image_size);
+			}
+			if (pread(overlay_fd, present.data(), bitmap_len, header.bitmap_offset) != ssize_t(bitmap_len)) {
+				panic("disk: error: read: %s: %s", name, strerror(errno));
+			}
+
+			/* read saved pages over the private image mapping */
+			for (size_t page = 0; page < num_pages(); page++) {
+				if (!(present[page >> 6] & (1ULL << (page & 63)))) continue;
+				off_t offset = page << page_shift;
+				if (pread(overlay_fd, data + offset, page_size, header.data_offset + offset) < 0) {
+					panic("disk: error: read: %s: %s", name, strerror(errno));
+				}
+			}
+		}
+
+		bool read(u8 *buf, u64 offset, size_t len)
+		{
+			if (offset > size || len > size - offset) return false;
+			memcpy(buf, data + offset, len);
+			return true;
+		}
+
+		bool write(const u8 *buf, u64 offset, size_t len)
+		{
+			if (read_only || offset > size || len > size - offset) return false;
+			memcpy(data + offset, buf, len);
+			if (overlay_fd >= 0) {
+				for (size_t page = offset >> page_shift; page <= (offset + len - 1) >> page_shift; page++) {
+					dirty[page >> 6] |= 1ULL << (page & 63);
+				}
+			}
+			return true;
+		}
+
+		/* write back to the image or save written pages to the overlay */
+		bool flush()
+		{
+			if (overlay_fd < 0) {
+				return read_only || msync(data, map_len, MS_SYNC) == 0;
+			}
+			bool saved = false;
+			for (size_t i = 0; i < dirty.size(); i++) {
+				for (u64 bits = dirty[i]; bits; bits &= bits - 1) {
+					size_t page = (i << 6) + ctz(bits);
+					off_t offset = page << page_shift;
+					if (pwrite(overlay_fd, data + offset, page_size, header.data_offset + offset) != ssize_t(page_size)) {
+						debug("disk: error: write: %s: %s", overlay_filename.c_str(), strerror(errno));
+						return false;
+					}
+				}
+				saved |= (present[i] | dirty[i]) != present[i];
+				present[i] |= dirty[i];
+				dirty[i] = 0;
+			}
+			size_t bitmap_len = present.size() * sizeof(u64);
+			if (saved && pwrite(overlay_fd, present.data(), bitmap_len,
+				header.bitmap_offset) != ssize_t(bitmap_len))
+			{
+				debug("disk: error: write: %s: %s", overlay_filename.c_str(), strerror(errno));
+				return false;
+			}
+			return fdatasync(overlay_fd) == 0;
+		}
+	};
+
+	/*
+	 * Virtio block MMIO device
+	 *
+	 * Virtio over MMIO version 2 with one split virtqueue. Requests are
+	 * processed when the driver writes QueueNotify, taking every available
+	 * descriptor chain as one batch and raising a single used buffer
+	 * interrupt. Data is copied directly between guest memory and the
+	 * image mapping.
+	 *
+	 * Reference: Virtual I/O Device (VIRTIO) Version 1.0, 4.2 and 5.2
+	 */
+
+	template <typename P>
+	struct virtio_blk_mmio_device : memory_segment<typename P::ux>
+	{
+		typedef typename P::ux UX;
+		typedef std::shared_ptr<plic_mmio_device<P>> plic_mmio_device_ptr;
+
+		enum : u32 {
+			REG_MAGIC               = 0x000,
+			REG_VERSION             = 0x004,
+			REG_DEVICE_ID           = 0x008,
+			REG_VENDOR_ID           = 0x00c,
+			REG_DEVICE_FEATURES     = 0x010,
+			REG_DEVICE_FEATURES_SEL = 0x014,
+			REG_DRIVER_FEATURES     = 0x020,
+			REG_DRIVER_FEATURES_SEL = 0x024,
+			REG_QUEUE_SEL           = 0x030,
+			REG_QUEUE_NUM_MAX       = 0x034,
+			REG_QUEUE_NUM           = 0x038,
+			REG_QUEUE_READY         = 0x044,
+			REG_QUEUE_NOTIFY        = 0x050,
+			REG_INTERRUPT_STATUS    = 0x060,
+			REG_INTERRUPT_ACK       = 0x064,
+			REG_STATUS              = 0x070,
+			REG_QUEUE_DESC_LOW      = 0x080,
+			REG_QUEUE_DESC_HIGH     = 0x084,
+			REG_QUEUE_DRIVER_LOW    = 0x090,
+			REG_QUEUE_DRIVER_HIGH   = 0x094,
+			REG_QUEUE_DEVICE_LOW    = 0x0a0,
+			REG_QUEUE_DEVICE_HIGH   = 0x0a4,
+			REG_CONFIG_GENERATION   = 0x0fc,
+			REG_CONFIG              = 0x100,
+
+			MAGIC                   = 0x74726976,  /* "virt" */
+			VERSION                 = 2,
+			DEVICE_ID_BLOCK         = 2,
+			VENDOR_ID               = 0x4154454d,  /* "META" */
+
+			QUEUE_NUM_MAX           = 256,
+			SEG_MAX                 = 128,
+			SECTOR_SIZE             = 512,
+
+			STATUS_ACKNOWLEDGE      = 0x01,
+			STATUS_DRIVER           = 0x02,
+			STATUS_DRIVER_OK        = 0x04,
+			STATUS_FEATURES_OK      = 0x08,
+			STATUS_NEEDS_RESET      = 0x40,
+			STATUS_FAILED           = 0x80,
+
+			INTERRUPT_USED_BUFFER   = 0x01,
+			INTERRUPT_CONFIG        = 0x02,
+
+			DESC_F_NEXT             = 0x01,
+			DESC_F_WRITE            = 0x02,
+			AVAIL_F_NO_INTERRUPT    = 0x01,
+
+			BLK_T_IN                = 0,
+			BLK_T_OUT               = 1,
+			BLK_T_FLUSH             = 4,
+			BLK_T_GET_ID            = 8,
+			BLK_S_OK                = 0,
+			BLK_S_IOERR             = 1,
+			BLK_S_UNSUPP            = 2,
+			BLK_ID_BYTES            = 20,
+		};
+
+		enum : u64 {
+			F_SEG_MAX               = 1ULL << 2,
+			F_RO                    = 1ULL << 5,
+			F_BLK_SIZE              = 1ULL << 6,
+			F_FLUSH                 = 1ULL << 9,
+			F_VERSION_1             = 1ULL << 32,
+		};
+
+		struct vring_desc
+		{
+			u64 addr;
+			u32 len;
+			u16 flags;
+			u16 next;
+		};
+
+		struct vring_used_elem
+		{
+			u32 id;
+			u32 len;
+		};
+
+		struct blk_req_header
+		{
+			u32 type;
+			u32 reserved;
+			u64 sector;
+		};
+
+		/* guest buffer in a descriptor chain */
+		struct chain_buf
+		{
+			u8 *ptr;
+			size_t len;
+		};
+
+		P &proc;
+		plic_mmio_device_ptr plic;
+		UX irq;
+		std::unique_ptr<block_image> image;
+
+		/* Virtio registers */
+
+		u64 device_features;
+		u64 driver_features;
+		u32 device_features_sel;
+		u32 driver_features_sel;
+		u32 queue_sel;
+		u32 queue_num;
+		u32 queue_ready;
+		u64 queue_desc;
+		u64 queue_driver;
+		u64 queue_device;
+		u32 interrupt_status;
+		u32 status;
+		u16 last_avail_idx;
+		u16 used_idx;
+		u8 config[24];
+
+		/* Request statistics */
+
+		u64 notifies;
+		u64 max_batch;
+		u64 reads, writes, flushes, errors;
+		u64 bytes_read, bytes_written;
+
+		/* Virtio block constructor */
+
+		virtio_blk_mmio_device(P &proc, UX mpa, plic_mmio_device_ptr plic, UX irq,
+			std::string filename, std::string overlay_filename) :
+			memory_segment<UX>("VIRTIO", mpa, /*uva*/0, /*size*/0x1000,
+				pma_type_io | pma_prot_read | pma_prot_write),
+			proc(proc),
+			plic(plic),
+			irq(irq),
+			image(new block_image(filename, overlay_filename)),
+			device_features(F_VERSION_1 | F_SEG_MAX | F_BLK_SIZE | F_FLUSH),
+			config{},
+			notifies(0), max_batch(0),
+			reads(0), writes(0), flushes(0), errors(0),
+			bytes_read(0), bytes_written(0)
+		{
+			if (image->read_only) device_features |= F_RO;
+			u64 capacity = image->size / SECTOR_SIZE;
+			u32 size_max = 0, seg_max = SEG_MAX, blk_size = SECTOR_SIZE;
+			memcpy(config + 0, &capacity, sizeof(capacity));
+			memcpy(config + 8, &size_max, sizeof(size_max));
+			memcpy(config + 12, &seg_max, sizeof(seg_max));
+			memcpy(config + 20, &blk_size, sizeof(blk_size));
+			reset();
+		}
+
+		void reset()
+		{
+			driver_features = 0;
+			device_features_sel = driver_features_sel = 0;
+			queue_sel = queue_num = queue_ready = 0;
+			queue_desc = queue_driver = queue_device = 0;
+			interrupt_status = status = 0;
+			last_avail_idx = used_idx = 0;
+		}
+
+		void service()
+		{
+			plic->set_irq(irq, interrupt_status != 0);
+		}
+
+		void print_registers()
+		{
+			debug("virtio_mmio:status         0x%02x", status);
+			debug("virtio_mmio:features       0x%016llx", driver_features);
+			debug("virtio_mmio:queue_num      %d", queue_num);
+			debug("virtio_mmio:queue_ready    %d", queue_ready);
+			debug("virtio_mmio:queue_desc     0x%016llx", queue_desc);
+			debug("virtio_mmio:queue_driver   0x%016llx", queue_driver);
+			debug("virtio_mmio:queue_device   0x%016llx", queue_device);
+			debug("virtio_mmio:interrupt      0x%02x", interrupt_status);
+			debug("virtio_mmio:avail_idx      %d", last_avail_idx);
+			debug("virtio_mmio:used_idx       %d", used_idx);
+			debug("virtio_mmio:notifies       %llu", notifies);
+			debug("virtio_mmio:max_batch      %llu", max_batch);
+			debug("virtio_mmio:reads          %llu", reads);
+			debug("virtio_mmio:writes         %llu", writes);
+			debug("virtio_mmio:flushes        %llu", flushes);
+			debug("virtio_mmio:errors         %llu", errors);
+			debug("virtio_mmio:bytes_read     %llu", bytes_read);
+			debug("virtio_mmio:bytes_written  %llu", bytes_written);
+		}
+
+		/* device state only, the image contents are not part of the snapshot */
+		template <typename S>
+		void snapshot(S &s)
+		{
+			s(driver_features);
+			s(device_features_sel);
+			s(driver_features_sel);
+			s(queue_sel);
+			s(queue_num);
+			s(queue_ready);
+			s(queue_desc);
+			s(queue_driver);
+			s(queue_device);
+			s(interrupt_status);
+			s(status);
+			s(last_avail_idx);
+			s(used_idx);
+		}
+
+		/* host pointer to a guest physical range within one RAM segment */
+		u8* guest_ptr(u64 pa, size_t len, bool write)
+		{
+			memory_segment<UX> *seg = nullptr;
+			addr_t uva = proc.mmu.mem->mpa_to_host(seg, UX(pa));
+			if (seg == nullptr || UX(pa) != pa || len > seg->size - size_t(UX(pa) - seg->mpa)) {
+				return nullptr;
+			}
+			if (write) {
+				if (!(seg->flags & pma_prot_write)) return nullptr;
+				for (addr_t page = uva & ~addr_t(page_size - 1); page < uva + addr_t(len); page += page_size) {
+					seg->mark_dirty(page);
+				}
+			}
+			return (u8*)uva;
+		}
+
+		/* copy between a descriptor chain stream and a host buffer */
+		static size_t chain_copy(std::vector<chain_buf> &chain, size_t offset,
+			u8 *buf, size_t len, bool to_chain)
+		{
+			size_t done = 0;
+			for (auto &b : chain) {
+				if (offset >= b.len) {
+					offset -= b.len;
+					continue;
+				}
+				size_t n = std::min(b.len - offset, len - done);
+				if (to_chain) memcpy(b.ptr + offset, buf + done, n);
+				else memcpy(buf + done, b.ptr + offset, n);
+				done += n;
+				offset = 0;
+				if (done == len) break;
+			}
+			return done;
+		}
+
+		/* copy between a descriptor chain stream and the image */
+		bool chain_image(std::vector<chain_buf> &chain, size_t offset, u64 image_offset,
+			size_t len, bool to_chain)
+		{
+			for (auto &b : chain) {
+				if (offset >= b.len) {
+					offset -= b.len;
+					continue;
+				}
+				size_t n = std::min(b.len - offset, len);
+				bool ok = to_chain ?
+					image->read(b.ptr + offset, image_offset, n) :
+					image->write(b.ptr + offset, image_offset, n);
+				if (!ok) return false;
+				image_offset += n;
+				len -= n;
+				offset = 0;
+				if (len == 0) break;
+			}
+			return len == 0;
+		}
+
+		/* process one request, returning the number of bytes written to the guest */
+		u32 process_request(vring_desc *desc, u16 head)
+		{
+			std::vector<chain_buf> out, in;
+			size_t out_len = 0, in_len = 0;
+
+			/* split the chain into device readable and writable streams */
+			u16 idx = head;
+			for (u32 n = 0; n < queue_num; n++) {
+				vring_desc &d = desc[idx % queue_num];
+				bool write = d.flags & DESC_F_WRITE;
+				u8 *ptr = guest_ptr(d.addr, d.len, write);
+				if (!ptr) {
+					errors++;
+					return 0;
+				}
+				if (write) {
+					in.push_back(chain_buf{ptr, d.len});
+					in_len += d.len;
+				} else {
+					out.push_back(chain_buf{ptr, d.len});
+					out_len += d.len;
+				}
+				if (!(d.flags & DESC_F_NEXT)) break;
+				idx = d.next;
+			}
+
+			/* the header leads the readable stream, the status ends the writable stream */
+			blk_req_header hdr;
+			if (in_len == 0 || chain_copy(out, 0, (u8*)&hdr, sizeof(hdr), false) != sizeof(hdr)) {
+				errors++;
+				return 0;
+			}
+			size_t data_len = 0;
+			u8 blk_status = BLK_S_OK;
+			u64 offset = hdr.sector < image->size / SECTOR_SIZE ?
+				hdr.sector * SECTOR_SIZE : image->size;
+			switch (hdr.type) {
+				case BLK_T_IN:
+					data_len = in_len - 1;
+					if (data_len % SECTOR_SIZE || !chain_image(in, 0, offset, data_len, true)) {
+						blk_status = BLK_S_IOERR;
+						data_len = 0;
+						break;
+					}
+					reads++;
+					bytes_read += data_len;
+					break;
+				case BLK_T_OUT:
+					data_len = out_len - sizeof(hdr);
+					if (data_len % SECTOR_SIZE || !chain_image(out, sizeof(hdr), offset, data_len, false)) {
+						blk_status = BLK_S_IOERR;
+					} else {
+						writes++;
+						bytes_written += data_len;
+					}
+					data_len = 0;
+					break;
+				case BLK_T_FLUSH:
+					flushes++;
+					if (!image->flush()) blk_status = BLK_S_IOERR;
+					break;
+				case BLK_T_GET_ID: {
+					char id[BLK_ID_BYTES] = "rv8-virtio-blk";
+					data_len = std::min(size_t(BLK_ID_BYTES), in_len - 1);
+					chain_copy(in, 0, (u8*)id, data_len, true);
+					break;
+				}
+				default:
+					blk_status = BLK_S_UNSUPP;
+					break;
+			}
+			if (blk_status == BLK_S_IOERR) errors++;
+			chain_copy(in, in_len - 1, &blk_status, 1, true);
+			return u32(data_len + 1);
+		}
+
+		/* process every available request and post one interrupt for the batch */
+		void notify()
+		{
+			notifies++;
+			if (!(status & STATUS_DRIVER_OK) || !queue_ready || queue_num == 0) return;
+
+			vring_desc *desc = (vring_desc*)guest_ptr(queue_desc, sizeof(vring_desc) * queue_num, false);
+			u16 *avail = (u16*)guest_ptr(queue_driver, sizeof(u16) * (3 + queue_num), false);
+			u16 *used = (u16*)guest_ptr(queue_device, sizeof(u16) * 3 + sizeof(vring_used_elem) * queue_num, true);
+			if (!desc || !avail || !used) {
+				status |= STATUS_NEEDS_RESET;
+				interrupt_status |= INTERRUPT_CONFIG;
+				return;
+			}
+			vring_used_elem *used_ring = (vring_used_elem*)(used + 2);
+
+			u16 avail_idx = ((volatile u16*)avail)[1];
+			std::atomic_thread_fence(std::memory_order_acquire);
+			u64 batch = 0;
+			while (last_avail_idx != avail_idx) {
+				u16 head = avail[2 + last_avail_idx % queue_num];
+				vring_used_elem &elem = used_ring[used_idx % queue_num];
+				elem.len = process_request(desc, head);
+				elem.id = head;
+				last_avail_idx++;
+				used_idx++;
+				batch++;
+			}
+			if (batch == 0) return;
+			std::atomic_thread_fence(std::memory_order_release);
+			((volatile u16*)used)[1] = used_idx;
+			max_batch = std::max(max_batch, batch);
+			if (!(avail[0] & AVAIL_F_NO_INTERRUPT)) {
+				interrupt_status |= INTERRUPT_USED_BUFFER;
+			}
+		}
+
+		u32 read_reg(UX va)
+		{
+			switch (va) {
+				case REG_MAGIC:               return MAGIC;
+				case REG_VERSION:             return VERSION;
+				case REG_DEVICE_ID:           return DEVICE_ID_BLOCK;
+				case REG_VENDOR_ID:           return VENDOR_ID;
+				case REG_DEVICE_FEATURES:
+					return device_features_sel < 2 ? u32(device_features >> (device_features_sel * 32)) : 0;
+				case REG_QUEUE_NUM_MAX:       return queue_sel == 0 ? QUEUE_NUM_MAX : 0;
+				case REG_QUEUE_READY:         return queue_sel == 0 ? queue_ready : 0;
+				case REG_INTERRUPT_STATUS:    return interrupt_status;
+				case REG_STATUS:              return status;
+				case REG_CONFIG_GENERATION:   return 0;
+				default:                      return 0;
+			}
+		}
+
+		void write_reg(UX va, u32 val)
+		{
+			switch (va) {
+				case REG_DEVICE_FEATURES_SEL: device_features_sel = val; break;
+				case REG_DRIVER_FEATURES:
+					if (driver_features_sel < 2) {
+						u64 shift = driver_features_sel * 32;
+						driver_features = (driver_features & ~(0xffffffffULL << shift)) |
+							(u64(val) << shift);
+					}
+					break;
+				case REG_DRIVER_FEATURES_SEL: driver_features_sel = val; break;
+				case REG_QUEUE_SEL:           queue_sel = val; break;
+				case REG_QUEUE_NUM:
+					/* ring indexes wrap at 2^16 so the size must be a power of two */
+					if (queue_sel == 0 && val <= QUEUE_NUM_MAX && (val & (val - 1)) == 0) queue_num = val;
+					break;
+				case REG_QUEUE_READY:
+					if (queue_sel == 0) queue_ready = val & 1;
+					break;
+				case REG_QUEUE_NOTIFY:
+					if (val == 0) notify();
+					break;
+				case REG_INTERRUPT_ACK:       interrupt_status &= ~val; break;
+				case REG_STATUS:
+					if (val == 0) reset();
+					else status = val;
+					break;
+				case REG_QUEUE_DESC_LOW:      if (queue_sel == 0) queue_desc = (queue_desc & ~0xffffffffULL) | val; break;
+				case REG_QUEUE_DESC_HIGH:     if (queue_sel == 0) queue_desc = (queue_desc & 0xffffffffULL) | (u64(val) << 32); break;
+				case REG_QUEUE_DRIVER_LOW:    if (queue_sel == 0) queue_driver = (queue_driver & ~0xffffffffULL) | val; break;
+				case REG_QUEUE_DRIVER_HIGH:   if (queue_sel == 0) queue_driver = (queue_driver & 0xffffffffULL) | (u64(val) << 32); break;
+				case REG_QUEUE_DEVICE_LOW:    if (queue_sel == 0) queue_device = (queue_device & ~0xffffffffULL) | val; break;
+				case REG_QUEUE_DEVICE_HIGH:   if (queue_sel == 0) queue_device = (queue_device & 0xffffffffULL) | (u64(val) << 32); break;
+				default: break;
+			}
+		}
+
+		/* byte, halfword and doubleword loads read the config space */
+		u64 read_config(UX va, size_t len)
+		{
+			u64 val = 0;
+			if (va >= REG_CONFIG && va - REG_CONFIG + len <= sizeof(config)) {
+				memcpy(&val, config + (va - REG_CONFIG), len);
+			}
+			return val;
+		}
+
+		/* Virtio MMIO */
+
+		buserror_t load_8 (UX va, u8  &val)
+		{
+			val = u8(read_config(va, 1));
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx -> 0x%02hhx\n", addr_t(va), val);
+			}
+			return 0;
+		}
+
+		buserror_t load_16(UX va, u16 &val)
+		{
+			val = u16(read_config(va, 2));
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx -> 0x%04hx\n", addr_t(va), val);
+			}
+			return 0;
+		}
+
+		buserror_t load_32(UX va, u32 &val)
+		{
+			val = va < REG_CONFIG ? read_reg(va) : u32(read_config(va, 4));
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx -> 0x%08x\n", addr_t(va), val);
+			}
+			return 0;
+		}
+
+		buserror_t load_64(UX va, u64 &val)
+		{
+			val = va < REG_CONFIG ? read_reg(va) | (u64(read_reg(va + 4)) << 32) : read_config(va, 8);
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx -> 0x%016llx\n", addr_t(va), val);
+			}
+			return 0;
+		}
+
+		buserror_t store_8 (UX va, u8  val)
+		{
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx <- 0x%02hhx\n", addr_t(va), val);
+			}
+			return 0;
+		}
+
+		buserror_t store_16(UX va, u16 val)
+		{
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx <- 0x%04hx\n", addr_t(va), val);
+			}
+			return 0;
+		}
+
+		buserror_t store_32(UX va, u32 val)
+		{
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx <- 0x%08x\n", addr_t(va), val);
+			}
+			write_reg(va, val);
+			return 0;
+		}
+
+		buserror_t store_64(UX va, u64 val)
+		{
+			if (proc.log & proc_log_mmio) {
+				printf("virtio_mmio:0x%04llx <- 0x%016llx\n", addr_t(va), val);
+			}
+			write_reg(va, u32(val));
+			write_reg(va + 4, u32(val >> 32));
+			return 0;
+		}
+
+	};
+
+}
+
+#endif
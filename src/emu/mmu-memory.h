@@ -51,11 +51,30 @@ namespace riscv {
 		addr_t uva;       /* segment user virtual address     (host) */
 		size_t size;      /* segment size */
 		uint32_t flags;   /* segment PMA flags */
+		std::vector<u64> dirty; /* dirty page bitmap (empty if not tracking) */
 
 		memory_segment(const char *name, UX mpa, addr_t uva, size_t size, UX flags) :
 			name(name), mpa(mpa), uva(uva), size(size), flags(flags) {}
 
 		virtual ~memory_segment() {}
+
+		/* start tracking stores or clear dirty pages */
+		void clear_dirty()
+		{
+			dirty.assign(((size >> page_shift) + 63) >> 6, 0);
+		}
+
+		inline void mark_dirty(addr_t va)
+		{
+			if (likely(dirty.empty())) return;
+			size_t page = (va - uva) >> page_shift;
+			dirty[page >> 6] |= 1ULL << (page & 63);
+		}
+
+		inline bool is_dirty(size_t page)
+		{
+			return dirty[page >> 6] & (1ULL << (page & 63));
+		}
 	};
 
 	/*  user memory segment contains one mapping from a segment of emulated machine
@@ -76,10 +95,173 @@ namespace riscv {
 		virtual buserror_t load_32(UX va, u32 &val) { val = *static_cast<u32*>((void*)(addr_t)va); return 0; }
 		virtual buserror_t load_64(UX va, u64 &val) { val = *static_cast<u64*>((void*)(addr_t)va); return 0; }
 
-		virtual buserror_t store_8 (UX va, u8  val) { *static_cast<u8*>((void*)(addr_t)va) = val; return 0; }
-		virtual buserror_t store_16(UX va, u16 val) { *static_cast<u16*>((void*)(addr_t)va) = val; return 0; }
-		virtual buserror_t store_32(UX va, u32 val) { *static_cast<u32*>((void*)(addr_t)va) = val; return 0; }
-		virtual buserror_t store_64(UX va, u64 val) { *static_cast<u64*>((void*)(addr_t)va) = val; return 0; }
+		virtual buserror_t store_8 (UX va, u8  val) { this->mark_dirty(va); *static_cast<u8*>((void*)(addr_t)va) = val; return 0; }
+		virtual buserror_t store_16(UX va, u16 val) { this->mark_dirty(va); *static_cast<u16*>((void*)(addr_t)va) = val; return 0; }
+		virtual buserror_t store_32(UX va, u32 val) { this->mark_dirty(va); *static_cast<u32*>((void*)(addr_t)va) = val; return 0; }
+		virtual buserror_t store_64(UX va, u64 val) { this->mark_dirty(va); *static_cast<u64*>((void*)(addr_t)va) = val; return 0; }
+	};
+
+
+	/*  read-only memory segment backed by a host mapping shared between
+	    emulator instances, unmapped when the last instance releases it */
+	template <typename UX>
+	struct shared_memory_segment : memory_segment<UX>
+	{
+		std::shared_ptr<void> mapping;
+
+		shared_memory_segment(const char*name, UX mpa, std::shared_ptr<void> mapping, size_t size, UX flags) :
+			memory_segment<UX>(name, mpa, addr_t(mapping.get()), size, flags & ~pma_prot_write),
+			mapping(mapping) {}
+
+		virtual buserror_t load_8 (UX va, u8  &val) { val = *static_cast<u8*>((void*)(addr_t)va); return 0; }
+		virtual buserror_t load_16(UX va, u16 &val) { val = *static_cast<u16*>((void*)(addr_t)va); return 0; }
+		virtual buserror_t load_32(UX va, u32 &val) { val = *static_cast<u32*>((void*)(addr_t)va); return 0; }
+		virtual buserror_t load_64(UX va, u64 &val) { val = *static_cast<u64*>((void*)(addr_t)va); return 0; }
+
+		virtual buserror_t store_8 (UX va, u8  val) { return -1; }
+		virtual buserror_t store_16(UX va, u16 val) { return -1; }
+		virtual buserror_t store_32(UX va, u32 val) { return -1; }
+		virtual buserror_t store_64(UX va, u64 val) { return -1; }
+	};
+
+
+	/*  width specialised MMIO callbacks for a device type */
+	template <typename UX>
+	struct mmio_ops
+	{
+		typedef memory_segment<UX> seg_type;
+
+		buserror_t (*load_8) (seg_type *seg, UX va, u8  &val);
+		buserror_t (*load_16)(seg_type *seg, UX va, u16 &val);
+		buserror_t (*load_32)(seg_type *seg, UX va, u32 &val);
+		buserror_t (*load_64)(seg_type *seg, UX va, u64 &val);
+
+		buserror_t (*store_8) (seg_type *seg, UX va, u8  val);
+		buserror_t (*store_16)(seg_type *seg, UX va, u16 val);
+		buserror_t (*store_32)(seg_type *seg, UX va, u32 val);
+		buserror_t (*store_64)(seg_type *seg, UX va, u64 val);
+
+		/* callbacks that call the device type directly so accesses are not virtual */
+		template <typename D>
+		static const mmio_ops* direct()
+		{
+			static const mmio_ops ops = {
+				[](seg_type *seg, UX va, u8  &val) { return static_cast<D*>(seg)->D::load_8(va, val); },
+				[](seg_type *seg, UX va, u16 &val) { return static_cast<D*>(seg)->D::load_16(va, val); },
+				[](seg_type *seg, UX va, u32 &val) { return static_cast<D*>(seg)->D::load_32(va, val); },
+				[](seg_type *seg, UX va, u64 &val) { return static_cast<D*>(seg)->D::load_64(va, val); },
+				[](seg_type *seg, UX va, u8  val) { return static_cast<D*>(seg)->D::store_8(va, val); },
+				[](seg_type *seg, UX va, u16 val) { return static_cast<D*>(seg)->D::store_16(va, val); },
+				[](seg_type *seg, UX va, u32 val) { return static_cast<D*>(seg)->D::store_32(va, val); },
+				[](seg_type *seg, UX va, u64 val) { return static_cast<D*>(seg)->D::store_64(va, val); }
+			};
+			return &ops;
+		}
+
+		/* callbacks for segments added without their device type */
+		static const mmio_ops* dynamic()
+		{
+			static const mmio_ops ops = {
+				[](seg_type *seg, UX va, u8  &val) { return seg->load_8(va, val); },
+				[](seg_type *seg, UX va, u16 &val) { return seg->load_16(va, val); },
+				[](seg_type *seg, UX va, u32 &val) { return seg->load_32(va, val); },
+				[](seg_type *seg, UX va, u64 &val) { return seg->load_64(va, val); },
+				[](seg_type *seg, UX va, u8  val) { return seg->store_8(va, val); },
+				[](seg_type *seg, UX va, u16 val) { return seg->store_16(va, val); },
+				[](seg_type *seg, UX va, u32 val) { return seg->store_32(va, val); },
+				[](seg_type *seg, UX va, u64 val) { return seg->store_64(va, val); }
+			};
+			return &ops;
+		}
+
+		buserror_t load(seg_type *seg, UX va, u8  &val) const { return load_8(seg, va, val); }
+		buserror_t load(seg_type *seg, UX va, u16 &val) const { return load_16(seg, va, val); }
+		buserror_t load(seg_type *seg, UX va, u32 &val) const { return load_32(seg, va, val); }
+		buserror_t load(seg_type *seg, UX va, u64 &val) const { return load_64(seg, va, val); }
+
+		buserror_t store(seg_type *seg, UX va, u8  val) const { return store_8(seg, va, val); }
+		buserror_t store(seg_type *seg, UX va, u16 val) const { return store_16(seg, va, val); }
+		buserror_t store(seg_type *seg, UX va, u32 val) const { return store_32(seg, va, val); }
+		buserror_t store(seg_type *seg, UX va, u64 val) const { return store_64(seg, va, val); }
+	};
+
+
+	/*  MMIO page table maps machine physical pages to device segments and
+	    their callbacks. It is open addressed with Fibonacci hashing and sized
+	    for the handful of device pages in a machine */
+	template <typename UX>
+	struct mmio_page_table
+	{
+		enum {
+			table_bits = 8,
+			table_size = 1 << table_bits,
+			table_mask = table_size - 1
+		};
+
+		struct entry
+		{
+			UX page;
+			memory_segment<UX> *segment;
+			const mmio_ops<UX> *ops;
+		};
+
+		entry table[table_size];
+		size_t count;
+
+		mmio_page_table() : table(), count(0) {}
+
+		static size_t hash(UX page)
+		{
+			return size_t((u64(page) * 0x9e3779b97f4a7c15ULL) >> (64 - table_bits));
+		}
+
+		void clear()
+		{
+			std::fill(table, table + table_size, entry());
+			count = 0;
+		}
+
+		/* add every page covered by the device segment */
+		void insert(memory_segment<UX> *segment, const mmio_ops<UX> *ops)
+		{
+			if (segment->size == 0) return;
+			UX first = segment->mpa >> page_shift;
+			UX last = (segment->mpa + segment->size - 1) >> page_shift;
+			for (UX page = first; ; page++) {
+				insert_page(page, segment, ops);
+				if (page == last) break;
+			}
+		}
+
+		void insert_page(UX page, memory_segment<UX> *segment, const mmio_ops<UX> *ops)
+		{
+			if (count >= table_size / 2) {
+				panic("mmio: too many device pages: %s", segment->name);
+			}
+			size_t i = hash(page);
+			while (table[i].segment) {
+				if (table[i].page == page) {
+					panic("mmio: %s and %s share page 0x%llx",
+						table[i].segment->name, segment->name, u64(page) << page_shift);
+				}
+				i = (i + 1) & table_mask;
+			}
+			table[i] = entry{ page, segment, ops };
+			count++;
+		}
+
+		/* find the device mapped at the machine physical address */
+		entry* lookup(UX mpa)
+		{
+			UX page = mpa >> page_shift;
+			for (size_t i = hash(page); table[i].segment; i = (i + 1) & table_mask) {
+				if (table[i].page == page) {
+					return UX(mpa - table[i].segment->mpa) < table[i].segment->size ?
+						&table[i] : nullptr;
+				}
+			}
+			return nullptr;
+		}
 	};
 
 
@@ -90,10 +272,21 @@ namespace riscv {
 	{
 		typedef std::shared_ptr<memory_segment<UX>> memory_segment_type;
 
+		typedef std::pair<UX,size_t> mmio_stat_key;         /* address and width */
+		typedef std::pair<u64,u64> mmio_stat_val;           /* loads and stores */
+
 		std::vector<memory_segment_type> segments;
+		std::vector<memory_segment<UX>*> host_segments; /* host backed segments */
+		mmio_page_table<UX> mmio;       /* device segments by page */
+		std::vector<UX*> reservations;  /* load reservations of harts sharing memory */
+		std::recursive_mutex io_lock;   /* serializes device access between harts */
+		std::atomic<u64> io_count;      /* device register accesses (written under io_lock) */
+		std::map<mmio_stat_key,mmio_stat_val> mmio_stats;
+		bool mmio_summary;              /* count accesses per device register */
+		bool shared;                    /* memory is shared by multiple harts */
 		bool log;
 
-		user_memory() : log(false) {}
+		user_memory() : io_count(0), mmio_summary(false), shared(false), log(false) {}
 		~user_memory() { clear_segments(); }
 
 		/* print memory */
@@ -119,37 +312,115 @@ namespace riscv {
 		}
 
 		/* add existing memory segment given user physical address and size */
-		void add_segment(memory_segment_type seg)
+		void add_segment(memory_segment_type seg, const mmio_ops<UX> *ops = mmio_ops<UX>::dynamic())
 		{
 			segments.push_back(seg);
+			if (seg->uva) {
+				host_segments.push_back(seg.get());
+			} else {
+				mmio.insert(seg.get(), ops);
+			}
 			if (log) {
 				print_memory_segment(seg);
 			}
 		}
 
+		/* add device segment with callbacks specialised for the device type */
+		template <typename D>
+		void add_device(std::shared_ptr<D> dev)
+		{
+			add_segment(dev, mmio_ops<UX>::template direct<D>());
+		}
+
 		void add_mmap(UX mpa, intptr_t uva, size_t size, UX flags)
 		{
 			add_segment(std::make_shared<mmap_memory_segment<UX>>("ELF", mpa, uva, size, flags));
 		}
 
+		/* add read-only host mapping shared with other emulator instances */
+		void add_shared_mmap(UX mpa, std::shared_ptr<void> mapping, size_t size, UX flags)
+		{
+			add_segment(std::make_shared<shared_memory_segment<UX>>("ELF", mpa, mapping, size, flags));
+		}
+
 		/* mmap new main memory segment using fixed user physical address and size */
-		void add_ram(UX mpa, size_t size)
+		void add_ram(UX mpa, size_t size, UX flags =
+			pma_type_main | pma_prot_read | pma_prot_write | pma_prot_execute,
+			const char *name = "RAM")
 		{
 			void *addr = mmap(nullptr, size,
 				PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
 			if (addr == MAP_FAILED) {
 				panic("memory: error: mmap: %s", strerror(errno));
 			}
-			add_segment(std::make_shared<mmap_memory_segment<UX>>("RAM", mpa, uintptr_t(addr), size,
-				pma_type_main | pma_prot_read | pma_prot_write | pma_prot_execute));
+			add_segment(std::make_shared<mmap_memory_segment<UX>>(name, mpa, uintptr_t(addr), size, flags));
+		}
+
+		/*
+		 * map file copy-on-write at machine physical address inside an existing segment
+		 *
+		 * The file is mapped MAP_PRIVATE | MAP_FIXED over the segment's anonymous
+		 * reservation so page-cache pages are shared with other emulator instances
+		 * until the guest writes to them. Returns the file size.
+		 */
+		size_t map_file(UX mpa, const char *filename)
+		{
+			int fd = open(filename, O_RDONLY);
+			if (fd < 0) {
+				panic("memory: error: open: %s: %s", filename, strerror(errno));
+			}
+			struct stat statbuf;
+			if (fstat(fd, &statbuf) < 0) {
+				panic("memory: error: fstat: %s: %s", filename, strerror(errno));
+			}
+			map_fd(mpa, fd, 0, statbuf.st_size, filename);
+			close(fd);
+			return statbuf.st_size;
+		}
+
+		/* map file range copy-on-write at machine physical address inside an existing segment */
+		void map_fd(UX mpa, int fd, off_t offset, size_t len, const char *filename)
+		{
+			memory_segment<UX> *segment = nullptr;
+			addr_t uva = mpa_to_uva(segment, mpa);
+			if (segment == nullptr || segment->uva == 0) {
+				panic("memory: error: no segment at 0x%016llx: %s", (u64)mpa, filename);
+			}
+			if (((mpa - segment->mpa) | offset) & (page_size - 1)) {
+				panic("memory: error: unaligned address 0x%016llx: %s", (u64)mpa, filename);
+			}
+			size_t map_len = round_up(len, page_size);
+			if (mpa - segment->mpa + map_len > segment->size) {
+				panic("memory: error: %s does not fit in %s segment", filename, segment->name);
+			}
+			if (map_len == 0) return;
+			void *addr = mmap((void*)uva, map_len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_FIXED, fd, offset);
+			if (addr == MAP_FAILED) {
+				panic("memory: error: mmap: %s: %s", filename, strerror(errno));
+			}
+			if (log) {
+				debug("soft-mmu :%016llx-%016llx (0x%04llx-0x%04llx) %s",
+					(u64)mpa, (u64)mpa + map_len, (u64)uva, (u64)uva + map_len, filename);
+			}
 		}
 
 		/* Unmap memory segments */
 		void clear_segments()
 		{
+			mmio.clear();
+			host_segments.clear();
 			segments.clear();
 		}
 
+		/* clear load reservations of all harts on the given physical address */
+		void clear_reservations(UX mpa)
+		{
+			for (auto lr : reservations) {
+				if (*lr == mpa) *lr = UX(-1);
+			}
+		}
+
 		/* convert machine physical address to user virtual address */
 		addr_t mpa_to_uva(memory_segment<UX>* &out_seg, UX mpa)
 		{
@@ -163,69 +434,86 @@ namespace riscv {
 			return 0;
 		}
 
-		virtual buserror_t load_8(UX va, u8 &val)
+		/* convert machine physical address to user virtual address of a host backed segment */
+		addr_t mpa_to_host(memory_segment<UX>* &out_seg, UX mpa)
 		{
-			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->load_8(uva, val);
-		}
-
-		virtual buserror_t load_16(UX va, u16 &val)
-		{
-			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->load_16(uva, val);
+			for (auto seg : host_segments) {
+				if (mpa >= seg->mpa && /* note the upper limit may wrap to 0 */
+					((mpa < seg->mpa + seg->size) || (seg->mpa + seg->size == 0))) {
+					out_seg = seg;
+					return seg->uva + (mpa - seg->mpa);
+				}
+			}
+			return 0;
 		}
 
-		virtual buserror_t load_32(UX va, u32 &val)
+		/* count a device register access for the mmio summary */
+		void count_mmio(UX va, size_t width, bool store)
 		{
-			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->load_32(uva, val);
+			mmio_stat_val &stat = mmio_stats[mmio_stat_key(va, width)];
+			if (store) stat.second++; else stat.first++;
 		}
 
-		virtual buserror_t load_64(UX va, u64 &val)
+		/* print device register access counts */
+		void print_mmio_summary()
 		{
-			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->load_64(uva, val);
+			printf("\n");
+			printf("mmio register accesses\n");
+			printf("~~~~~~~~~~~~~~~~~~~~~~\n");
+			printf("%-8s %-18s %-8s %5s %12s %12s\n",
+				"device", "address", "offset", "width", "loads", "stores");
+			for (auto &ent : mmio_stats) {
+				auto pte = mmio.lookup(ent.first.first);
+				printf("%-8s 0x%016llx 0x%06llx %5zu %12llu %12llu\n",
+					pte ? pte->segment->name : "?",
+					u64(ent.first.first),
+					pte ? u64(ent.first.first - pte->segment->mpa) : 0ULL,
+					ent.first.second << 3,
+					ent.second.first, ent.second.second);
+			}
 		}
 
-		virtual buserror_t store_8 (UX va, u8  val)
+		/* load from a host backed segment or dispatch to the device mapped on the page */
+		template <typename T>
+		buserror_t bus_load(UX va, T &val)
 		{
 			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->store_8(uva, val);
+			addr_t uva = mpa_to_host(segment, va);
+			if (likely(segment != nullptr)) return segment->load(uva, val);
+			auto pte = mmio.lookup(va);
+			if (unlikely(!pte)) return -1;
+			std::unique_lock<std::recursive_mutex> lock(io_lock, std::defer_lock);
+			if (shared) lock.lock();
+			io_count.store(io_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (unlikely(mmio_summary)) count_mmio(va, sizeof(T), false);
+			return pte->ops->load(pte->segment, va - pte->segment->mpa, val);
 		}
 
-		virtual buserror_t store_16(UX va, u16 val)
+		/* store to a host backed segment or dispatch to the device mapped on the page */
+		template <typename T>
+		buserror_t bus_store(UX va, T val)
 		{
 			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->store_16(uva, val);
+			addr_t uva = mpa_to_host(segment, va);
+			if (likely(segment != nullptr)) return segment->store(uva, val);
+			auto pte = mmio.lookup(va);
+			if (unlikely(!pte)) return -1;
+			std::unique_lock<std::recursive_mutex> lock(io_lock, std::defer_lock);
+			if (shared) lock.lock();
+			io_count.store(io_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (unlikely(mmio_summary)) count_mmio(va, sizeof(T), true);
+			return pte->ops->store(pte->segment, va - pte->segment->mpa, val);
 		}
 
-		virtual buserror_t store_32(UX va, u32 val)
-		{
-			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->store_32(uva, val);
-		}
+		virtual buserror_t load_8 (UX va, u8  &val) { return bus_load(va, val); }
+		virtual buserror_t load_16(UX va, u16 &val) { return bus_load(va, val); }
+		virtual buserror_t load_32(UX va, u32 &val) { return bus_load(va, val); }
+		virtual buserror_t load_64(UX va, u64 &val) { return bus_load(va, val); }
 
-		virtual buserror_t store_64(UX va, u64 val)
-		{
-			memory_segment<UX> *segment = nullptr;
-			addr_t uva = mpa_to_uva(segment, va);
-			if (unlikely(!segment)) return -1;
-			return segment->store_64(uva, val);
-		}
+		virtual buserror_t store_8 (UX va, u8  val) { return bus_store(va, val); }
+		virtual buserror_t store_16(UX va, u16 val) { return bus_store(va, val); }
+		virtual buserror_t store_32(UX va, u32 val) { return bus_store(va, val); }
+		virtual buserror_t store_64(UX va, u64 val) { return bus_store(va, val); }
 
 	};
 
@@ -64,6 +64,7 @@ namespace riscv {
 					}
 				}
 			}
+			if (proc.log & proc_log_wss) proc.wss->touch(pc);
 			return riscv::inst_fetch(pc, pc_offset);
 		}
 
@@ -72,13 +73,36 @@ namespace riscv {
 		template <typename P, typename T>
 		void amo(P &proc, const amo_op a_op, UX va, T &val1, T val2)
 		{
-			val1 = UX(*(T*)addr_t(va & (memory_top - 1)));
-			val2 = amo_fn<UX>(a_op, val1, val2);
-			*((T*)addr_t(va & (memory_top - 1))) = val2;
+			if (proc.log & proc_log_wss) proc.wss->touch(va);
+			val1 = amo_atomic<T>(a_op, addr_t(va & (memory_top - 1)), val2);
+		}
+
+		/*
+		 * LR/SC between guest threads: the reservation holds the address and
+		 * value loaded by lr and sc is a compare and swap against that value
+		 */
+
+		template <typename P, typename T>
+		void lr(P &proc, UX va, T &val)
+		{
+			if (proc.log & proc_log_wss) proc.wss->touch(va);
+			val = lr_atomic<T>(addr_t(va & (memory_top - 1)));
+			proc.lr = va;
+			proc.lr_val = val;
+		}
+
+		template <typename P, typename T>
+		void sc(P &proc, UX va, T val, UX &res)
+		{
+			if (proc.log & proc_log_wss) proc.wss->touch(va);
+			res = !(proc.lr == typename P::long_t(va) &&
+				sc_atomic<T>(addr_t(va & (memory_top - 1)), T(proc.lr_val), val));
+			proc.lr = -1;
 		}
 
 		template <typename P, typename T> void load(P &proc, UX va, T &val)
 		{
+			if (proc.log & proc_log_wss) proc.wss->touch(va);
 			if (enfore_memory_top) {
 				val = UX(*(T*)addr_t(va & (memory_top - 1)));
 			} else {
@@ -88,6 +112,7 @@ namespace riscv {
 
 		template <typename P, typename T> void store(P &proc, UX va, T val)
 		{
+			if (proc.log & proc_log_wss) proc.wss->touch(va);
 			if (enfore_memory_top) {
 				*((T*)addr_t(va & (memory_top - 1))) = val;
 			} else {
@@ -28,6 +28,14 @@ namespace riscv {
 		pma_type       pma;         /* PMA table */
 		memory_type    mem;         /* memory device */
 
+		/* MMU statistics */
+
+		u64            itlb_hits = 0;
+		u64            itlb_misses = 0;
+		u64            dtlb_hits = 0;
+		u64            dtlb_misses = 0;
+		u64            page_walks = 0;
+
 		/* MMU constructor */
 
 		mmu_soft() : mem(std::make_shared<MEMORY>()) {}
@@ -97,6 +105,16 @@ namespace riscv {
 			);
 		}
 
+		/* count a load or store event and an MMIO event for device addresses */
+		template <typename P, hpm_event E> void count_access(P &proc, addr_t mpa)
+		{
+			if (proc.log & proc_log_wss) proc.wss->touch(mpa);
+			proc.hpm.template count<E>();
+			if (proc.hpm.template armed<hpm_event_mmio>() && mem->mmio.lookup(mpa)) {
+				proc.hpm.add(hpm_event_mmio);
+			}
+		}
+
 		/* instruction fetch */
 		template <typename P, const mmu_op op = op_fetch>
 		inst_t inst_fetch(P &proc, UX pc, typename P::ux &pc_offset)
@@ -125,6 +143,7 @@ namespace riscv {
 			if (proc.log & proc_log_hist_pc) {
 				proc.histogram_add_pc(mpa);
 			}
+			if (proc.log & proc_log_wss) proc.wss->touch(mpa);
 
 			/* decode length and fetch any remaining instruction bytes */
 			inst = htole16(inst_16);
@@ -178,6 +197,7 @@ namespace riscv {
 		void amo(P &proc, const amo_op a_op, UX va, T &val1, T val2)
 		{
 			typename tlb_type::tlb_entry_t* tlb_ent = nullptr;
+			memory_segment<UX> *segment = nullptr;
 
 			/* raise exception if address is misalligned */
 			if (unlikely(misaligned<T>(va))) {
@@ -189,21 +209,116 @@ namespace riscv {
 			addr_t mpa = translate_addr<P,op>(proc, va, tlb_ent);
 			if (!mpa) return;
 
-			/* TODO - plumb amo interface into the memory bus */
+			/* check read and write permissions */
+			if (unlikely(load_access_fault(proc, proc.mode, tlb_ent) ||
+				store_access_fault(proc, proc.mode, tlb_ent))) {
+				proc.raise(rv_cause_fault_store, va);
+				return;
+			}
 
-			/* Check read permissions and perform load */
-			if (unlikely(load_access_fault(proc, proc.mode, tlb_ent) || mem->load(mpa, val1))) {
+			/* execute atomic op on the host address of RAM or on the device */
+			addr_t uva = mem->mpa_to_host(segment, mpa);
+			if (likely(segment && segment->uva)) {
+				segment->mark_dirty(uva);
+				val1 = amo_atomic<T>(a_op, uva, val2);
+			} else if (unlikely(amo_device(mpa, a_op, val1, val2))) {
 				proc.raise(rv_cause_fault_store, va);
 				return;
 			}
 
-			/* execute atomic op */
-			val2 = amo_fn<UX>(a_op, val1, val2);
+			/* clear reservations held by other harts */
+			if (unlikely(mem->shared)) mem->clear_reservations(mpa);
+			count_access<P,hpm_event_store>(proc, mpa);
+		}
+
+		/* device amo is a load and store on the memory bus under the io lock */
+		template <typename T>
+		buserror_t amo_device(addr_t mpa, const amo_op a_op, T &val1, T val2)
+		{
+			std::lock_guard<std::recursive_mutex> lock(mem->io_lock);
+			if (mem->load(mpa, val1)) return -1;
+			return mem->store(mpa, T(amo_fn<UX>(a_op, val1, val2)));
+		}
+
+		/* load reserved: the reservation holds the physical address and value */
+		template <typename P, typename T, const mmu_op op = op_load>
+		void lr(P &proc, UX va, T &val)
+		{
+			typename tlb_type::tlb_entry_t* tlb_ent = nullptr;
+			memory_segment<UX> *segment = nullptr;
+
+			/* raise exception if address is misalligned */
+			if (unlikely(misaligned<T>(va))) {
+				proc.raise(rv_cause_misaligned_load, va);
+				return;
+			}
+
+			/* translate to physical (raises exception on fault) */
+			addr_t mpa = translate_addr<P,op>(proc, va, tlb_ent);
+			if (!mpa) return;
+
+			/* check read permissions and perform load */
+			if (unlikely(load_access_fault(proc, proc.mode, tlb_ent))) {
+				proc.raise(rv_cause_fault_load, va);
+				return;
+			}
+			addr_t uva = mem->mpa_to_host(segment, mpa);
+			if (likely(segment && segment->uva)) {
+				val = lr_atomic<T>(uva);
+			} else if (unlikely(mem->load(mpa, val))) {
+				proc.raise(rv_cause_fault_load, va);
+				return;
+			}
+
+			proc.lr = mpa;
+			proc.lr_val = val;
+			count_access<P,hpm_event_load>(proc, mpa);
+		}
+
+		/*
+		 * store conditional: succeeds if the reservation was not cleared by a
+		 * store from another hart and memory still holds the reserved value
+		 */
+		template <typename P, typename T, const mmu_op op = op_store>
+		void sc(P &proc, UX va, T val, UX &res)
+		{
+			typename tlb_type::tlb_entry_t* tlb_ent = nullptr;
+			memory_segment<UX> *segment = nullptr;
+
+			/* raise exception if address is misalligned */
+			if (unlikely(misaligned<T>(va))) {
+				proc.raise(rv_cause_misaligned_store, va);
+				return;
+			}
+
+			/* translate to physical (raises exception on fault) */
+			addr_t mpa = translate_addr<P,op>(proc, va, tlb_ent);
+			if (!mpa) return;
 
-			/* Check write permissions and perform store */
-			if (unlikely(store_access_fault(proc, proc.mode, tlb_ent) || mem->store(mpa, val2))) {
+			/* check write permissions */
+			if (unlikely(store_access_fault(proc, proc.mode, tlb_ent))) {
 				proc.raise(rv_cause_fault_store, va);
+				return;
+			}
+
+			res = 1;
+			if (proc.lr == typename P::long_t(mpa)) {
+				addr_t uva = mem->mpa_to_host(segment, mpa);
+				if (likely(segment && segment->uva)) {
+					segment->mark_dirty(uva);
+					res = !sc_atomic<T>(uva, T(proc.lr_val), val);
+				} else if (unlikely(mem->store(mpa, val))) {
+					proc.raise(rv_cause_fault_store, va);
+					return;
+				} else {
+					res = 0;
+				}
+
+				/* clear reservations held by other harts */
+				if (res == 0 && unlikely(mem->shared)) mem->clear_reservations(mpa);
 			}
+			proc.lr = -1;
+			if (res == 0) count_access<P,hpm_event_store>(proc, mpa);
 		}
 
 		/* load */
@@ -225,7 +340,9 @@ namespace riscv {
 			/* check read permissions and perform load */
 			if (unlikely(load_access_fault(proc, proc.mode, tlb_ent)|| mem->load(mpa, val))) {
 				proc.raise(rv_cause_fault_load, va);
+				return;
 			}
+			count_access<P,hpm_event_load>(proc, mpa);
 		}
 
 		/* store */
@@ -247,7 +364,12 @@ namespace riscv {
 			/* check write permissions and perform store */
 			if (unlikely(store_access_fault(proc, proc.mode, tlb_ent) || mem->store(mpa, val))) {
 				proc.raise(rv_cause_fault_store, va);
+				return;
 			}
+			count_access<P,hpm_event_store>(proc, mpa);
+
+			/* clear reservations held by other harts */
+			if (unlikely(mem->shared)) mem->clear_reservations(mpa);
 		}
 
 		template <typename P> constexpr UX effective_mode(P &proc, const mmu_op op)
@@ -307,12 +429,31 @@ namespace riscv {
 		{
 			tlb_ent = tlb.lookup(proc.pdid, proc.sptbr >> tlb_type::ppn_bits, va);
 			if (tlb_ent) {
+				/* hits are only counted while an hpm counter or the statistics export tracks them */
+				if (op == op_fetch) {
+					if (proc.hpm.template armed<hpm_event_itlb_hit>()) {
+						itlb_hits++;
+						proc.hpm.add(hpm_event_itlb_hit);
+					}
+				} else {
+					if (proc.hpm.template armed<hpm_event_dtlb_hit>()) {
+						dtlb_hits++;
+						proc.hpm.add(hpm_event_dtlb_hit);
+					}
+				}
+
 				/* check if accessed and dirty flags are up-to-date */
 				uintptr_t ad_flags = pte_flag_A | (op == op_store ? pte_flag_D : 0);
-				if ((tlb_ent->pteb & ad_flags) != ad_flags) {
-					/* rewalk the page table to find the PTE address and update flags */
+				if ((tlb_ent->pteb & ad_flags) == ad_flags) {
 					return page_translate_offset<PTM>(tlb_ent->ppn, va, tlb_ent->ptel);
 				}
+				/* rewalk the page table to find the PTE address and update flags */
+			} else if (op == op_fetch) {
+				itlb_misses++;
+				proc.hpm.template count<hpm_event_itlb_miss>();
+			} else {
+				dtlb_misses++;
+				proc.hpm.template count<hpm_event_dtlb_miss>();
 			}
 			return page_translate_addr_tlb_miss<P,PTM>(proc, va, op, tlb, tlb_ent);
 		}
@@ -333,7 +474,9 @@ namespace riscv {
 			typename PTM::pte_type pte;
 			UX level;
 
-			/* TODO: TLB statistics */
+			phase_scope timer(proc.phases, phase_mmu);
+			page_walks++;
+			proc.hpm.template count<hpm_event_page_walk>();
 
 			/* Walk the page table to find a leaf PTE entry
 			 * (access fault is raised if leaf PTE is not found) */
@@ -8,111 +8,126 @@
 namespace riscv {
 
 	/*
-	 * work-in-progress node class for eventual SMP implementation
+	 * SMP node
+	 *
+	 * The first hart is initialized and run on the main thread and owns the
+	 * memory map and devices. Secondary harts share the memory map and devices
+	 * of the first hart, have their own registers, TLBs and instruction caches,
+	 * and each run on their own host thread.
+	 *
+	 * External interrupts and the console are routed to the first hart.
+	 * Asynchronous signals are blocked on secondary hart threads so they are
+	 * delivered to the main thread. The node powers off when the first hart
+	 * stops running. The debugger drives only the first hart, so rv-sys
+	 * rejects --debug with more than one hart.
 	 *
 	 * TODO
 	 *
-	 *  - change rv-sys to create a node with n harts
-	 *  - move the shared memory map into the node class
+	 *  - move the shared memory map from the first hart into the node class
 	 *  - rewire debug CLI to node and allow selection of hart
 	 */
 
 	template <typename P>
-	struct node_processor : P, std::thread
+	struct node_processor : P
 	{
-		node_processor() : P(), std::thread(&node_processor::mainloop) {}
+		std::thread thread;
+
+		void start()
+		{
+			thread = std::thread(&node_processor::mainloop, this);
+		}
 
 		void mainloop()
 		{
-			P::init();
+			sigset_t set;
+			sigemptyset(&set);
+			sigaddset(&set, SIGTERM);
+			sigaddset(&set, SIGQUIT);
+			sigaddset(&set, SIGINT);
+			sigaddset(&set, SIGHUP);
+			sigaddset(&set, SIGUSR1);
+			if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+				panic("can't set thread signal mask: %s", strerror(errno));
+			}
+			fenv_init();
+			processor_singleton::current = this;
 			P::run();
 		}
-	};
 
-	struct node_fault
-	{
-		static node_fault *current;
+		void join()
+		{
+			if (thread.joinable()) thread.join();
+		}
 	};
 
-	node_fault* node_fault::current = nullptr;
-
 	template <typename P>
-	struct node : node_fault
+	struct node
 	{
-		std::vector<std::shared_ptr<P>> nodes;
+		typedef node_processor<P> hart_type;
+
+		std::vector<std::shared_ptr<hart_type>> harts;
 
-		node(size_t num_nodes)
+		node(size_t num_harts)
 		{
-			init();
-			for (size_t i = 0; i < num_nodes; i++) {
-				nodes.push_back(std::make_shared<P>());
+			for (size_t i = 0; i < num_harts; i++) {
+				auto hart = std::make_shared<hart_type>();
+				hart->hart_id = i;
+				hart->num_harts = num_harts;
+				harts.push_back(hart);
 			}
 		}
 
-		static void signal_handler(int signum, siginfo_t *info, void *)
+		/* devices refer to the first hart so it is destroyed last */
+		~node()
 		{
-			static_cast<node<P>*>
-				(node_fault::current)->signal_dispatch(signum, info);
+			while (harts.size() > 0) {
+				harts.pop_back();
+			}
 		}
 
-		void signal_dispatch(int signum, siginfo_t *info)
-		{
-			printf("SIGNAL   :%s\n", signal_name(signum));
-		}
+		hart_type& primary() { return *harts[0]; }
 
-		void init()
+		/* share memory and devices of the initialized first hart */
+		void attach()
 		{
-			/*
-			 * Note: the processor currently runs in the main thread.
-			 * When SMP is implemented, hart threads will be changed
-			 * to block all interrupts except for SIGSEGV and the main
-			 * thread will be configured to monitor for interrupts and
-			 * signals to deliver to the hart threads.
-			 */
-
-			// block signals before so we don't deadlock in signal handlers
-			sigset_t set;
-			sigemptyset(&set);
-			sigaddset(&set, SIGSEGV);
-			sigaddset(&set, SIGTERM);
-			sigaddset(&set, SIGQUIT);
-			sigaddset(&set, SIGINT);
-			sigaddset(&set, SIGHUP);
-			sigaddset(&set, SIGUSR1);
-			if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
-				panic("can't set thread signal mask: %s", strerror(errno));
-			}
-
-			// disable unwanted signals
-			sigset_t sigpipe_set;
-			sigemptyset(&sigpipe_set);
-			sigaddset(&sigpipe_set, SIGPIPE);
-			sigprocmask(SIG_BLOCK, &sigpipe_set, nullptr);
-
-			// install signal handler
-			struct sigaction sigaction_handler;
-			memset(&sigaction_handler, 0, sizeof(sigaction_handler));
-			sigaction_handler.sa_sigaction = &node<P>::signal_handler;
-			sigaction_handler.sa_flags = SA_SIGINFO;
-			sigaction(SIGSEGV, &sigaction_handler, nullptr);
-			sigaction(SIGTERM, &sigaction_handler, nullptr);
-			sigaction(SIGQUIT, &sigaction_handler, nullptr);
-			sigaction(SIGINT, &sigaction_handler, nullptr);
-			sigaction(SIGHUP, &sigaction_handler, nullptr);
-			sigaction(SIGUSR1, &sigaction_handler, nullptr);
-			node_fault::current = this;
-
-			/* unblock signals */
-			if (pthread_sigmask(SIG_UNBLOCK, &set, NULL) != 0) {
-				panic("can't set thread signal mask: %s", strerror(errno));
+			auto &mem = primary().mmu.mem;
+			mem->shared = harts.size() > 1;
+			for (auto &hart : harts) {
+				if (hart.get() != &primary()) {
+					hart->window = primary().window;
+					hart->log = primary().log;
+					hart->roi = primary().roi.fork();
+					hart->stats_dirname = primary().stats_dirname;
+					hart->attach(primary());
+					hart->reset();
+					if (primary().trace) {
+						hart->trace_open(primary().trace_filename + "." + std::to_string(hart->hart_id));
+					}
+					if (primary().stats) hart->stats_attach(primary().stats);
+					if (primary().profile) {
+						hart->profile = primary().profile->fork(primary().profile->filename + "." + std::to_string(hart->hart_id));
+					}
+					if (primary().wss) {
+						hart->wss = primary().wss->fork(primary().wss->prefix + "." + std::to_string(hart->hart_id), hart->instret);
+					}
+				}
+				mem->reservations.push_back(reinterpret_cast<typename P::ux*>(&hart->lr));
 			}
 		}
 
-		void shutdown()
+		/* run secondary harts on their own threads and the first hart on this thread */
+		void run(exit_cause ex)
 		{
-			for (auto &node : nodes) {
-				node->shutdown();
-				node->join();
+			for (auto &hart : harts) {
+				if (hart.get() != &primary()) hart->start();
+			}
+			primary().run(ex);
+			for (auto &hart : harts) {
+				hart->halt = true;
+				hart->wake();
+			}
+			for (auto &hart : harts) {
+				hart->join();
 			}
 		}
 	};
@@ -163,7 +163,8 @@ namespace riscv {
 		u16 node_id;                  /* Node Identifier */
 		u16 hart_id;                  /* Hardware Thread Identifier */
 		u32 log;                      /* Log flags */
-		SX lr;                        /* Load Reservation (TODO - global) */
+		SX lr;                        /* Load Reservation address */
+		SX lr_val;                    /* Load Reservation value */
 		SX cause;                     /* Fault cause */
 		SX badaddr;                   /* Fault address */
 		jmp_buf env;                  /* Fault handler */
@@ -186,7 +187,7 @@ namespace riscv {
 		u32 fcsr;                     /* Floating-Point Control and Status Register */
 
 		processor_base() : pc(0), ireg(), freg(),
-			node_id(0), hart_id(0), log(0), lr(0), cause(0), badaddr(0), env(),
+			node_id(0), hart_id(0), log(0), lr(-1), lr_val(0), cause(0), badaddr(0), env(),
 			running(true), debugging(false), exceptions(true),
 			update_instret(false), memory_registers(false),
 			breakpoint(0), trace_iters(0), trace_pc(), trace_fn(),
@@ -201,7 +202,8 @@ namespace riscv {
 			internal_cause_cli      = 0x1001,
 			internal_cause_poweroff = 0x1002,
 			internal_cause_fatal    = 0x1003,
-			internal_cause_hotspot  = 0x1004
+			internal_cause_hotspot  = 0x1004,
+			internal_cause_yield    = 0x1005
 		};
 
 		/* program counter histogram sentinels */
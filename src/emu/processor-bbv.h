@@ -0,0 +1,144 @@
+//
+//  processor-bbv.h
+//
+
+#ifndef rv_processor_bbv_h
+#define rv_processor_bbv_h
+
+namespace riscv {
+
+	/*
+	 * Basic block vectors
+	 *
+	 * Retired instructions are counted per basic block, where a block
+	 * starts at the first instruction after a branch, jump or system
+	 * instruction. At the end of each interval the non-zero counts are
+	 * written as one line of a SimPoint frequency vector file:
+	 *
+	 *   T:<block id>:<instructions> :<block id>:<instructions> ...
+	 *
+	 * Block ids start at 1 in order of first execution. The interpreter
+	 * increments the length of the current block and adds it to the block
+	 * counter when the block ends. Intervals end at the first block end
+	 * after the interval is reached. JIT traces do not end at every block
+	 * so rv-jit interprets the program while --bbv is given.
+	 */
+
+	struct bbv_block
+	{
+		u64 count;
+		u32 id;
+	};
+
+	struct bbv_cache_ent
+	{
+		u64 pc;
+		u64 *count;
+	};
+
+	struct guest_bbv
+	{
+		static const size_t cache_size = 256;
+
+		std::string filename;
+		u64 interval;
+		FILE *file;
+
+		google::dense_hash_map<u64,size_t> block_index;
+		std::deque<bbv_block> blocks; /* counter addresses are held by the cache */
+		bbv_cache_ent cache[cache_size] = {};
+		u64 block_pc = 0;
+		u64 block_len = 0;
+		u64 insts = 0;
+		u64 intervals = 0;
+
+		guest_bbv(std::string filename, u64 interval) :
+			filename(filename), interval(interval)
+		{
+			block_index.set_empty_key(-1);
+			file = fopen(filename.c_str(), "w");
+			if (!file) {
+				panic("bbv: can't open %s: %s", filename.c_str(), strerror(errno));
+			}
+		}
+
+		~guest_bbv()
+		{
+			if (file) fclose(file);
+		}
+
+		/* vectors of a new guest thread with the same interval */
+		std::shared_ptr<guest_bbv> fork(std::string filename)
+		{
+			return std::make_shared<guest_bbv>(filename, interval);
+		}
+
+		u64* counter(u64 pc)
+		{
+			auto bi = block_index.find(pc);
+			if (bi != block_index.end()) return &blocks[bi->second].count;
+			block_index[pc] = blocks.size();
+			blocks.push_back(bbv_block{ 0, u32(blocks.size() + 1) });
+			return &blocks.back().count;
+		}
+
+		/* direct mapped cache in front of the block index */
+		u64* cached_counter(u64 pc)
+		{
+			bbv_cache_ent &ent = cache[(pc >> 1) & (cache_size - 1)];
+			if (ent.pc != pc || !ent.count) {
+				ent.pc = pc;
+				ent.count = counter(pc);
+			}
+			return ent.count;
+		}
+
+		/* called for each retired instruction, end is set if it ends the block */
+		void retire(u64 pc, bool end)
+		{
+			if (block_len++ == 0) block_pc = pc;
+			if (end) flush();
+		}
+
+		/* end the current block */
+		void flush()
+		{
+			if (block_len == 0) return;
+			*cached_counter(block_pc) += block_len;
+			advance(block_len);
+			block_len = 0;
+		}
+
+		/* count instructions added to the block counters */
+		void advance(u64 count)
+		{
+			insts += count;
+			if (insts >= interval) write_interval();
+		}
+
+		void write_interval()
+		{
+			fputs("T", file);
+			for (auto &block : blocks) {
+				if (block.count == 0) continue;
+				fprintf(file, ":%u:%llu ", block.id, block.count);
+				block.count = 0;
+			}
+			fputs("\n", file);
+			insts = 0;
+			intervals++;
+		}
+
+		void close()
+		{
+			flush();
+			if (insts > 0) write_interval();
+			fclose(file);
+			file = nullptr;
+			debug("bbv: %s: intervals=%llu blocks=%zu", filename.c_str(), intervals, blocks.size());
+		}
+	};
+
+}
+
+#endif
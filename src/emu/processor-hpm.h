@@ -0,0 +1,170 @@
+//
+//  processor-hpm.h
+//
+
+#ifndef rv_processor_hpm_h
+#define rv_processor_hpm_h
+
+namespace riscv {
+
+	/*
+	 * Hardware performance monitor
+	 *
+	 * mhpmcounter3..31 count the emulator event selected by the matching
+	 * mhpmevent3..31 register. Unsupported event numbers read back as zero.
+	 *
+	 *   0x001  L1 ITLB hit            0x007  store
+	 *   0x002  L1 ITLB miss           0x008  branch
+	 *   0x003  L1 DTLB hit            0x009  taken branch
+	 *   0x004  L1 DTLB miss           0x00a  compressed instruction
+	 *   0x005  page table walk        0x00b  MMIO access
+	 *   0x006  load                   0x00c  trap
+	 *   0x100 + <cause>               exception with cause
+	 *   0x200 + <cause>               interrupt with cause
+	 *
+	 * Event sites are specialised on the event number and test one bit
+	 * of the mask of enabled events, which also holds the events tracked
+	 * for the statistics export. Branch and compressed instruction
+	 * events are counted at retire by a step loop that is only used
+	 * while one of them is selected.
+	 */
+
+	enum hpm_event : u32
+	{
+		hpm_event_none = 0x000,
+		hpm_event_itlb_hit = 0x001,
+		hpm_event_itlb_miss = 0x002,
+		hpm_event_dtlb_hit = 0x003,
+		hpm_event_dtlb_miss = 0x004,
+		hpm_event_page_walk = 0x005,
+		hpm_event_load = 0x006,
+		hpm_event_store = 0x007,
+		hpm_event_branch = 0x008,
+		hpm_event_branch_taken = 0x009,
+		hpm_event_compressed = 0x00a,
+		hpm_event_mmio = 0x00b,
+		hpm_event_trap = 0x00c,
+		hpm_event_exception = 0x100,
+		hpm_event_interrupt = 0x200
+	};
+
+	enum : u64 {
+		hpm_counter_first = 3,
+		hpm_counter_count = 29,
+		hpm_exception_count = 16,
+		hpm_interrupt_count = 12,
+		hpm_mask_exception = 1ULL << 13,
+		hpm_mask_interrupt = 1ULL << 14,
+		hpm_mask_retire = (1ULL << hpm_event_branch) | (1ULL << hpm_event_branch_taken) |
+			(1ULL << hpm_event_compressed),
+		hpm_mask_trap = (1ULL << hpm_event_trap) | hpm_mask_exception | hpm_mask_interrupt,
+		hpm_mask_tlb_hit = (1ULL << hpm_event_itlb_hit) | (1ULL << hpm_event_dtlb_hit)
+	};
+
+	struct hpm_counters
+	{
+		u64 counter[hpm_counter_count];
+		u64 event[hpm_counter_count];
+		u64 selected;                 /* events selected by mhpmevent3..31 */
+		u64 tracked;                  /* events counted for the statistics export */
+		u64 enabled;
+
+		hpm_counters() : counter(), event(), selected(0), tracked(0), enabled(0) {}
+
+		static bool valid(u64 e)
+		{
+			return (e >= hpm_event_itlb_hit && e <= hpm_event_trap) ||
+				(e >= hpm_event_exception && e < hpm_event_exception + hpm_exception_count) ||
+				(e >= hpm_event_interrupt && e < hpm_event_interrupt + hpm_interrupt_count);
+		}
+
+		static u64 event_mask(u64 e)
+		{
+			if (e >= hpm_event_interrupt) return hpm_mask_interrupt;
+			if (e >= hpm_event_exception) return hpm_mask_exception;
+			return e ? 1ULL << e : 0;
+		}
+
+		static std::string event_name(u64 e)
+		{
+			static const char* names[] = {
+				"none", "itlb_hit", "itlb_miss", "dtlb_hit", "dtlb_miss", "page_walk",
+				"load", "store", "branch", "branch_taken", "compressed", "mmio", "trap"
+			};
+			if (e >= hpm_event_interrupt) {
+				return format_string("interrupt:%s", rv_intr_name_sym[e - hpm_event_interrupt]);
+			}
+			if (e >= hpm_event_exception) {
+				/* the cause name table does not skip reserved cause 14 */
+				u64 cause = e - hpm_event_exception;
+				return cause <= rv_cause_load_page_fault ?
+					format_string("exception:%s", rv_cause_name_sym[cause]) :
+					format_string("exception:%llu", cause);
+			}
+			return names[e];
+		}
+
+		void set_event(size_t i, u64 e)
+		{
+			event[i] = valid(e) ? e : hpm_event_none;
+			selected = 0;
+			for (size_t j = 0; j < hpm_counter_count; j++) {
+				selected |= event_mask(event[j]);
+			}
+			enabled = selected | tracked;
+		}
+
+		void track(u64 mask)
+		{
+			tracked = mask;
+			enabled = selected | tracked;
+		}
+
+		bool retire_armed() { return (selected & hpm_mask_retire) != 0; }
+
+		template <hpm_event E> bool armed()
+		{
+			return unlikely((enabled & (1ULL << E)) != 0);
+		}
+
+		template <hpm_event E> void count()
+		{
+			if (armed<E>()) add(E);
+		}
+
+		void clear()
+		{
+			for (size_t i = 0; i < hpm_counter_count; i++) counter[i] = 0;
+		}
+
+		void add(u64 e)
+		{
+			if ((selected & event_mask(e)) == 0) return;
+			for (size_t i = 0; i < hpm_counter_count; i++) {
+				if (event[i] == e) counter[i]++;
+			}
+		}
+
+		void trap(u64 cause, bool interrupt)
+		{
+			if (likely((enabled & hpm_mask_trap) == 0)) return;
+			add(hpm_event_trap);
+			add((interrupt ? hpm_event_interrupt : hpm_event_exception) + cause);
+		}
+
+		void print()
+		{
+			bool any = false;
+			for (size_t i = 0; i < hpm_counter_count; i++) {
+				if (event[i] == hpm_event_none) continue;
+				printf("mhpmcounter%-2zu %-28s %20llu\n", size_t(i + hpm_counter_first),
+					event_name(event[i]).c_str(), counter[i]);
+				any = true;
+			}
+			if (!any) printf("no performance counters selected\n");
+		}
+	};
+
+}
+
+#endif
@@ -54,6 +54,22 @@ namespace riscv {
 		hist_reg_map_t hist_reg;
 		hist_inst_map_t hist_inst;
 		std::function<const char*(addr_t)> symlookup;
+		std::shared_ptr<trace_writer> trace;
+		std::string trace_filename;
+		const u8 *trace_ops = nullptr;
+		u64 trace_ea = 0;
+		log_window window;
+		std::shared_ptr<guest_profile> profile;
+		std::shared_ptr<guest_bbv> bbv;
+		std::shared_ptr<guest_wss> wss;
+		std::shared_ptr<stats_export> stats;
+		std::shared_ptr<stats_block> stats_counters;
+		u64 jit_traces = 0;          /* JIT statistics kept by the JIT run loop */
+		u64 jit_code_bytes = 0;
+		u64 jit_compile_ns = 0;
+		u64 jit_exits = 0;
+		phase_counters phases;
+		guest_roi roi;
 
 		processor_impl() : P()
 		{
@@ -239,11 +255,211 @@ namespace riscv {
 			return operands;
 		}
 
+		void trace_open(std::string filename)
+		{
+			trace_filename = filename;
+			trace_ops = trace_op_info();
+			trace = std::make_shared<trace_writer>(filename, P::xlen, P::hart_id);
+		}
+
+		void trace_close()
+		{
+			if (!trace) return;
+			trace->close();
+			debug("trace: %s: records=%llu raw=%llu file=%llu (%.2f bytes/inst)",
+				trace->filename.c_str(), trace->records, trace->raw_bytes, trace->file_bytes,
+				trace->records ? double(trace->file_bytes) / trace->records : 0.0);
+			trace = nullptr;
+		}
+
+		void profile_close()
+		{
+			if (!profile) return;
+			profile->close();
+			profile = nullptr;
+		}
+
+		/* called after execution and before the program counter is updated */
+		void profile_inst(decode_type &dec, inst_t inst)
+		{
+			if (profile->call_pending) profile->enter(P::pc);
+			switch (dec.op) {
+				case rv_op_jal:
+				case rv_op_jalr:
+					if (dec.rd == rv_ireg_ra || dec.rd == rv_ireg_t0) {
+						profile->call(P::pc + inst_length(inst));
+					} else if (dec.op == rv_op_jalr && dec.rd == rv_ireg_zero &&
+						(dec.rs1 == rv_ireg_ra || dec.rs1 == rv_ireg_t0)) {
+						profile->ret(typename P::ux(P::ireg[dec.rs1].r.xu.val + dec.imm) & ~1);
+					}
+					break;
+				default:
+					break;
+			}
+			profile->retire(P::pc);
+		}
+
+		void bbv_close()
+		{
+			if (!bbv) return;
+			bbv->close();
+			bbv = nullptr;
+		}
+
+		void wss_close()
+		{
+			if (!wss) return;
+			wss->close(P::instret);
+			wss = nullptr;
+		}
+
+		/* called after execution and before the program counter is updated */
+		void bbv_inst(decode_type &dec)
+		{
+			switch (dec.op) {
+				case rv_op_beq:
+				case rv_op_bne:
+				case rv_op_blt:
+				case rv_op_bge:
+				case rv_op_bltu:
+				case rv_op_bgeu:
+				case rv_op_jal:
+				case rv_op_jalr:
+				case rv_op_ecall:
+				case rv_op_ebreak:
+				case rv_op_uret:
+				case rv_op_sret:
+				case rv_op_hret:
+				case rv_op_mret:
+				case rv_op_fence_i:
+					bbv->retire(P::pc, true);
+					break;
+				default:
+					bbv->retire(P::pc, false);
+					break;
+			}
+		}
+
+		/* add this thread or hart to a statistics exporter */
+		void stats_attach(std::shared_ptr<stats_export> exporter)
+		{
+			stats = exporter;
+			stats_counters = exporter ? exporter->attach() : nullptr;
+			if (stats_counters && roi.gated && !roi.inside) stats_counters->stop();
+		}
+
+		/* with gate set statistics are only collected inside guest regions of interest */
+		void roi_init(bool gate)
+		{
+			roi.init(gate, P::log, window);
+			if (stats_counters && gate) stats_counters->stop();
+		}
+
+		/* copy counters to the exporter, called between steps */
+		void stats_publish()
+		{
+			stats_counters->set(stats_instret, P::instret);
+			stats_counters->set(stats_jit_traces, jit_traces);
+			stats_counters->set(stats_jit_code_bytes, jit_code_bytes);
+			stats_counters->set(stats_jit_compile_ns, jit_compile_ns);
+			stats_counters->set(stats_jit_exits, jit_exits);
+			if (phase_profile) stats_counters->set_phases(phases.cycles);
+		}
+
+		/*
+		 * region of interest command, returns true if the log mask changed.
+		 * proc is the complete processor, whose counters are published
+		 * before the command and cleared by roi_reset.
+		 */
+		template <typename D>
+		bool roi_command(D &proc, u32 cmd)
+		{
+			if (stats_counters) proc.stats_publish();
+			if (cmd == roi_reset) proc.roi_reset_counters();
+			return roi_apply(cmd);
+		}
+
+		/* retire a region of interest ecall and end the step if the step loop must change */
+		template <typename D>
+		typename P::ux inst_roi(D &proc, typename P::ux pc_offset)
+		{
+			auto &a0 = P::ireg[rv_ireg_a0].r.xu.val;
+			u32 cmd = u32(a0);
+			bool changed = roi_command(proc, cmd);
+			a0 = cmd < roi_command_count ? 0 : -1;
+			if (changed) {
+				P::pc += pc_offset;
+				P::instret++;
+				P::raise(P::internal_cause_yield, P::pc);
+			}
+			return pc_offset;
+		}
+
+		/* counters outside the processor core cleared by roi_reset */
+		void roi_reset_counters() {}
+
+		/* apply a region of interest command, returns true if the log mask changed */
+		bool roi_apply(u32 cmd)
+		{
+			u32 log = P::log;
+			if (P::log & proc_log_inst) {
+				printf("ROI      :%s pc:0x%0llx instret:%llu\n",
+					guest_roi::name(cmd), addr_t(P::pc), u64(P::instret));
+			}
+			if (!roi.command(cmd, P::instret, P::log, window)) {
+				debug("roi: unknown command %u", cmd);
+				return false;
+			}
+			if (cmd == roi_reset) {
+				hist_reg.clear();
+				hist_inst.clear();
+				if (!roi.jit) hist_pc.clear();
+			}
+			if (stats_counters) {
+				switch (cmd) {
+					case roi_begin: stats_counters->start(); break;
+					case roi_end: stats_counters->stop(); break;
+					case roi_reset: stats_counters->reset(); break;
+					case roi_dump: stats->write_snapshot(); break;
+				}
+			}
+			return P::log != log;
+		}
+
+		/* effective address is found before execution as rd may overwrite rs1 */
+		void trace_mem(decode_type &dec)
+		{
+			u8 info = trace_ops[dec.op];
+			if (info & trace_op_mem) {
+				trace_ea = typename P::ux(P::ireg[dec.rs1].r.xu.val +
+					((info & trace_op_offset) ? dec.imm : 0));
+			}
+		}
+
+		void trace_inst(decode_type &dec, inst_t inst)
+		{
+			u8 info = trace_ops[dec.op], flags = 0;
+			u64 val = 0;
+			if ((info & trace_op_ireg) && dec.rd != 0) {
+				flags |= trace_ireg;
+				val = P::ireg[dec.rd].r.xu.val;
+			} else if (info & trace_op_freg) {
+				flags |= trace_freg;
+				val = P::freg[dec.rd].r.lu.val;
+			}
+			if (info & trace_op_mem) flags |= trace_addr;
+			trace->record(P::pc, P::instret, inst, flags, dec.rd, val, trace_ea);
+		}
+
 		void print_log(decode_type &dec, inst_t inst)
 		{
 			static const char *fmt_32 = "%019llu core-%-4zu:%08llx (%s) %-30s %s\n";
 			static const char *fmt_64 = "%019llu core-%-4zu:%016llx (%s) %-30s %s\n";
 			static const char *fmt_128 = "%019llu core-%-4zu:%032llx (%s) %-30s %s\n";
+			if ((P::log & proc_log_trace) && inst) trace_inst(dec, inst);
+			if ((P::log & proc_log_profile) && inst) profile_inst(dec, inst);
+			if ((P::log & proc_log_bbv) && inst) bbv_inst(dec);
+			if ((P::log & proc_log_wss) && inst) wss->retire(P::instret);
 			if (P::log & proc_log_hist_reg) histogram_add_regs(dec);
 			if (P::log & proc_log_hist_inst) histogram_add_inst(dec);
 			if (P::log & proc_log_inst) {
@@ -262,6 +478,24 @@ namespace riscv {
 
 		void print_device_registers() {}
 
+		void print_hpm_counters() {}
+
+		void print_phase_profile(std::string title)
+		{
+			if (phase_profile) phases.print(title);
+		}
+
+		void print_roi(std::string title)
+		{
+			if (roi.regions > 0 || roi.inside) roi.print(title.c_str(), P::instret);
+		}
+
+		bool save_snapshot(std::string filename) { return false; }
+
+		bool save_checkpoint(std::string filename, std::string base) { return false; }
+
+		bool halted() { return false; }
+
 		void print_csr_registers()
 		{
 			printf("%s %s\n", format_reg("instret", P::instret, true).c_str(),
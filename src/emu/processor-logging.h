@@ -33,6 +33,12 @@ namespace riscv {
 		proc_log_jit_regalloc =    1<<20,      /* Log JIT register allocation */
 		proc_log_exit_log_stats =  1<<21,      /* Log statistics on interpreter exit */
 		proc_log_exit_save_stats = 1<<22,      /* Save statistics on interpreter exit */
+		proc_log_mmio_summary =    1<<23,      /* Count memory mapped IO per device register */
+		proc_log_trace =           1<<24,      /* Write binary instruction trace */
+		proc_log_profile =         1<<25,      /* Sample program counter and call stack */
+		proc_log_bbv =             1<<26,      /* Count basic block vectors */
+		proc_log_syscall_profile = 1<<27,      /* Profile proxy syscall latency and transfer sizes */
+		proc_log_wss =             1<<28,      /* Profile working set and page heatmap */
 	};
 
 }
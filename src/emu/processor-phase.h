@@ -0,0 +1,129 @@
+//
+//  processor-phase.h
+//
+
+#ifndef rv_processor_phase_h
+#define rv_processor_phase_h
+
+#ifndef ENABLE_PHASE_PROFILE
+#define ENABLE_PHASE_PROFILE 0
+#endif
+
+namespace riscv {
+
+	/*
+	 * Emulator phase profiler
+	 *
+	 * Scoped timers read the cycle counter when a phase of the emulator
+	 * is entered and left, and charge the elapsed cycles to the innermost
+	 * active phase, so a page walk during a load is charged to mmu rather
+	 * than exec. Cycles outside any phase (run loop, logging) are charged
+	 * to other, and harts sleeping in wfi are charged to idle.
+	 *
+	 * Sites use phase_scope, which is phase_timer<false> and compiles to
+	 * nothing unless the emulator is built with enable_phase_profile=1.
+	 * Traps longjmp out of timer scopes so the run loop unwinds the active
+	 * phase on its trap return path.
+	 */
+
+	enum phase_id
+	{
+		phase_other,
+		phase_fetch,
+		phase_decode,
+		phase_exec,
+		phase_mmu,
+		phase_isr,
+		phase_jit_compile,
+		phase_jit_exec,
+		phase_syscall,
+		phase_idle,
+		phase_count
+	};
+
+	constexpr bool phase_profile = ENABLE_PHASE_PROFILE;
+
+	struct phase_counters
+	{
+		u64 cycles[phase_count] = {};
+		u64 count[phase_count] = {};
+		u64 last = 0;
+		phase_id current = phase_other;
+
+		static const char* name(size_t id)
+		{
+			static const char* names[phase_count] = {
+				"other", "fetch", "decode", "exec", "mmu", "isr",
+				"jit_compile", "jit_exec", "syscall", "idle"
+			};
+			return names[id];
+		}
+
+		void charge(u64 now)
+		{
+			if (last) cycles[current] += now - last;
+			last = now;
+		}
+
+		/* enter a phase, returns the phase to resume */
+		phase_id enter(phase_id id)
+		{
+			charge(cpu_cycle_clock());
+			count[id]++;
+			phase_id prev = current;
+			current = id;
+			return prev;
+		}
+
+		void leave(phase_id prev)
+		{
+			charge(cpu_cycle_clock());
+			current = prev;
+		}
+
+		/* a trap left the phase scopes it was raised in */
+		void unwind()
+		{
+			charge(cpu_cycle_clock());
+			current = phase_other;
+		}
+
+		void print(std::string title)
+		{
+			u64 total = 0;
+			for (size_t i = 0; i < phase_count; i++) total += cycles[i];
+			printf("\n");
+			printf("%s phase profile\n", title.c_str());
+			printf("%-12s %20s %8s %16s %10s\n", "phase", "cycles", "percent", "entries", "cycles/ent");
+			for (size_t i = 0; i < phase_count; i++) {
+				if (cycles[i] == 0) continue;
+				printf("%-12s %20llu %7.2f%% %16llu %10.1f\n", name(i), cycles[i],
+					total ? cycles[i] * 100.0 / total : 0.0, count[i],
+					count[i] ? double(cycles[i]) / count[i] : 0.0);
+			}
+		}
+	};
+
+	template <bool enabled>
+	struct phase_timer
+	{
+		phase_timer(phase_counters &counters, phase_id id) {}
+	};
+
+	template <>
+	struct phase_timer<true>
+	{
+		phase_counters &counters;
+		phase_id prev;
+
+		phase_timer(phase_counters &counters, phase_id id) :
+			counters(counters), prev(counters.enter(id)) {}
+
+		~phase_timer() { counters.leave(prev); }
+	};
+
+	typedef phase_timer<phase_profile> phase_scope;
+
+}
+
+#endif
@@ -187,6 +187,7 @@ namespace riscv {
 		UX           scause;          /* Supervisor Cause Register */
 		UX           sbadaddr;        /* Supervisor Bad Address Register */
 		UX           sptbr;           /* Supervisor Page Table Base Register */
+		hpm_counters hpm;             /* mhpmcounter3..31 and mhpmevent3..31 */
 
 		processor_priv() : processor_type(), pdid(0), mode(rv_mode_M), resetvec(0x1000) {}
 
@@ -243,38 +244,81 @@ namespace riscv {
 	template <typename P>
 	struct processor_privileged : P
 	{
+		enum { max_harts = 4 };
+
+		event_scheduler sched;  /* device events for this hart (outlives the console) */
 		std::shared_ptr<console_device<processor_privileged>> console;
 		std::shared_ptr<sbi_mmio_device<processor_privileged>> device_sbi;
 		std::shared_ptr<boot_mmio_device<processor_privileged>> device_boot;
 		std::shared_ptr<rtc_mmio_device<processor_privileged>> device_rtc;
-		std::shared_ptr<mipi_mmio_device<processor_privileged>> device_mipi;
+		std::shared_ptr<mipi_mmio_device<processor_privileged,max_harts>> device_mipi;
 		std::shared_ptr<plic_mmio_device<processor_privileged>> device_plic;
 		std::shared_ptr<uart_mmio_device<processor_privileged>> device_uart;
-		std::shared_ptr<timer_mmio_device<processor_privileged>> device_timer;
+		std::shared_ptr<timer_mmio_device<processor_privileged,max_harts>> device_timer;
 		std::shared_ptr<gpio_mmio_device<processor_privileged>> device_gpio;
 		std::shared_ptr<rand_mmio_device<processor_privileged>> device_rand;
 		std::shared_ptr<htif_mmio_device<processor_privileged>> device_htif;
 		std::shared_ptr<config_mmio_device<processor_privileged>> device_config;
 		std::shared_ptr<string_mmio_device<processor_privileged>> device_string;
+		std::shared_ptr<virtio_blk_mmio_device<processor_privileged>> device_disk;
 
-		u64 intr_sleep_time, intr_powerdown_delay;
 		std::vector<struct pollfd> pollfds;
 
 		std::mutex intr_mutex;
 		std::condition_variable intr_cond;
 
+		size_t num_harts;                          /* harts in the node */
+		std::vector<processor_privileged*> harts;  /* harts sharing devices (first hart) */
+		std::atomic<bool> halt;                    /* power off requested */
+		std::thread::id primary_thread;            /* thread running the first hart */
+		bool console_interactive;                  /* console uses the terminal */
+		bool native_sbi;                           /* handle SBI calls from S-mode in the emulator */
+		std::atomic<bool> sfence_pending;          /* another hart requested sfence.vm */
+		u64 sbi_calls;                             /* SBI calls handled in the emulator */
+		u64 exception_count, interrupt_count;      /* traps taken */
+		u64 ecall_count;                           /* user mode environment calls */
+
+		u64 io_count;                              /* device accesses at last service */
+		u64 timer_posted;                          /* timer compare posted to sched */
+		bool intr_eip, intr_tip, intr_sip;         /* interrupts found at last service */
+		u64 rate_time, rate_instret;               /* last step start for the step budget */
+		double inst_per_tick;                      /* instructions per time unit */
+		u64 clock_ns, clock_time;                  /* host clock and time at start */
+
 		std::string stats_dirname;
+		std::string disk_filename;                 /* virtio block device image */
+		std::string disk_overlay;                  /* copy-on-write overlay for the image */
 
 		const char* name() { return "rv-sys"; }
 
 		const u64 RTC_FREQ = 10000000;
 		const u64 RTC_DIV = 1000000000 / RTC_FREQ;
 
-		const u64 POWERDOWN_DELAY_INTERRUPT = 30000000;
-		const u64 POWERDOWN_DELAY_DEFAULT = 10000;
-		const u64 POWERDOWN_SLEEP_DEFAULT = 1000000;
-
-		processor_privileged() : intr_sleep_time(0), intr_powerdown_delay(1000), pollfds() {}
+		const size_t STEP_BUDGET_MIN = 1000;
+
+		const u64 CLOCK_CALIBRATE_NS = 1000000;
+		const u64 WFI_SLEEP_UNCALIBRATED_NS = 100000;
+
+		/* SBI MCALL numbers (see src/rom/sbi-rom.S) */
+		enum {
+			mcall_console_putchar = 1,
+			mcall_console_getchar = 2,
+			mcall_send_ipi = 4,
+			mcall_clear_ipi = 5,
+			mcall_shutdown = 6,
+			mcall_set_timer = 7,
+			mcall_remote_sfence_vm = 8,
+			mcall_remote_fence_i = 9,
+			mcall_remote_sfence_vm_range = 15
+		};
+
+		processor_privileged() : pollfds(),
+			num_harts(1), harts(), halt(false), console_interactive(true),
+			native_sbi(false), sfence_pending(false), sbi_calls(0),
+			exception_count(0), interrupt_count(0), ecall_count(0),
+			io_count(-1), timer_posted(0), intr_eip(false), intr_tip(false), intr_sip(false),
+			rate_time(0), rate_instret(0), inst_per_tick(0),
+			clock_ns(host_cpu::get_instance().get_time_ns()), clock_time(cpu_cycle_clock()) {}
 
 		u64 get_time()
 		{
@@ -295,6 +339,15 @@ namespace riscv {
 					ram_size = seg->size;
 				}
 			}
+			static const char* kCoreFormat =
+R"CONFIG(
+  %d {
+    0 {
+      isa rv64imafd;
+      ipi 0x%x;
+      timecmp 0x%x;
+    };
+  };)CONFIG";
 			static const char* kConfigFormat =
 R"CONFIG(
 platform {
@@ -318,16 +371,16 @@ ram {
     size 0x%x;
   };
 };
-core {
-  0 {
-    0 {
-      isa rv64imafd;
-      ipi 0x%x;
-      timecmp 0x%x;
-    };
-  };
+core {%s
 };)CONFIG";
-			std::string cfg_str;
+			std::string core_str, cfg_str;
+			for (size_t i = 0; i < num_harts; i++) {
+				std::string hart_str;
+				sprintf(hart_str, kCoreFormat, i,
+					device_mipi->mpa + i * sizeof(u32),
+					device_timer->mpa + i * sizeof(u64));
+				core_str += hart_str;
+			}
 			sprintf(cfg_str, kConfigFormat,
 				device_rtc->mpa,
 				RTC_FREQ,
@@ -335,8 +388,7 @@ core {
 				device_htif->mpa,
 				device_htif->mpa + 8,
 				ram_base, ram_size,
-				device_mipi->mpa,
-				device_timer->mpa);
+				core_str.c_str());
 			return cfg_str;
 		}
 
@@ -345,42 +397,207 @@ core {
 			/* set initial value for misa register */
 			P::misa = P::misa_default;
 
+			/* the first hart owns the devices */
+			P::mhartid = P::hart_id;
+			harts.push_back(this);
+			primary_thread = std::this_thread::get_id();
+
 			/* create TIME, MIPI, PLIC and UART devices */
-			console = std::make_shared<console_device<processor_privileged>>(*this);
+			console = std::make_shared<console_device<processor_privileged>>(*this, console_interactive);
 			device_sbi = std::make_shared<sbi_mmio_device<processor_privileged>>(*this, s32(0xfffff000));
 			device_boot = std::make_shared<boot_mmio_device<processor_privileged>>(*this, 0x1000);
 			device_rtc = std::make_shared<rtc_mmio_device<processor_privileged>>(*this, 0x40000000);
-			device_mipi = std::make_shared<mipi_mmio_device<processor_privileged>>(*this, 0x40001000);
+			device_mipi = std::make_shared<mipi_mmio_device<processor_privileged,max_harts>>(*this, 0x40001000);
 			device_plic = std::make_shared<plic_mmio_device<processor_privileged>>(*this, 0x40002000);
 			device_uart = std::make_shared<uart_mmio_device<processor_privileged>>(*this, 0x40003000, device_plic, 3, console);
-			device_timer = std::make_shared<timer_mmio_device<processor_privileged>>(*this, 0x40004000);
+			device_timer = std::make_shared<timer_mmio_device<processor_privileged,max_harts>>(*this, 0x40004000);
 			device_gpio = std::make_shared<gpio_mmio_device<processor_privileged>>(*this, 0x40005000, device_plic, 4);
 			device_rand = std::make_shared<rand_mmio_device<processor_privileged>>(*this, 0x40006000);
 			device_htif = std::make_shared<htif_mmio_device<processor_privileged>>(*this, 0x40008000, console);
 			device_config = std::make_shared<config_mmio_device<processor_privileged>>(*this, 0x4000f000);
 			device_string  = std::make_shared<string_mmio_device<processor_privileged>>(*this, 0x40010000, create_config_string());
+			if (disk_filename.size() > 0) {
+				device_disk = std::make_shared<virtio_blk_mmio_device<processor_privileged>>(*this, 0x40020000, device_plic, 5,
+					disk_filename, disk_overlay);
+			}
 
 			if (P::log & proc_log_config) {
 				printf("%s\n", device_string->str.c_str());
 			}
 
 			/* Add TIME, MIPI, PLIC and UART devices to the mmu */
-			P::mmu.mem->add_segment(device_sbi);
-			P::mmu.mem->add_segment(device_boot);
-			P::mmu.mem->add_segment(device_rtc);
-			P::mmu.mem->add_segment(device_mipi);
-			P::mmu.mem->add_segment(device_plic);
-			P::mmu.mem->add_segment(device_uart);
-			P::mmu.mem->add_segment(device_timer);
-			P::mmu.mem->add_segment(device_gpio);
-			P::mmu.mem->add_segment(device_rand);
-			P::mmu.mem->add_segment(device_htif);
-			P::mmu.mem->add_segment(device_config);
-			P::mmu.mem->add_segment(device_string);
+			P::mmu.mem->add_device(device_sbi);
+			P::mmu.mem->add_device(device_boot);
+			P::mmu.mem->add_device(device_rtc);
+			P::mmu.mem->add_device(device_mipi);
+			P::mmu.mem->add_device(device_plic);
+			P::mmu.mem->add_device(device_uart);
+			P::mmu.mem->add_device(device_timer);
+			P::mmu.mem->add_device(device_gpio);
+			P::mmu.mem->add_device(device_rand);
+			P::mmu.mem->add_device(device_htif);
+			P::mmu.mem->add_device(device_config);
+			P::mmu.mem->add_device(device_string);
+			if (device_disk) {
+				P::mmu.mem->add_device(device_disk);
+			}
+		}
+
+		/* share memory and devices with the first hart */
+		void attach(processor_privileged &primary)
+		{
+			P::misa = P::misa_default;
+			P::mhartid = P::hart_id;
+			P::mmu.mem = primary.mmu.mem;
+			console = primary.console;
+			device_sbi = primary.device_sbi;
+			device_boot = primary.device_boot;
+			device_rtc = primary.device_rtc;
+			device_mipi = primary.device_mipi;
+			device_plic = primary.device_plic;
+			device_uart = primary.device_uart;
+			device_timer = primary.device_timer;
+			device_gpio = primary.device_gpio;
+			device_rand = primary.device_rand;
+			device_htif = primary.device_htif;
+			device_config = primary.device_config;
+			device_string = primary.device_string;
+			device_disk = primary.device_disk;
+			native_sbi = primary.native_sbi;
+			primary.harts.push_back(this);
+		}
+
+		/* wake this hart if it is sleeping in wfi */
+		void wake()
+		{
+			std::lock_guard<std::mutex> intr_lock(intr_mutex);
+			intr_cond.notify_one();
+		}
+
+		/* wake a hart sleeping in wfi */
+		void wake_hart(size_t hart_id)
+		{
+			if (hart_id < harts.size()) {
+				harts[hart_id]->wake();
+			}
+		}
+
+		/*
+		 * power off all harts
+		 *
+		 * When called by a device on the first hart's thread without other
+		 * harts the processor stops immediately, otherwise each hart stops
+		 * at the end of its current step.
+		 */
+		void poweroff()
+		{
+			for (auto hart : harts) {
+				hart->halt = true;
+				hart->wake();
+			}
+			if (harts.size() <= 1 && std::this_thread::get_id() == primary_thread) {
+				P::raise(P::internal_cause_poweroff, P::pc);
+			}
+		}
+
+		bool halted() { return halt; }
+
+		void flush_tlb()
+		{
+			P::mmu.l1_itlb.flush(P::pdid);
+			P::mmu.l1_dtlb.flush(P::pdid);
+		}
+
+		/* flush the TLBs of every hart, waiting until the other harts have flushed */
+		void remote_sfence()
+		{
+			auto &primary = device_mipi->proc;
+			for (auto hart : primary.harts) {
+				if (hart == this) continue;
+				hart->sfence_pending = true;
+				hart->wake();
+			}
+			flush_tlb();
+			for (auto hart : primary.harts) {
+				while (hart != this && hart->sfence_pending && !hart->halt) {
+					/* flush for a hart that is waiting on us */
+					if (sfence_pending) {
+						flush_tlb();
+						sfence_pending = false;
+					}
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		/*
+		 * SBI call from S-mode handled in the emulator (--native-sbi)
+		 *
+		 * The SBI ROM trampolines put the MCALL number in a7 and ecall to
+		 * the M-mode firmware. The common calls are performed here on the
+		 * devices the firmware would use, so the ecall retires without a
+		 * trap. Returns false for calls left to the firmware.
+		 */
+		bool sbi_call()
+		{
+			auto &a0 = P::ireg[rv_ireg_a0].r.xu.val;
+			auto &mem = *P::mmu.mem;
+			std::unique_lock<std::recursive_mutex> io_lock(mem.io_lock, std::defer_lock);
+			if (mem.shared) io_lock.lock();
+			switch (P::ireg[rv_ireg_a7].r.xu.val) {
+				case mcall_console_putchar:
+					console->write_char(u8(a0));
+					a0 = 0;
+					break;
+				case mcall_console_getchar:
+					a0 = console->has_char() ? console->read_char() : -1;
+					break;
+				case mcall_send_ipi:
+					device_mipi->signal_ipi(a0, 1);
+					a0 = 0;
+					break;
+				case mcall_clear_ipi:
+					a0 = device_mipi->ipi_pending(P::hart_id);
+					device_mipi->hart[P::hart_id] = 0;
+					break;
+				case mcall_set_timer:
+					device_timer->timecmp[P::hart_id] = a0;
+					device_timer->claimed[P::hart_id] = 0;
+					sched.post(a0);
+					timer_posted = a0;
+					a0 = 0;
+					break;
+				case mcall_shutdown:
+					io_lock = std::unique_lock<std::recursive_mutex>();
+					device_mipi->proc.poweroff();
+					a0 = 0;
+					break;
+				case mcall_remote_sfence_vm:
+				case mcall_remote_sfence_vm_range:
+					/* all harts are flushed whatever the hart mask */
+					io_lock = std::unique_lock<std::recursive_mutex>();
+					remote_sfence();
+					a0 = 0;
+					break;
+				case mcall_remote_fence_i:
+					/* decoded instructions are cached by value so there is nothing to flush */
+					a0 = 0;
+					break;
+				default:
+					return false;
+			}
+
+			/* service devices on the next step as if the firmware accessed them */
+			mem.io_count.store(mem.io_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			sbi_calls++;
+			return true;
 		}
 
 		void exit(int rc)
 		{
+			/* report histograms recorded in logging windows and regions of interest */
+			P::log |= (P::window.flags | P::roi.flags) & (proc_log_hist_pc | proc_log_hist_reg | proc_log_hist_inst);
+
 			if (P::log & proc_log_exit_log_stats) {
 
 				/* print integer register file */
@@ -401,6 +618,14 @@ core {
 				printf("~~~~~~~~~~~~~~~~~~~\n");
 				print_device_registers();
 
+				/* performance counters selected by the guest */
+				if (P::hpm.selected) {
+					printf("\n");
+					printf("performance counters\n");
+					printf("~~~~~~~~~~~~~~~~~~~~\n");
+					print_hpm_counters();
+				}
+
 				/* print program counter histogram */
 				if (P::log & proc_log_hist_pc) {
 					printf("\n");
@@ -444,30 +669,51 @@ core {
 			}
 		}
 
-		void wait_for_interrupt()
+		/* convert time to host nanoseconds using the clock rate since start */
+		u64 time_to_ns(u64 time)
 		{
-			auto &cpu = host_cpu::get_instance();
-
-			/* get time in nanoseconds */
-			u64 t = cpu.get_time_ns();
-
-			/* spin for intr_powerdown_delay after last interrupt */
-			if (t - intr_sleep_time < intr_powerdown_delay) {
-				std::this_thread::yield();
-				return;
+			u64 ns = host_cpu::get_instance().get_time_ns() - clock_ns;
+			u64 elapsed = cpu_cycle_clock() - clock_time;
+			if (ns < CLOCK_CALIBRATE_NS || elapsed == 0) {
+				return WFI_SLEEP_UNCALIBRATED_NS;
 			}
+			return u64(double(time) * double(ns) / double(elapsed));
+		}
 
-			/* sleep on interrupt condition variable */
+		/* check for an event that ends wfi */
+		bool wfi_wakeup()
+		{
+			u64 timecmp;
+			return halt ||
+				P::mmu.mem->io_count.load(std::memory_order_relaxed) != io_count ||
+				sched.due(cpu_cycle_clock()) ||
+				(intr_eip && (P::mie.r.meie || P::mie.r.seie)) ||
+				(intr_sip && (P::mie.r.msie || P::mie.r.ssie)) ||
+				device_mipi->ipi_pending(P::hart_id) ||
+				(P::hart_id == 0 && console->has_char()) ||
+				sfence_pending ||
+				(device_timer->timer_armed(P::hart_id, timecmp) && timecmp != timer_posted);
+		}
+
+		/*
+		 * wait for interrupt
+		 *
+		 * The hart sleeps until its next device event is due, another hart
+		 * sends an interrupt or reprograms its timer, or the console receives
+		 * input. Without a pending event the hart sleeps until it is woken.
+		 */
+		void wait_for_interrupt()
+		{
+			phase_scope timer(P::phases, phase_idle);
 			std::unique_lock<std::mutex> intr_lock(intr_mutex);
-			if (intr_cond.wait_for(intr_lock, std::chrono::nanoseconds
-				(POWERDOWN_SLEEP_DEFAULT)) == std::cv_status::no_timeout)
-			{
-				intr_powerdown_delay = POWERDOWN_DELAY_INTERRUPT;
-			} else {
-				intr_powerdown_delay = POWERDOWN_DELAY_DEFAULT;
+			while (!wfi_wakeup()) {
+				u64 next = sched.next(), time = cpu_cycle_clock();
+				if (next == std::numeric_limits<u64>::max()) {
+					intr_cond.wait(intr_lock);
+				} else if (next > time) {
+					intr_cond.wait_for(intr_lock, std::chrono::nanoseconds(time_to_ns(next - time)));
+				}
 			}
-			intr_lock.unlock();
-			intr_sleep_time = cpu.get_time_ns();
 		}
 
 		void print_device_registers()
@@ -480,6 +726,98 @@ core {
 			device_gpio->print_registers();
 			device_htif->print_registers();
 			device_config->print_registers();
+			if (device_disk) device_disk->print_registers();
+			if (native_sbi) debug("sbi:native_calls           %llu", sbi_calls);
+		}
+
+		template <typename S>
+		void snapshot(S &s)
+		{
+			/* user registers */
+			s(P::pc);
+			s(P::ireg);
+			s(P::freg);
+			s(P::fcsr);
+			s(P::lr);
+			s(P::lr_val);
+			s(P::instret);
+
+			/* privileged registers */
+			s(P::pdid);
+			s(P::mode);
+			s(P::resetvec);
+			s(P::misa);
+			s(P::mhartid);
+			s(P::mstatus);
+			s(P::mtvec);
+			s(P::medeleg);
+			s(P::mideleg);
+			s(P::mip);
+			s(P::mie);
+			s(P::mhcounteren);
+			s(P::mscounteren);
+			s(P::mucounteren);
+			s(P::mscratch);
+			s(P::mepc);
+			s(P::mcause);
+			s(P::mbadaddr);
+			s(P::mbase);
+			s(P::mbound);
+			s(P::mibase);
+			s(P::mibound);
+			s(P::mdbase);
+			s(P::mdbound);
+			s(P::stvec);
+			s(P::sedeleg);
+			s(P::sideleg);
+			s(P::sscratch);
+			s(P::sepc);
+			s(P::scause);
+			s(P::sbadaddr);
+			s(P::sptbr);
+			s(P::hpm);
+
+			/* soft-mmu TLBs */
+			s(P::mmu.l1_itlb.tlb);
+			s(P::mmu.l1_dtlb.tlb);
+
+			/* devices */
+			device_rtc->snapshot(s);
+			device_mipi->snapshot(s);
+			device_plic->snapshot(s);
+			device_uart->snapshot(s);
+			device_timer->snapshot(s);
+			device_gpio->snapshot(s);
+			device_htif->snapshot(s);
+			device_config->snapshot(s);
+			if (device_disk) device_disk->snapshot(s);
+		}
+
+		/* optional devices present in the state, recorded in the snapshot header */
+		u32 snapshot_devices()
+		{
+			return device_disk ? snapshot_device_disk : 0;
+		}
+
+		bool save_snapshot(std::string filename)
+		{
+			return snapshot_save(*this, filename);
+		}
+
+		bool save_checkpoint(std::string filename, std::string base)
+		{
+			snapshot_stats stats;
+			if (!snapshot_save(*this, filename, base, &stats)) return false;
+
+			/* track stores from this checkpoint onwards */
+			for (auto &seg : P::mmu.mem->segments) {
+				if (seg->uva) seg->clear_dirty();
+			}
+
+			double secs = stats.time_ns / 1e9, gib = double(stats.pages << page_shift) / (1ULL << 30);
+			debug("checkpoint: %s pages=%llu time=%.3fs cost=%.3fs/GiB",
+				filename.c_str(), stats.pages, secs, gib > 0 ? secs / gib : 0.0);
+			return true;
 		}
 
 		const char* colorize(int val)
@@ -608,6 +946,56 @@ core {
 			}
 		}
 
+		void print_hpm_counters()
+		{
+			P::hpm.print();
+		}
+
+		bool hpm_retire_armed() { return P::hpm.retire_armed(); }
+
+		void stats_attach(std::shared_ptr<stats_export> exporter)
+		{
+			P::hpm.track(exporter ? hpm_mask_tlb_hit : 0);
+			P::stats_attach(exporter);
+		}
+
+		void stats_publish()
+		{
+			P::stats_publish();
+			P::stats_counters->set(stats_itlb_hits, P::mmu.itlb_hits);
+			P::stats_counters->set(stats_itlb_misses, P::mmu.itlb_misses);
+			P::stats_counters->set(stats_dtlb_hits, P::mmu.dtlb_hits);
+			P::stats_counters->set(stats_dtlb_misses, P::mmu.dtlb_misses);
+			P::stats_counters->set(stats_page_walks, P::mmu.page_walks);
+			P::stats_counters->set(stats_syscalls, ecall_count);
+			P::stats_counters->set(stats_exceptions, exception_count);
+			P::stats_counters->set(stats_interrupts, interrupt_count);
+		}
+
+		void roi_reset_counters()
+		{
+			P::hpm.clear();
+		}
+
+		/* branch and compressed instruction events, counted at retire */
+		void hpm_retire(typename P::decode_type &dec, typename P::ux pc_offset, typename P::ux new_offset)
+		{
+			if (pc_offset == 2) P::hpm.template count<hpm_event_compressed>();
+			switch (dec.op) {
+				case rv_op_beq:
+				case rv_op_bne:
+				case rv_op_blt:
+				case rv_op_bge:
+				case rv_op_bltu:
+				case rv_op_bgeu:
+					P::hpm.template count<hpm_event_branch>();
+					if (new_offset != pc_offset) P::hpm.template count<hpm_event_branch_taken>();
+					break;
+				default:
+					break;
+			}
+		}
+
 		addr_t inst_csr(typename P::decode_type &dec, int op, int csr, typename P::ux value, addr_t pc_offset)
 		{
 			/*
@@ -727,7 +1115,31 @@ core {
 				case rv_csr_scause:   P::set_csr(dec, P::mode, op, csr, P::scause, value);     break;
 				case rv_csr_sbadaddr: P::set_csr(dec, P::mode, op, csr, P::sbadaddr, value);   break;
 				case rv_csr_sptbr:    P::set_csr(dec, P::mode, op, csr, P::sptbr, value);      break;
-				default: return -1; /* illegal instruction */
+				default: return inst_csr_hpm(dec, op, csr, value, pc_offset);
+			}
+			return pc_offset;
+		}
+
+		addr_t inst_csr_hpm(typename P::decode_type &dec, int op, int csr, typename P::ux value, addr_t pc_offset)
+		{
+			if (csr >= rv_csr_mhpmcounter3 && csr <= rv_csr_mhpmcounter31) {
+				P::set_csr(dec, P::mode, op, csr, P::hpm.counter[csr - rv_csr_mhpmcounter3], value);
+			} else if (csr >= rv_csr_mhpmcounter3h && csr <= rv_csr_mhpmcounter31h) {
+				P::set_csr_hi(dec, P::mode, op, csr, P::hpm.counter[csr - rv_csr_mhpmcounter3h], value);
+			} else if (csr >= rv_csr_mhpmevent3 && csr <= rv_csr_mhpmevent31) {
+				size_t i = csr - rv_csr_mhpmevent3;
+				bool retire_armed = P::hpm.retire_armed();
+				u64 event = P::hpm.event[i];
+				P::set_csr(dec, P::mode, op, csr, event, value);
+				P::hpm.set_event(i, event);
+				/* retire the write and end the step to switch step loops */
+				if (P::hpm.retire_armed() != retire_armed) {
+					P::pc += pc_offset;
+					P::instret++;
+					P::raise(P::internal_cause_yield, P::pc);
+				}
+			} else {
+				return -1; /* illegal instruction */
 			}
 			return pc_offset;
 		}
@@ -771,11 +1183,23 @@ core {
 					}
 				case rv_op_wfi:
 					if (P::mode >= rv_mode_S) {
+						/* retire wfi and end the step so the isr runs on wakeup */
 						wait_for_interrupt();
+						P::pc += pc_offset;
+						P::instret++;
+						P::raise(P::internal_cause_yield, P::pc);
 						return pc_offset;
 					} else {
 						return -1; /* illegal instruction */
 					}
+				case rv_op_ecall:
+					if (P::ireg[rv_ireg_a7].r.xu.val == roi_ecall) {
+						return P::inst_roi(*this, pc_offset);
+					} else if (native_sbi && P::mode == rv_mode_S && sbi_call()) {
+						return pc_offset;
+					} else {
+						return -1; /* trap to the firmware */
+					}
 				case rv_op_fence:
 					return pc_offset;
 				case rv_op_fence_i:
@@ -785,8 +1209,17 @@ core {
 			return -1; /* illegal instruction */
 		}
 
+		void count_trap(typename P::ux cause, bool interrupt)
+		{
+			if (interrupt) interrupt_count++;
+			else exception_count++;
+			if (!interrupt && cause == rv_cause_user_ecall) ecall_count++;
+			P::hpm.trap(cause, interrupt);
+		}
+
 		void strap(typename P::ux cause, bool interrupt)
 		{
+			count_trap(cause, interrupt);
 			P::sepc = P::pc;
 			P::scause = cause | (interrupt ? (1ULL << (P::xlen - 1)) : 0ULL);
 			P::mstatus.r.spp = P::mode;
@@ -801,6 +1234,7 @@ core {
 
 		void mtrap(typename P::ux cause, bool interrupt)
 		{
+			count_trap(cause, interrupt);
 			P::mepc = P::pc;
 			P::mcause = cause | (interrupt ? (1ULL << (P::xlen - 1)) : 0ULL);
 			P::mstatus.r.mpp = P::mode;
@@ -813,20 +1247,80 @@ core {
 			}
 		}
 
+		/*
+		 * service devices
+		 *
+		 * Runs when a device register was accessed, the console posted input
+		 * or the timer compare is due. External interrupts and the console
+		 * are routed to the first hart.
+		 */
+		void service_devices()
+		{
+			bool console_pending = false;
+			if (P::hart_id == 0) {
+				std::unique_lock<std::recursive_mutex> io_lock(P::mmu.mem->io_lock, std::defer_lock);
+				if (P::mmu.mem->shared) io_lock.lock();
+				device_uart->service();
+				device_gpio->service();
+				if (device_disk) device_disk->service();
+				intr_eip = device_plic->irq_pending();
+				console_pending = console->has_char();
+			}
+			intr_tip = device_timer->timer_pending(P::hart_id, P::time);
+			intr_sip = device_mipi->ipi_pending(P::hart_id) || console_pending;
+
+			/* post the timer compare so we are serviced when it is due */
+			u64 timecmp;
+			if (device_timer->timer_armed(P::hart_id, timecmp) && timecmp != timer_posted) {
+				sched.post(timecmp);
+				timer_posted = timecmp;
+			}
+		}
+
+		/* instructions to step before the next device event is due */
+		size_t step_budget(size_t count)
+		{
+			/* estimate the instruction rate over the last step */
+			if (rate_time != 0 && P::time > rate_time) {
+				inst_per_tick = double(P::instret - rate_instret) / double(P::time - rate_time);
+			}
+			rate_time = P::time;
+			rate_instret = P::instret;
+
+			u64 next = sched.next();
+			if (next == std::numeric_limits<u64>::max() || inst_per_tick == 0) {
+				return count;
+			}
+			double budget = next > P::time ? double(next - P::time) * inst_per_tick : 0;
+			return std::min(count, std::max(STEP_BUDGET_MIN, size_t(std::min(budget, double(count)))));
+		}
+
 		void isr()
 		{
-			/* service all external devices connected to the PLIC */
+			/*
+			 * service devices if an event is due otherwise use the interrupt
+			 * state from the last service, so idle devices cost nothing
+			 */
+
+			/* sfence.vm requested by another hart */
+			if (sfence_pending) {
+				flush_tlb();
+				sfence_pending = false;
+			}
 
-			device_uart->service();
-			device_gpio->service();
+			u64 count = P::mmu.mem->io_count.load(std::memory_order_relaxed);
+			if (count != io_count || sched.due(P::time)) {
+				io_count = count;
+				sched.expire(P::time);
+				service_devices();
+			}
 
 			/*
 			 * service external interrupts from the PLIC if enabled
 			 */
 
 			/* NOTE: delegation is implicit based on enable bits in this model */
-			bool eip = device_plic->irq_pending();
-			if (eip) {
+			if (intr_eip) {
 				P::mip.r.meip = 1;
 				P::mip.r.seip = 1;
 				if (P::mstatus.r.mie && P::mie.r.meie) {
@@ -843,11 +1337,13 @@ core {
 
 			/*
 			 * service timer interrupts if enabled
+			 *
+			 * the timer compare is claimed when it fires so it is pending once
 			 */
 
 			/* NOTE: delegation is implicit based on enable bits in this model */
-			device_rtc->update_time(P::time);
-			bool tip = device_timer->timer_pending(P::hart_id, P::time);
+			bool tip = intr_tip;
+			intr_tip = false;
 			if (tip) {
 				P::mip.r.mtip = 1;
 				P::mip.r.stip = 1;
@@ -868,8 +1364,7 @@ core {
 			 */
 
 			/* NOTE: delegation is implicit based on enable bits in this model */
-			bool sip = device_mipi->ipi_pending(P::hart_id) || console->has_char();
-			if (sip) {
+			if (intr_sip) {
 				P::mip.r.msip = 1;
 				P::mip.r.ssip = 1;
 				if (P::mstatus.r.mie && P::mie.r.msie) {
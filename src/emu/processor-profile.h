@@ -0,0 +1,236 @@
+//
+//  processor-profile.h
+//
+
+#ifndef rv_processor_profile_h
+#define rv_processor_profile_h
+
+namespace riscv {
+
+	/*
+	 * Sampling guest profiler
+	 *
+	 * A sample is taken every interval retired instructions, or every
+	 * interval host nanoseconds with the clock read every profile_time_check
+	 * instructions. Each sample records the program counter and the entry
+	 * addresses on a shadow call stack that is pushed by jal and jalr with
+	 * a link register (ra or t0) and popped by jalr to the link register
+	 * with rd=zero. A return pops frames up to the one with a matching
+	 * return address so longjmp and tail calls do not leave the stack
+	 * unbalanced; returns that match no frame are ignored.
+	 *
+	 * Samples are symbolized when the profile is closed and written as
+	 * folded stacks ( main;foo;bar <count> ) for flame graph tools.
+	 */
+
+	enum {
+		profile_max_depth = 256,
+		profile_time_check = 251,
+		profile_default_interval = 10007
+	};
+
+	struct profile_frame
+	{
+		u64 entry;
+		u64 ra;
+	};
+
+	struct guest_profile
+	{
+		typedef std::function<std::string(addr_t)> symbolize_fn;
+
+		std::string filename;
+		symbolize_fn symbolize;
+		u64 interval;
+		bool host_time;
+		bool stacks;
+
+		u64 countdown;
+		u64 next_time = 0;
+		u64 call_ra = 0;
+		bool call_pending = false;
+		std::vector<profile_frame> stack;
+		std::map<std::vector<u64>,u64> samples;
+		u64 total = 0;
+		u64 overflows = 0;
+
+		guest_profile(std::string filename, symbolize_fn symbolize,
+			u64 interval, bool host_time, bool stacks) :
+			filename(filename), symbolize(symbolize), interval(interval),
+			host_time(host_time), stacks(stacks),
+			countdown(host_time ? profile_time_check : interval) {}
+
+		/* profile of a new guest thread or hart with the same settings */
+		std::shared_ptr<guest_profile> fork(std::string filename)
+		{
+			return std::make_shared<guest_profile>(filename, symbolize,
+				interval, host_time, stacks);
+		}
+
+		/* parse <n> instructions or <n>us host microseconds */
+		static bool parse_interval(std::string s, u64 &interval, bool &host_time)
+		{
+			char *end;
+			interval = strtoull(s.c_str(), &end, 10);
+			if (end == s.c_str() || interval == 0) return false;
+			host_time = (strcmp(end, "us") == 0);
+			if (host_time) interval *= 1000;
+			return host_time || *end == '\0';
+		}
+
+		void call(u64 ra)
+		{
+			call_ra = ra;
+			call_pending = true;
+		}
+
+		/* first instruction after a call */
+		void enter(u64 pc)
+		{
+			call_pending = false;
+			if (stack.size() == profile_max_depth) {
+				overflows++;
+				return;
+			}
+			stack.push_back(profile_frame{ pc, call_ra });
+		}
+
+		void ret(u64 target)
+		{
+			for (size_t i = stack.size(); i > 0; i--) {
+				if (stack[i - 1].ra == target) {
+					stack.resize(i - 1);
+					return;
+				}
+			}
+		}
+
+		void sample(u64 pc, u64 weight)
+		{
+			std::vector<u64> key;
+			if (stacks) {
+				key.reserve(stack.size() + 1);
+				for (auto &frame : stack) key.push_back(frame.entry);
+			}
+			key.push_back(pc);
+			samples[key] += weight;
+			total += weight;
+		}
+
+		bool time_elapsed()
+		{
+			u64 now = host_cpu::get_instance().get_time_ns();
+			if (now < next_time) return false;
+			next_time = now + interval;
+			return true;
+		}
+
+		/* called for each retired instruction */
+		void retire(u64 pc)
+		{
+			if (likely(--countdown > 0)) return;
+			if (host_time) {
+				countdown = profile_time_check;
+				if (time_elapsed()) sample(pc, 1);
+			} else {
+				countdown = interval;
+				sample(pc, 1);
+			}
+		}
+
+		/* called at a JIT trace boundary after count instructions starting at pc */
+		void retire(u64 pc, u64 count)
+		{
+			if (host_time) {
+				if (time_elapsed()) sample(pc, 1);
+			} else if (count >= countdown) {
+				count -= countdown;
+				sample(pc, 1 + count / interval);
+				countdown = interval - count % interval;
+			} else {
+				countdown -= count;
+			}
+		}
+
+		std::string symbol(u64 addr)
+		{
+			return symbolize ? symbolize(addr) : format_string("0x%llx", addr);
+		}
+
+		/* symbolize samples into folded stacks */
+		std::map<std::string,u64> fold()
+		{
+			std::map<std::string,u64> folded;
+			std::map<u64,std::string> names;
+			auto name = [&](u64 addr) -> std::string& {
+				auto ni = names.find(addr);
+				if (ni == names.end()) ni = names.insert(std::make_pair(addr, symbol(addr))).first;
+				return ni->second;
+			};
+			for (auto &ent : samples) {
+				std::string line;
+				for (size_t i = 0; i < ent.first.size(); i++) {
+					std::string &sym = name(ent.first[i]);
+					/* the leaf is usually in the function of the innermost frame */
+					if (i > 0 && i == ent.first.size() - 1 && sym == name(ent.first[i - 1])) break;
+					if (i > 0) line += ";";
+					line += sym;
+				}
+				folded[line] += ent.second;
+			}
+			return folded;
+		}
+
+		void close()
+		{
+			auto folded = fold();
+			FILE *file = fopen(filename.c_str(), "w");
+			if (!file) {
+				debug("profile: can't open %s: %s", filename.c_str(), strerror(errno));
+			} else {
+				for (auto &ent : folded) {
+					fprintf(file, "%s %llu\n", ent.first.c_str(), ent.second);
+				}
+				fclose(file);
+			}
+			print_report(folded);
+		}
+
+		/* self and total samples per function */
+		void print_report(std::map<std::string,u64> &folded)
+		{
+			struct func_count { u64 self = 0; u64 total = 0; };
+			std::map<std::string,func_count> funcs;
+			for (auto &ent : folded) {
+				auto frames = split(ent.first, ";");
+				for (size_t i = 0; i < frames.size(); i++) {
+					/* count recursive functions once per stack */
+					if (std::find(frames.begin(), frames.begin() + i, frames[i]) == frames.begin() + i) {
+						funcs[frames[i]].total += ent.second;
+					}
+				}
+				if (frames.size() > 0) funcs[frames.back()].self += ent.second;
+			}
+			std::vector<std::pair<std::string,func_count>> sorted(funcs.begin(), funcs.end());
+			std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string,func_count> &a,
+				const std::pair<std::string,func_count> &b) {
+				return a.second.self != b.second.self ? a.second.self > b.second.self :
+					a.second.total > b.second.total;
+			});
+			printf("\n");
+			printf("profile %s: %llu samples every %llu %s%s\n", filename.c_str(), total,
+				host_time ? interval / 1000 : interval, host_time ? "us" : "instructions",
+				overflows ? format_string(", %llu calls over the stack depth limit", overflows).c_str() : "");
+			printf("%8s %8s  %s\n", "self", "total", "function");
+			for (auto &ent : sorted) {
+				printf("%7.2f%% %7.2f%%  %s\n",
+					total ? ent.second.self * 100.0 / total : 0.0,
+					total ? ent.second.total * 100.0 / total : 0.0,
+					ent.first.c_str());
+			}
+		}
+	};
+
+}
+
+#endif
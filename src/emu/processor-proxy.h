@@ -7,22 +7,110 @@
 
 namespace riscv {
 
+	/* Guest threads sharing the proxy address space */
+
+	struct proxy_thread_group
+	{
+		std::mutex lock;
+		std::condition_variable cond;
+		size_t live;
+
+		proxy_thread_group() : live(1) {}
+	};
+
+	static_assert(size_t(abi_syscall_count) <= size_t(stats_syscall_slots), "stats_syscall_slots is too small");
+
 	/* Processor ABI/AEE proxy emulator that delegates ecall to an abi proxy */
 
 	template <typename P>
 	struct processor_proxy : P
 	{
-		int set_child_tid;
-		int clear_child_tid;
+		typedef processor_proxy<P> proxy_type;
+		typedef std::function<int(processor_proxy&, typename P::ux flags,
+			typename P::ux stack, typename P::ux ptid,
+			typename P::ux tls, typename P::ux ctid)> clone_fn;
+
+		int tid = 0;
+		addr_t clear_child_tid = 0;
+		addr_t robust_list = 0;
+		std::shared_ptr<proxy_thread_group> threads = std::make_shared<proxy_thread_group>();
+		clone_fn clone_thread;
 
 		elf_file elf;
 		addr_t imageoffset;
 		addr_t imagebase;
 		std::string stats_dirname;
+		u64 syscalls = 0;
+		u64 syscall_ns = 0;
+		u64 syscalls_published = 0;
+		syscall_profile sysprof;
+		bool sysprof_histogram = false;
 
 		const char* name() { return "rv-sim"; }
 
-		void init() {}
+		void init()
+		{
+			if (!tid) tid = getpid();
+		}
+
+		/* share the address space of the parent thread and copy its registers */
+		void attach(processor_proxy &parent)
+		{
+			P::window = parent.window;
+			P::log = parent.log;
+			P::roi = parent.roi.fork();
+			P::mmu.mem = parent.mmu.mem;
+			P::pc = parent.pc;
+			for (size_t i = 0; i < P::ireg_count; i++) P::ireg[i] = parent.ireg[i];
+			for (size_t i = 0; i < P::freg_count; i++) P::freg[i] = parent.freg[i];
+			P::fcsr = parent.fcsr;
+			P::trace_iters = parent.trace_iters;
+			P::update_instret = parent.update_instret;
+			P::memory_registers = parent.memory_registers;
+			P::symlookup = parent.symlookup;
+			P::trace_filename = parent.trace_filename;
+			P::profile = parent.profile;
+			P::bbv = parent.bbv;
+			P::wss = parent.wss;
+			stats_attach(parent.stats);
+			sysprof_histogram = parent.sysprof_histogram;
+			imageoffset = parent.imageoffset;
+			imagebase = parent.imagebase;
+			stats_dirname = parent.stats_dirname;
+			threads = parent.threads;
+			clone_thread = parent.clone_thread;
+		}
+
+		/*
+		 * exit the calling thread. The process exits when the first thread
+		 * exits and no other threads are live, so the first thread waits
+		 * for the others and other threads stop their run loop.
+		 */
+		void exit_thread(int rc)
+		{
+			bool first_thread = (tid == getpid());
+			P::trace_close();
+			P::profile_close();
+			P::bbv_close();
+			P::wss_close();
+			if (P::stats_counters) stats_publish();
+			{
+				std::unique_lock<std::mutex> lock(threads->lock);
+				threads->live--;
+				threads->cond.notify_all();
+				if (first_thread) {
+					threads->cond.wait(lock, [&] { return threads->live == 0; });
+				}
+			}
+			if (first_thread) {
+				exit(rc);
+				::exit(rc);
+			}
+			P::print_phase_profile(format_string("thread %d", tid));
+			P::print_roi(format_string("thread %d", tid));
+			print_syscall_profile();
+			P::raise(P::internal_cause_poweroff, P::pc);
+		}
 
 		void destroy()
 		{
@@ -34,6 +122,21 @@ namespace riscv {
 
 		void exit(int rc)
 		{
+			P::trace_close();
+			P::profile_close();
+			P::bbv_close();
+			P::wss_close();
+			if (P::stats_counters) {
+				stats_publish();
+				P::stats->close();
+			}
+			P::print_phase_profile(format_string("thread %d", tid));
+			P::print_roi(format_string("thread %d", tid));
+			print_syscall_profile();
+
+			/* report histograms recorded in logging windows and regions of interest */
+			P::log |= (P::window.flags | P::roi.flags) & (proc_log_hist_pc | proc_log_hist_reg | proc_log_hist_inst);
+
 			if (P::log & proc_log_exit_log_stats) {
 
 				/* reopen console if necessary */
@@ -136,6 +239,14 @@ namespace riscv {
 			return nullptr;
 		}
 
+		/* name of the function containing an address */
+		std::string symfunction_elf(addr_t addr)
+		{
+			auto sym = addr < imageoffset ? nullptr :
+				elf.sym_by_nearest_addr((Elf64_Addr)(addr - imageoffset));
+			return sym ? std::string(elf.sym_name(sym)) : format_string("0x%llx", addr);
+		}
+
 		/* search for the ELF interpreter if one exists */
 		char* find_interp_path(const char* elf_filename, const char* interp_name)
 		{
@@ -195,11 +306,40 @@ namespace riscv {
 			}
 		}
 
+		/* ELF sections, ELF segments, stack and heap, other guest mappings are mmap */
+		std::vector<wss_region> wss_regions()
+		{
+			std::vector<wss_region> regions;
+			for (size_t i = 0; i < elf.shdrs.size(); i++) {
+				Elf64_Shdr &shdr = elf.shdrs[i];
+				if (!(shdr.sh_flags & SHF_ALLOC) || shdr.sh_size == 0 || elf.shstrtab == 0) continue;
+				u64 begin = shdr.sh_addr + imageoffset;
+				regions.push_back(wss_region{ elf.shdr_name(i), begin, begin + shdr.sh_size });
+			}
+			auto &mem = P::mmu.mem;
+			for (auto &seg : mem->segments) {
+				u64 begin = u64(seg.first), end = begin + seg.second;
+				if (begin >= u64(mem->heap_begin) && end <= u64(mem->heap_end)) continue;
+				regions.push_back(wss_region{ end == P::mmu_type::memory_top ? "stack" : "elf", begin, end });
+			}
+			if (mem->heap_end > mem->heap_begin) {
+				regions.push_back(wss_region{ "heap", u64(mem->heap_begin), u64(mem->heap_end) });
+			}
+			regions.push_back(wss_region{ "mmap", 0, ~0ULL });
+			return regions;
+		}
+
+		/* guest mappings end below 4GiB for rv32 so addresses fit in a register */
+		static constexpr uintptr_t mmap_limit()
+		{
+			return P::xlen == 32 ? GUEST_MMAP_LIMIT_32 : GUEST_MMAP_LIMIT_64;
+		}
+
 		/* Map a single stack segment into user address space */
 		void map_proxy_stack(addr_t stack_top, size_t stack_size)
 		{
 			void *addr = guest_mmap((void*)(stack_top - stack_size), stack_size,
-				PROT_READ | PROT_WRITE, MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+				PROT_READ | PROT_WRITE, MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0, mmap_limit());
 			if (addr == MAP_FAILED) {
 				panic("map_proxy_stack: error: mmap: %s", strerror(errno));
 			}
@@ -322,7 +462,7 @@ namespace riscv {
 
 			/* map the segment */
 			void *addr = guest_mmap((void*)map_vaddr, map_len,
-				elf_p_flags_mmap(phdr.p_flags), MAP_FIXED | MAP_PRIVATE, fd, map_offset);
+				elf_p_flags_mmap(phdr.p_flags), MAP_FIXED | MAP_PRIVATE, fd, map_offset, mmap_limit());
 			close(fd);
 			if (addr == MAP_FAILED) {
 				panic("map_executable: error: mmap: %s: %s", filename, strerror(errno));
@@ -391,7 +531,9 @@ namespace riscv {
 			switch (dec.op) {
 				case rv_op_fence:
 				case rv_op_fence_i: return pc_offset;
-				case rv_op_ecall:  proxy_syscall(*this); return pc_offset;
+				case rv_op_ecall:
+					if (P::ireg[rv_ireg_a7].r.xu.val == roi_ecall) return P::inst_roi(*this, pc_offset);
+					syscall(); return pc_offset;
 				case rv_op_csrrw:  return inst_csr(dec, csr_rw, dec.imm, P::ireg[dec.rs1], pc_offset);
 				case rv_op_csrrs:  return inst_csr(dec, csr_rs, dec.imm, P::ireg[dec.rs1], pc_offset);
 				case rv_op_csrrc:  return inst_csr(dec, csr_rc, dec.imm, P::ireg[dec.rs1], pc_offset);
@@ -403,7 +545,62 @@ namespace riscv {
 			return -1; /* illegal instruction */
 		}
 
+		/* system calls are timed when statistics are exported or profiled */
+		void syscall()
+		{
+			phase_scope timer(P::phases, phase_syscall);
+			syscalls++;
+			if (!P::stats && !(P::log & proc_log_syscall_profile)) {
+				proxy_syscall(*this);
+				return;
+			}
+			/* with --roi the profile only counts inside regions */
+			int slot = P::roi.gated && !P::roi.inside ? -1 :
+				abi_syscall_slot(P::ireg[rv_ireg_a7].r.xu.val);
+			sysprof.enter(slot);
+			u64 start = host_cpu::get_instance().get_time_ns();
+			proxy_syscall(*this);
+			u64 ns = host_cpu::get_instance().get_time_ns() - start;
+			syscall_ns += ns;
+			sysprof.leave(slot, ns, typename P::sx(P::ireg[rv_ireg_a0].r.xu.val));
+		}
+
+		void stats_attach(std::shared_ptr<stats_export> exporter)
+		{
+			if (exporter && exporter->syscall_names.empty()) {
+				for (size_t i = 0; i < abi_syscall_count; i++) {
+					exporter->syscall_names.push_back(abi_syscall_table()[i].name);
+				}
+			}
+			P::stats_attach(exporter);
+		}
+
+		void stats_publish()
+		{
+			P::stats_publish();
+			P::stats_counters->set(stats_syscalls, syscalls);
+			P::stats_counters->set(stats_syscall_ns, syscall_ns);
+			if (syscalls == syscalls_published) return;
+			syscalls_published = syscalls;
+			P::stats_counters->set(stats_io_read_bytes, sysprof.io_bytes[syscall_io_read]);
+			P::stats_counters->set(stats_io_write_bytes, sysprof.io_bytes[syscall_io_write]);
+			for (size_t i = 0; i < abi_syscall_count; i++) {
+				syscall_stat &s = sysprof.stat[i];
+				P::stats_counters->set_syscall(i, s.calls, s.ns, s.max_ns, s.bytes);
+			}
+		}
+
+		void print_syscall_profile()
+		{
+			if (P::log & proc_log_syscall_profile) {
+				sysprof.print(format_string("thread %d", tid), sysprof_histogram);
+			}
+		}
+
 		void isr() {}
+		size_t step_budget(size_t count) { return count; }
+		bool hpm_retire_armed() { return false; }
+		void hpm_retire(typename P::decode_type &dec, typename P::ux pc_offset, typename P::ux new_offset) {}
 		void debug_enter() {}
 		void debug_leave() {}
 
@@ -448,6 +645,170 @@ namespace riscv {
 
 	};
 
+	/* Guest thread created by clone, running on its own host thread */
+
+	template <typename P>
+	struct proxy_thread
+	{
+		typedef typename P::proxy_type proxy_type;
+		typedef typename P::ux ux;
+
+		static int clone(proxy_type &parent, ux flags, ux stack, ux ptid, ux tls, ux ctid)
+		{
+			/* child returns 0 from ecall on the new stack */
+			P *child = new P();
+			child->attach(parent);
+			child->pc = parent.pc + 4;
+			child->ireg[rv_ireg_a0] = 0;
+			if (stack) child->ireg[rv_ireg_sp] = stack;
+			if (flags & abi_clone_SETTLS) child->ireg[rv_ireg_tp] = tls;
+			if (flags & abi_clone_CHILD_CLEARTID) child->clear_child_tid = ctid;
+
+			/*
+			 * wait for the child to publish its tid. The child may exit
+			 * and be deleted before we wake, so it is published here
+			 * rather than read from the child.
+			 */
+			auto threads = parent.threads;
+			std::unique_lock<std::mutex> lock(threads->lock);
+			threads->live++;
+			int tid = 0;
+			std::thread(&proxy_thread::mainloop, child, flags, ptid, ctid, &tid).detach();
+			threads->cond.wait(lock, [&] { return tid != 0; });
+			return tid;
+		}
+
+		static void mainloop(P *child, ux flags, ux ptid, ux ctid, int *parent_tid)
+		{
+			fenv_init();
+			{
+				std::lock_guard<std::mutex> lock(child->threads->lock);
+				child->tid = *parent_tid = abi_host_gettid();
+				if (flags & abi_clone_PARENT_SETTID) *(s32*)(addr_t)ptid = child->tid;
+				if (flags & abi_clone_CHILD_SETTID) *(s32*)(addr_t)ctid = child->tid;
+				child->threads->cond.notify_all();
+			}
+			child->init();
+			if (child->trace_filename.size() > 0) {
+				child->trace_open(child->trace_filename + "." + std::to_string(child->tid));
+			}
+			if (child->profile) {
+				child->profile = child->profile->fork(child->profile->filename + "." + std::to_string(child->tid));
+			}
+			if (child->bbv) {
+				child->bbv = child->bbv->fork(child->bbv->filename + "." + std::to_string(child->tid));
+			}
+			if (child->wss) {
+				child->wss = child->wss->fork(child->wss->prefix + "." + std::to_string(child->tid), child->instret);
+			}
+			child->run();
+			delete child;
+		}
+	};
+
+	/*
+	 * Fork server
+	 *
+	 * The guest runs once up to the fork point, then the server reads
+	 * requests on stdin, one per line naming a file to use as guest stdin
+	 * (an empty line uses /dev/null). Each request forks a child that
+	 * continues the guest from the fork point, sharing the loaded image,
+	 * the warmed up stack and heap, and instruction and trace caches with
+	 * the server copy-on-write. Run status and timings go to stderr.
+	 */
+
+	template <typename P>
+	struct proxy_fork_server
+	{
+		/* fork point is "entry", an address or a symbol in the executable */
+		static addr_t resolve(P &proc, std::string elf_filename, std::string point)
+		{
+			s64 addr;
+			if (point == "entry") return proc.pc;
+			if (parse_integral(point, addr)) return addr_t(addr);
+
+			elf_file exe;
+			exe.load(elf_filename, elf_load_all);
+			auto sym = exe.sym_by_name(point.c_str());
+			if (!sym) {
+				panic("--fork-server: can't find symbol: %s", point.c_str());
+			}
+			if (exe.interp_name() && exe.ehdr.e_type == ET_DYN) {
+				panic("--fork-server: can't resolve %s in a position independent "
+					"dynamic executable, use an address", point.c_str());
+			}
+			return sym->st_value + (exe.interp_name() ? 0 : proc.imageoffset);
+		}
+
+		static void serve(P &proc, addr_t fork_point, u64 start_ns)
+		{
+			host_cpu &cpu = host_cpu::get_instance();
+
+			if (!proc.run_to(fork_point)) {
+				panic("--fork-server: guest stopped before 0x%llx", (u64)fork_point);
+			}
+			if (proc.threads->live != 1) {
+				panic("--fork-server: guest has threads at the fork point");
+			}
+			u64 startup_ns = cpu.get_time_ns() - start_ns;
+
+			size_t runs = 0;
+			u64 fork_ns = 0, run_ns = 0;
+			char line[PATH_MAX + 1];
+			while (fgets(line, sizeof(line), stdin)) {
+				line[strcspn(line, "\r\n")] = 0;
+				const char *input = line[0] ? line : "/dev/null";
+				int fd = open(input, O_RDONLY);
+				if (fd < 0) {
+					fprintf(stderr, "fork-server: %s: %s\n", input, strerror(errno));
+					continue;
+				}
+
+				fflush(stdout);
+				fflush(stderr);
+				u64 t0 = cpu.get_time_ns();
+				pid_t pid = fork();
+				if (pid < 0) {
+					panic("--fork-server: fork: %s", strerror(errno));
+				}
+				if (pid == 0) {
+					/* child continues the guest with the request as stdin */
+					if (dup2(fd, STDIN_FILENO) < 0) ::exit(127);
+					close(fd);
+					proc.tid = getpid();
+					proc.run();
+					proc.destroy();
+					::exit(0);
+				}
+				u64 t1 = cpu.get_time_ns();
+				close(fd);
+
+				int status = 0;
+				while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+				u64 t2 = cpu.get_time_ns();
+
+				runs++;
+				fork_ns += t1 - t0;
+				run_ns += t2 - t0;
+				if (WIFSIGNALED(status)) {
+					fprintf(stderr, "fork-server: run %zu: %s: signal %d time %llu us\n",
+						runs, input, WTERMSIG(status), (t2 - t0) / 1000);
+				} else {
+					fprintf(stderr, "fork-server: run %zu: %s: exit %d time %llu us\n",
+						runs, input, WEXITSTATUS(status), (t2 - t0) / 1000);
+				}
+			}
+
+			/* startup is the cost a fresh process pays that forked runs skip */
+			if (runs > 0) {
+				fprintf(stderr, "fork-server: %zu runs, startup %llu us, "
+					"mean fork %llu us, mean run %llu us\n",
+					runs, startup_ns / 1000, fork_ns / runs / 1000, run_ns / runs / 1000);
+			}
+			::exit(0);
+		}
+	};
+
 }
 
 #endif
@@ -0,0 +1,158 @@
+//
+//  processor-roi.h
+//
+
+#ifndef rv_processor_roi_h
+#define rv_processor_roi_h
+
+namespace riscv {
+
+	/*
+	 * Guest regions of interest
+	 *
+	 * The guest sends region of interest commands to the emulator with a
+	 * marker instruction, an ecall or a store to the HTIF tohost register:
+	 *
+	 *   slti zero, zero, 0x7f0 + <cmd>        rv-sim, rv-jit and rv-sys
+	 *   ecall a7=0x09524f49 a0=<cmd>          rv-sim, rv-jit and rv-sys
+	 *   tohost = (2 << 56) | (<cmd> << 48)    rv-sys, applies to hart 0
+	 *
+	 *   0  begin    start collecting statistics
+	 *   1  end      stop collecting statistics
+	 *   2  reset    reset counters, histograms and region totals
+	 *   3  detail   open the logging window, interpreting JIT code
+	 *   4  fast     close the logging window, resuming the JIT
+	 *   5  dump     print region totals and write a statistics snapshot
+	 *
+	 * Exported statistics only count inside regions. With --roi the
+	 * emulator starts outside a region with the logging window closed,
+	 * and histograms, the profiler and the binary trace are only collected
+	 * inside regions. Region totals are printed on exit. See src/test/roi.h
+	 * for the guest interface.
+	 */
+
+	enum roi_command : u32
+	{
+		roi_begin,
+		roi_end,
+		roi_reset,
+		roi_detail,
+		roi_fast,
+		roi_dump,
+		roi_command_count
+	};
+
+	enum : u32 {
+		roi_marker_base = 0x7f0,
+		roi_ecall = 0x09524f49,
+		roi_htif_device = 2,
+		proc_log_roi_mask = proc_log_hist_reg | proc_log_hist_pc | proc_log_hist_inst |
+			proc_log_trace | proc_log_profile
+	};
+
+	inline bool roi_marker(u32 n) { return n >= roi_marker_base && n < roi_marker_base + roi_command_count; }
+
+	struct guest_roi
+	{
+		u32 flags = 0;              /* statistics log flags collected inside regions */
+		bool jit = false;           /* JIT enabled outside detailed mode */
+		bool gated = false;         /* started outside a region */
+		bool inside = false;
+		u64 regions = 0;
+		u64 instret = 0;
+		u64 ns = 0;
+		u64 start_instret = 0;
+		u64 start_ns = 0;
+
+		static const char* name(u32 cmd)
+		{
+			static const char* names[roi_command_count] = {
+				"begin", "end", "reset", "detail", "fast", "dump"
+			};
+			return cmd < roi_command_count ? names[cmd] : "unknown";
+		}
+
+		/* with gate set the emulator starts outside a region */
+		void init(bool gate, u32 &log, log_window &window)
+		{
+			jit = (log & proc_log_jit_trap) != 0;
+			gated = gate;
+			if (!gate) return;
+
+			/* the JIT run loop counts hot program counters in the pc histogram */
+			flags = log & proc_log_roi_mask & ~(jit ? proc_log_hist_pc : 0);
+			log &= ~flags;
+			window.flags &= ~flags;
+			window.set(false, log);
+		}
+
+		/* state of a new guest thread or hart, which starts at instret zero */
+		guest_roi fork()
+		{
+			guest_roi roi = *this;
+			roi.regions = roi.instret = roi.ns = roi.start_instret = 0;
+			roi.start_ns = host_cpu::get_instance().get_time_ns();
+			return roi;
+		}
+
+		/* apply a command, returns false for an unknown command */
+		bool command(u32 cmd, u64 now_instret, u32 &log, log_window &window)
+		{
+			u64 now_ns = host_cpu::get_instance().get_time_ns();
+			switch (cmd) {
+				case roi_begin:
+					if (!inside) {
+						inside = true;
+						start_instret = now_instret;
+						start_ns = now_ns;
+					}
+					log |= flags;
+					break;
+				case roi_end:
+					if (inside) {
+						inside = false;
+						regions++;
+						instret += now_instret - start_instret;
+						ns += now_ns - start_ns;
+					}
+					log &= ~flags;
+					break;
+				case roi_reset:
+					regions = instret = ns = 0;
+					start_instret = now_instret;
+					start_ns = now_ns;
+					break;
+				case roi_detail:
+					window.set(true, log);
+					log &= ~proc_log_jit_trap;
+					break;
+				case roi_fast:
+					window.set(false, log);
+					if (jit) log |= proc_log_jit_trap;
+					break;
+				case roi_dump:
+					print("dump", now_instret);
+					break;
+				default:
+					return false;
+			}
+			return true;
+		}
+
+		void print(const char *title, u64 now_instret)
+		{
+			u64 total_instret = instret, total_ns = ns, total_regions = regions;
+			if (inside) {
+				total_instret += now_instret - start_instret;
+				total_ns += host_cpu::get_instance().get_time_ns() - start_ns;
+				total_regions++;
+			}
+			printf("roi: %s: regions %llu instret %llu time %.6f s mips %.3f\n", title,
+				total_regions, total_instret, total_ns / 1e9,
+				total_ns ? total_instret * 1e3 / total_ns : 0.0);
+		}
+	};
+
+}
+
+#endif
@@ -11,10 +11,10 @@ namespace riscv {
 
 	struct processor_singleton
 	{
-		static processor_singleton *current;
+		static thread_local processor_singleton *current;
 	};
 
-	processor_singleton* processor_singleton::current = nullptr;
+	thread_local processor_singleton* processor_singleton::current = nullptr;
 
 	template <typename P>
 	struct processor_runloop : processor_singleton, P
@@ -24,6 +24,12 @@ namespace riscv {
 
 		std::shared_ptr<debug_cli<P>> cli;
 
+		u64 snapshot_instret = 0;
+		u64 checkpoint_interval = 0;
+		size_t checkpoint_seq = 0;
+		std::string snapshot_filename;
+		std::string checkpoint_base;
+
 		struct rv_inst_cache_ent
 		{
 			inst_t inst;
@@ -35,6 +41,35 @@ namespace riscv {
 		processor_runloop() : cli(std::make_shared<debug_cli<P>>()), inst_cache() {}
 		processor_runloop(std::shared_ptr<debug_cli<P>> cli) : cli(cli), inst_cache() {}
 
+		/* decode guest code into a cache image that can be shared between processors */
+		void decode_inst_cache(rv_inst_cache_ent *cache, addr_t start, size_t len)
+		{
+			typename P::ux pc_offset;
+			for (size_t offset = 0; offset + 8 <= len; offset += pc_offset) {
+				inst_t inst = riscv::inst_fetch(start + offset, pc_offset);
+				if (pc_offset == 0) {
+					pc_offset = 2;
+					continue;
+				}
+				rv_inst_cache_ent &ent = cache[inst % inst_cache_size];
+				ent.inst = inst;
+				inst_decode(ent.dec, inst);
+			}
+		}
+
+		/* log window markers decode as illegal so only the illegal path tests for them */
+		void inst_decode(typename P::decode_type &dec, inst_t inst)
+		{
+			P::inst_decode(dec, inst);
+			if (unlikely(log_marker_inst(inst))) dec.op = rv_op_illegal;
+		}
+
+		/* start with a copy of a shared instruction cache image */
+		void load_inst_cache(const rv_inst_cache_ent *cache)
+		{
+			std::copy(cache, cache + inst_cache_size, inst_cache);
+		}
+
 		static void signal_handler(int signum, siginfo_t *info, void *)
 		{
 			static_cast<processor_runloop<P>*>
@@ -102,11 +137,13 @@ namespace riscv {
 					case exit_cause_continue:
 						break;
 					case exit_cause_cli:
+						if (!P::debugging) logsave = P::log;
 						P::debugging = true;
 						count = cli->run(this);
 						if (count == size_t(-1)) {
 							P::debugging = false;
 							P::log = logsave;
+							P::window.sync(P::log);
 							count = inst_step;
 						} else {
 							P::log |= (proc_log_inst | proc_log_operands | proc_log_trap);
@@ -115,27 +152,111 @@ namespace riscv {
 					case exit_cause_poweroff:
 						return;
 				}
-				ex = step(count);
+				if (P::halted()) {
+					return;
+				}
+				if (snapshot_instret > P::instret) {
+					ex = step(std::min(u64(count), snapshot_instret - P::instret));
+					if (P::instret == snapshot_instret) save_snapshot();
+				} else {
+					ex = step(count);
+				}
+				if (P::stats_counters) P::stats_publish();
 				if (P::debugging && ex == exit_cause_continue) {
 					ex = exit_cause_cli;
 				}
 			}
 		}
 
+		/* run until the program counter reaches addr, false if the processor stopped */
+		bool run_to(addr_t addr)
+		{
+			exit_cause ex;
+			P::breakpoint = addr;
+			while ((ex = step(inst_step)) == exit_cause_continue);
+			P::breakpoint = 0;
+			return ex == exit_cause_cli && P::pc == typename P::ux(addr);
+		}
+
+		void save_snapshot()
+		{
+			if (checkpoint_interval) {
+				/* full checkpoint followed by deltas against the previous checkpoint */
+				std::string filename = snapshot_filename + "." + std::to_string(checkpoint_seq++);
+				if (P::save_checkpoint(filename, checkpoint_base)) {
+					checkpoint_base = filename;
+				}
+				snapshot_instret += checkpoint_interval;
+				return;
+			}
+			if (P::save_snapshot(snapshot_filename)) {
+				debug("snapshot: saved %s at instret %llu",
+					snapshot_filename.c_str(), (u64)P::instret);
+			}
+			snapshot_instret = 0;
+		}
+
 		exit_cause step(size_t count)
+		{
+			/* instret triggers end a step so the window only changes between steps */
+			if (P::window.next_instret != u64(-1)) {
+				if (P::instret >= P::window.next_instret) {
+					P::window.instret_hit(P::pc, P::instret, P::log);
+				}
+				if (P::window.next_instret != u64(-1)) {
+					count = std::min(u64(count), P::window.next_instret - P::instret);
+				}
+			}
+			/* retire events are only counted while a counter selects one */
+			return P::hpm_retire_armed() ? step_counting<true>(count) : step_counting<false>(count);
+		}
+
+		template <bool counting>
+		exit_cause step_counting(size_t count)
+		{
+			if (P::window.pc_armed) {
+				return P::log ? step_loop<true,true,counting>(count) : step_loop<false,true,counting>(count);
+			} else {
+				return P::log ? step_loop<true,false,counting>(count) : step_loop<false,false,counting>(count);
+			}
+		}
+
+		/* retire a log window or region of interest marker, true if the log mask changed */
+		bool step_marker(typename P::decode_type &dec, inst_t inst, typename P::ux pc_offset)
+		{
+			if (P::log) {
+				P::inst_decode(dec, inst);
+				P::print_log(dec, inst);
+			}
+			u32 num = log_marker_num(inst);
+			bool changed = P::window.marker(num, P::pc, P::instret, P::log);
+			if (roi_marker(num)) changed |= P::roi_command(*this, num - roi_marker_base);
+			P::pc += pc_offset;
+			P::instret++;
+			return changed;
+		}
+
+		template <bool logging, bool triggers, bool counting>
+		exit_cause step_loop(size_t count)
 		{
 			typename P::decode_type dec;
-			typename P::ux inststop = P::instret + count;
 			typename P::ux pc_offset, new_offset;
 			inst_t inst = 0, inst_cache_key;
 
 			/* interrupt service routine */
 			P::time = cpu_cycle_clock();
-			P::isr();
+			{
+				phase_scope timer(P::phases, phase_isr);
+				P::isr();
+			}
+
+			/* stop at the next device event */
+			typename P::ux inststop = P::instret + P::step_budget(count);
 
 			/* trap return path */
 			int cause;
 			if (unlikely((cause = setjmp(P::env)) > 0)) {
+				if (phase_profile) P::phases.unwind();
 				cause -= P::internal_cause_offset;
 				switch(cause) {
 					case P::internal_cause_cli:
@@ -146,6 +267,8 @@ namespace riscv {
 						return exit_cause_poweroff;
 					case P::internal_cause_poweroff:
 						return exit_cause_poweroff;
+					case P::internal_cause_yield:
+						return exit_cause_continue;
 				}
 				P::trap(dec, cause);
 				if (!P::running) return exit_cause_poweroff;
@@ -156,21 +279,34 @@ namespace riscv {
 				if (P::pc == P::breakpoint && P::breakpoint != 0) {
 					return exit_cause_cli;
 				}
-				inst = P::mmu.inst_fetch(*this, P::pc, pc_offset);
+				if (triggers && P::window.pc_check(P::pc) &&
+					P::window.pc_hit(P::pc, P::instret, P::ireg[rv_ireg_ra].r.xu.val, P::log)) {
+					return exit_cause_continue;
+				}
+				{
+					phase_scope timer(P::phases, phase_fetch);
+					inst = P::mmu.inst_fetch(*this, P::pc, pc_offset);
+				}
 				inst_cache_key = inst % inst_cache_size;
 				if (inst_cache[inst_cache_key].inst == inst) {
 					dec = inst_cache[inst_cache_key].dec;
 				} else {
-					P::inst_decode(dec, inst);
+					phase_scope timer(P::phases, phase_decode);
+					inst_decode(dec, inst);
 					inst_cache[inst_cache_key].inst = inst;
 					inst_cache[inst_cache_key].dec = dec;
 				}
+				if (logging && (P::log & proc_log_trace)) P::trace_mem(dec);
+				phase_scope timer(P::phases, phase_exec);
 				if ((new_offset = P::inst_exec(dec, pc_offset)) != typename P::ux(-1)  ||
 					(new_offset = P::inst_priv(dec, pc_offset)) != typename P::ux(-1))
 				{
-					if (P::log) P::print_log(dec, inst);
+					if (logging) P::print_log(dec, inst);
+					if (counting) P::hpm_retire(dec, pc_offset, new_offset);
 					P::pc += new_offset;
 					P::instret++;
+				} else if (log_marker_inst(inst)) {
+					if (step_marker(dec, inst, pc_offset)) return exit_cause_continue;
 				} else {
 					P::raise(rv_cause_illegal_instruction, P::pc);
 				}
@@ -0,0 +1,330 @@
+//
+//  processor-snapshot.h
+//
+
+#ifndef rv_processor_snapshot_h
+#define rv_processor_snapshot_h
+
+namespace riscv {
+
+	/*
+	 * Snapshot file layout
+	 *
+	 *   snapshot_header
+	 *   processor and device state (state_size bytes)
+	 *   snapshot_segment[num_segments]
+	 *   snapshot_extent[num_extents]
+	 *   page aligned memory extents
+	 *
+	 * Only host backed memory segments (RAM, ELF) are saved. Full snapshots
+	 * skip zero pages and store runs of non-zero pages as extents which are
+	 * mapped MAP_PRIVATE on restore so pages are loaded lazily on demand.
+	 *
+	 * Delta snapshots name a base snapshot and contain only the pages that
+	 * were stored to since the base was written. Restoring a delta maps the
+	 * chain of base snapshots first and the newer pages on top.
+	 */
+
+	enum {
+		snapshot_version = 5
+	};
+
+	/* optional devices whose state follows the fixed devices */
+	enum : u32 {
+		snapshot_device_disk = 1
+	};
+
+	static const char snapshot_magic[8] = { 'R', 'V', '8', 'S', 'N', 'A', 'P', '\0' };
+
+	struct snapshot_header
+	{
+		char magic[8];
+		u32  version;
+		u32  xlen;
+		u32  devices;    /* optional devices in the state (snapshot_device_*) */
+		u64  state_size;
+		u64  num_segments;
+		u64  num_extents;
+		char base[256];  /* base snapshot (delta snapshots only) */
+	};
+
+	struct snapshot_segment
+	{
+		u64  mpa;
+		u64  size;
+		u32  flags;
+		char name[12];
+	};
+
+	struct snapshot_extent
+	{
+		u64  mpa;
+		u64  size;
+		u64  offset;
+	};
+
+	struct snapshot_stats
+	{
+		u64  pages;      /* pages written */
+		u64  time_ns;    /* time to scan and write */
+	};
+
+	/* state visitor that appends to a buffer */
+	struct snapshot_writer
+	{
+		std::vector<u8> buf;
+
+		template <typename T>
+		void operator()(T &v)
+		{
+			const u8 *p = reinterpret_cast<const u8*>(&v);
+			buf.insert(buf.end(), p, p + sizeof(T));
+		}
+	};
+
+	/* state visitor that reads from a buffer */
+	struct snapshot_reader
+	{
+		const u8 *p;
+		const u8 *end;
+
+		snapshot_reader(const std::vector<u8> &buf) : p(buf.data()), end(buf.data() + buf.size()) {}
+
+		template <typename T>
+		void operator()(T &v)
+		{
+			if (p + sizeof(T) > end) {
+				panic("snapshot: error: truncated state");
+			}
+			memcpy(reinterpret_cast<u8*>(&v), p, sizeof(T));
+			p += sizeof(T);
+		}
+	};
+
+	/* snapshot file index */
+	struct snapshot_index
+	{
+		int fd;
+		snapshot_header hdr;
+		std::vector<u8> state;
+		std::vector<snapshot_segment> segments;
+		std::vector<snapshot_extent> extents;
+
+		snapshot_index(std::string filename) : fd(-1), hdr()
+		{
+			if ((fd = open(filename.c_str(), O_RDONLY)) < 0) {
+				panic("snapshot: error: open: %s: %s", filename.c_str(), strerror(errno));
+			}
+			off_t offset = 0;
+			read_at(&hdr, sizeof(hdr), offset, filename);
+			if (memcmp(hdr.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+				hdr.version != snapshot_version)
+			{
+				panic("snapshot: error: invalid snapshot: %s", filename.c_str());
+			}
+			hdr.base[sizeof(hdr.base) - 1] = '\0';
+			state.resize(hdr.state_size);
+			segments.resize(hdr.num_segments);
+			extents.resize(hdr.num_extents);
+			read_at(state.data(), state.size(), offset, filename);
+			read_at(segments.data(), segments.size() * sizeof(snapshot_segment), offset, filename);
+			read_at(extents.data(), extents.size() * sizeof(snapshot_extent), offset, filename);
+		}
+
+		~snapshot_index() { if (fd >= 0) close(fd); }
+
+		void read_at(void *buf, size_t len, off_t &offset, std::string &filename)
+		{
+			if (pread(fd, buf, len, offset) != ssize_t(len)) {
+				panic("snapshot: error: read: %s", filename.c_str());
+			}
+			offset += len;
+		}
+	};
+
+	static bool snapshot_page_zero(const u8 *page)
+	{
+		const u64 *p = reinterpret_cast<const u64*>(page);
+		for (size_t i = 0; i < page_size / sizeof(u64); i++) {
+			if (p[i]) return false;
+		}
+		return true;
+	}
+
+	static std::string snapshot_dirname(std::string filename)
+	{
+		size_t slash = filename.rfind('/');
+		return slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+	}
+
+	/* base paths are stored relative to the directory of the delta */
+	static std::string snapshot_base_path(std::string filename, std::string base)
+	{
+		return base.size() == 0 || base[0] == '/' ? base : snapshot_dirname(filename) + base;
+	}
+
+	/* return the xlen of the processor that saved the snapshot */
+	inline int snapshot_xlen(std::string filename)
+	{
+		snapshot_index index(filename);
+		return index.hdr.xlen;
+	}
+
+	/* write snapshot of host backed memory segments, delta against base if given */
+	template <typename UX>
+	bool snapshot_write(user_memory<UX> &mem, std::vector<u8> &state, u32 xlen, u32 devices,
+		std::string filename, std::string base, snapshot_stats *stats = nullptr)
+	{
+		u64 start_ns = host_cpu::get_instance().get_time_ns();
+		snapshot_header hdr = snapshot_header();
+		std::vector<snapshot_segment> segments;
+		std::vector<snapshot_extent> extents;
+		bool delta = base.size() > 0;
+
+		if (delta) {
+			if (snapshot_dirname(base) == snapshot_dirname(filename)) {
+				base = base.substr(snapshot_dirname(base).size());
+			} else if (base[0] != '/') {
+				char path[PATH_MAX];
+				if (!realpath(base.c_str(), path)) {
+					debug("snapshot: error: realpath: %s: %s", base.c_str(), strerror(errno));
+					return false;
+				}
+				base = path;
+			}
+			if (base.size() >= sizeof(hdr.base)) {
+				debug("snapshot: error: base path too long: %s", base.c_str());
+				return false;
+			}
+			strncpy(hdr.base, base.c_str(), sizeof(hdr.base) - 1);
+		}
+
+		/* find runs of dirty pages (delta) or non-zero pages (full) */
+		u64 data_size = 0;
+		for (auto &seg : mem.segments) {
+			if (seg->uva == 0) continue;
+			snapshot_segment ss = { seg->mpa, seg->size, seg->flags, { 0 } };
+			strncpy(ss.name, seg->name, sizeof(ss.name) - 1);
+			segments.push_back(ss);
+			size_t seg_extents = extents.size();
+			for (size_t off = 0; off < seg->size; off += page_size) {
+				if (delta && seg->dirty.size() > 0) {
+					if (!seg->is_dirty(off >> page_shift)) continue;
+				} else {
+					if (snapshot_page_zero((const u8*)(seg->uva + off))) continue;
+				}
+				if (extents.size() > seg_extents && extents.back().mpa + extents.back().size == seg->mpa + off) {
+					extents.back().size += page_size;
+				} else {
+					extents.push_back(snapshot_extent{ seg->mpa + off, page_size, data_size });
+				}
+				data_size += page_size;
+			}
+		}
+
+		memcpy(hdr.magic, snapshot_magic, sizeof(snapshot_magic));
+		hdr.version = snapshot_version;
+		hdr.xlen = xlen;
+		hdr.devices = devices;
+		hdr.state_size = state.size();
+		hdr.num_segments = segments.size();
+		hdr.num_extents = extents.size();
+
+		/* page data follows the page aligned index */
+		u64 data_offset = round_up(sizeof(hdr) + state.size() +
+			segments.size() * sizeof(snapshot_segment) +
+			extents.size() * sizeof(snapshot_extent), page_size);
+		for (auto &ext : extents) {
+			ext.offset += data_offset;
+		}
+
+		FILE *file;
+		if ((file = fopen(filename.c_str(), "w")) == nullptr) {
+			debug("snapshot: error: fopen: %s: %s", filename.c_str(), strerror(errno));
+			return false;
+		}
+		bool ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+			fwrite(state.data(), 1, state.size(), file) == state.size() &&
+			fwrite(segments.data(), sizeof(snapshot_segment), segments.size(), file) == segments.size() &&
+			fwrite(extents.data(), sizeof(snapshot_extent), extents.size(), file) == extents.size() &&
+			fseeko(file, data_offset, SEEK_SET) == 0;
+		for (auto &ext : extents) {
+			if (!ok) break;
+			memory_segment<UX> *segment = nullptr;
+			addr_t uva = mem.mpa_to_uva(segment, ext.mpa);
+			ok = fwrite((const void*)uva, 1, ext.size, file) == ext.size;
+		}
+		if (fclose(file) != 0) ok = false;
+		if (!ok) {
+			debug("snapshot: error: write: %s: %s", filename.c_str(), strerror(errno));
+			return false;
+		}
+		if (stats) {
+			stats->pages = data_size >> page_shift;
+			stats->time_ns = host_cpu::get_instance().get_time_ns() - start_ns;
+		}
+		return true;
+	}
+
+	/* recreate host backed memory segments and map saved pages, following delta chain */
+	template <typename UX>
+	snapshot_header snapshot_map_segments(user_memory<UX> &mem, std::string filename)
+	{
+		snapshot_index index(filename);
+		if (index.hdr.base[0]) {
+			snapshot_header base = snapshot_map_segments(mem, snapshot_base_path(filename, index.hdr.base));
+			if (base.xlen != index.hdr.xlen || base.num_segments != index.hdr.num_segments) {
+				panic("snapshot: error: base mismatch: %s", filename.c_str());
+			}
+		} else {
+			for (auto &ss : index.segments) {
+				mem.add_ram(ss.mpa, ss.size, ss.flags,
+					strcmp(ss.name, "RAM") == 0 ? "RAM" : "ELF");
+			}
+		}
+		for (auto &ext : index.extents) {
+			mem.map_fd(ext.mpa, index.fd, ext.offset, ext.size, filename.c_str());
+		}
+		return index.hdr;
+	}
+
+	/* save processor, device and memory state */
+	template <typename P>
+	bool snapshot_save(P &proc, std::string filename, std::string base = std::string(),
+		snapshot_stats *stats = nullptr)
+	{
+		snapshot_writer state;
+		proc.snapshot(state);
+		return snapshot_write(*proc.mmu.mem, state.buf, P::xlen, proc.snapshot_devices(),
+			filename, base, stats);
+	}
+
+	/* recreate memory from snapshot (before init) */
+	template <typename P>
+	void snapshot_map_memory(P &proc, std::string filename)
+	{
+		if (snapshot_xlen(filename) != P::xlen) {
+			panic("snapshot: error: xlen mismatch: %s", filename.c_str());
+		}
+		snapshot_map_segments(*proc.mmu.mem, filename);
+	}
+
+	/* restore processor and device state (after init) */
+	template <typename P>
+	void snapshot_load_state(P &proc, std::string filename)
+	{
+		snapshot_index index(filename);
+		if (index.hdr.devices != proc.snapshot_devices()) {
+			panic("snapshot: error: %s was saved %s --disk", filename.c_str(),
+				(index.hdr.devices & snapshot_device_disk) ? "with" : "without");
+		}
+		snapshot_reader state(index.state);
+		proc.snapshot(state);
+		if (state.p != state.end) {
+			panic("snapshot: error: state size mismatch: %s", filename.c_str());
+		}
+	}
+
+}
+
+#endif
@@ -0,0 +1,451 @@
+//
+//  processor-stats.h
+//
+
+#ifndef rv_processor_stats_h
+#define rv_processor_stats_h
+
+namespace riscv {
+
+	/*
+	 * Runtime statistics export
+	 *
+	 * Each guest thread or hart owns a block of counters that only it
+	 * writes. Processors keep plain counters in their hot paths and copy
+	 * them into the block with relaxed atomic stores at the end of each
+	 * step. An exporter thread wakes every interval, sums the blocks and
+	 * writes a snapshot as JSON or Prometheus text exposition to a file,
+	 * which is replaced atomically, or streams it to a Unix socket given
+	 * as unix:<path>. A final snapshot is written when the exporter closes.
+	 * Builds with the phase profiler also export host cycles per phase,
+	 * and proxy emulators export calls, latency and bytes per syscall.
+	 */
+
+	enum stats_counter
+	{
+		stats_instret,
+		stats_jit_traces,
+		stats_jit_code_bytes,
+		stats_jit_compile_ns,
+		stats_jit_exits,
+		stats_itlb_hits,
+		stats_itlb_misses,
+		stats_dtlb_hits,
+		stats_dtlb_misses,
+		stats_page_walks,
+		stats_syscalls,
+		stats_syscall_ns,
+		stats_io_read_bytes,
+		stats_io_write_bytes,
+		stats_exceptions,
+		stats_interrupts,
+		stats_counter_count
+	};
+
+	enum stats_format
+	{
+		stats_format_json,
+		stats_format_prometheus
+	};
+
+	enum stats_syscall_field
+	{
+		stats_syscall_calls,
+		stats_syscall_field_ns,
+		stats_syscall_bytes,
+		stats_syscall_field_count
+	};
+
+	enum {
+		stats_default_interval_ms = 1000,
+		stats_syscall_slots = 64
+	};
+
+	struct stats_counter_info
+	{
+		const char *name;
+		const char *help;
+	};
+
+	inline const stats_counter_info& stats_info(size_t i)
+	{
+		static const stats_counter_info info[stats_counter_count] = {
+			{ "instret", "Instructions retired" },
+			{ "jit_traces", "JIT traces compiled" },
+			{ "jit_code_bytes", "JIT code bytes emitted" },
+			{ "jit_compile_ns", "Host nanoseconds spent tracing and compiling" },
+			{ "jit_exits", "JIT trace exits to the interpreter" },
+			{ "itlb_hits", "L1 instruction TLB hits" },
+			{ "itlb_misses", "L1 instruction TLB misses" },
+			{ "dtlb_hits", "L1 data TLB hits" },
+			{ "dtlb_misses", "L1 data TLB misses" },
+			{ "page_walks", "Page table walks" },
+			{ "syscalls", "System calls" },
+			{ "syscall_ns", "Host nanoseconds spent in proxied system calls" },
+			{ "io_read_bytes", "Bytes read by proxied system calls" },
+			{ "io_write_bytes", "Bytes written by proxied system calls" },
+			{ "exceptions", "Synchronous exceptions" },
+			{ "interrupts", "Interrupts taken" },
+		};
+		return info[i];
+	}
+
+	/*
+	 * Counters of one guest thread or hart, written only by that thread.
+	 * Outside guest regions of interest the exported values hold, and
+	 * they continue from where they stopped at the start of a region.
+	 * The maximum syscall latency is a gauge that is not reset.
+	 */
+	struct stats_block
+	{
+		static const size_t phase_base = stats_counter_count;
+		static const size_t syscall_base = phase_base + phase_count;
+		static const size_t value_count = syscall_base + stats_syscall_slots * stats_syscall_field_count;
+
+		std::atomic<u64> val[value_count];
+		std::atomic<u64> syscall_max_ns[stats_syscall_slots];
+		u64 raw[value_count] = {};   /* last published counter values */
+		u64 base[value_count] = {};  /* counter values excluded from the export */
+		bool collecting = true;
+
+		stats_block()
+		{
+			for (auto &v : val) v.store(0, std::memory_order_relaxed);
+			for (auto &v : syscall_max_ns) v.store(0, std::memory_order_relaxed);
+		}
+
+		u64 load(size_t i) const { return val[i].load(std::memory_order_relaxed); }
+
+		u64 get(stats_counter c) const { return load(c); }
+
+		void store(size_t i, u64 v)
+		{
+			raw[i] = v;
+			if (collecting) val[i].store(v - base[i], std::memory_order_relaxed);
+		}
+
+		void set(stats_counter c, u64 v) { store(c, v); }
+
+		void set_phases(const u64 *cycles)
+		{
+			for (size_t i = 0; i < phase_count; i++) store(phase_base + i, cycles[i]);
+		}
+
+		void set_syscall(size_t slot, u64 calls, u64 ns, u64 max_ns, u64 bytes)
+		{
+			size_t i = syscall_base + slot * stats_syscall_field_count;
+			store(i + stats_syscall_calls, calls);
+			store(i + stats_syscall_field_ns, ns);
+			store(i + stats_syscall_bytes, bytes);
+			if (collecting) syscall_max_ns[slot].store(max_ns, std::memory_order_relaxed);
+		}
+
+		u64 get_syscall(size_t slot, stats_syscall_field f) const
+		{
+			return load(syscall_base + slot * stats_syscall_field_count + f);
+		}
+
+		void start()
+		{
+			if (collecting) return;
+			for (size_t i = 0; i < value_count; i++) {
+				base[i] = raw[i] - load(i);
+			}
+			collecting = true;
+		}
+
+		void stop() { collecting = false; }
+
+		void reset()
+		{
+			for (size_t i = 0; i < value_count; i++) {
+				base[i] = raw[i];
+				val[i].store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	/* counters summed over all blocks */
+	struct stats_totals
+	{
+		u64 val[stats_counter_count] = {};
+		u64 phase[phase_count] = {};
+		u64 syscall[stats_syscall_slots][stats_syscall_field_count] = {};
+		u64 syscall_max_ns[stats_syscall_slots] = {};
+		size_t threads = 0;
+
+		void add(const stats_block &block)
+		{
+			for (size_t i = 0; i < stats_counter_count; i++) {
+				val[i] += block.get(stats_counter(i));
+			}
+			for (size_t i = 0; i < phase_count; i++) {
+				phase[i] += block.load(stats_block::phase_base + i);
+			}
+			for (size_t i = 0; i < stats_syscall_slots; i++) {
+				for (size_t f = 0; f < stats_syscall_field_count; f++) {
+					syscall[i][f] += block.get_syscall(i, stats_syscall_field(f));
+				}
+				syscall_max_ns[i] = std::max(syscall_max_ns[i],
+					block.syscall_max_ns[i].load(std::memory_order_relaxed));
+			}
+			threads++;
+		}
+	};
+
+	struct stats_export
+	{
+		std::string program;
+		std::string target;
+		stats_format format;
+		u64 interval_ms;
+
+		std::mutex lock;
+		std::condition_variable cond;
+		std::vector<std::shared_ptr<stats_block>> blocks;
+		std::vector<std::string> syscall_names;  /* per slot, set before start */
+		std::thread thread;
+		bool stop = false;
+		bool closed = false;
+
+		u64 start_ns;
+		u64 last_ns;
+		u64 last_instret = 0;
+		u64 seq = 0;
+		std::mutex write_lock;
+		int sock = -1;
+		bool sock_error = false;
+
+		stats_export(std::string program, std::string target, stats_format format, u64 interval_ms) :
+			program(program), target(target), format(format), interval_ms(interval_ms),
+			start_ns(host_cpu::get_instance().get_time_ns()), last_ns(start_ns) {}
+
+		~stats_export() { close(); }
+
+		static bool parse_format(std::string s, stats_format &format)
+		{
+			if (s == "json") format = stats_format_json;
+			else if (s == "prometheus") format = stats_format_prometheus;
+			else return false;
+			return true;
+		}
+
+		/* counters for a new guest thread or hart */
+		std::shared_ptr<stats_block> attach()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			blocks.push_back(std::make_shared<stats_block>());
+			return blocks.back();
+		}
+
+		void start()
+		{
+			thread = std::thread(&stats_export::mainloop, this);
+		}
+
+		void mainloop()
+		{
+			/* asynchronous signals are delivered to the emulator threads */
+			sigset_t set;
+			sigemptyset(&set);
+			sigaddset(&set, SIGTERM);
+			sigaddset(&set, SIGQUIT);
+			sigaddset(&set, SIGINT);
+			sigaddset(&set, SIGHUP);
+			sigaddset(&set, SIGUSR1);
+			pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+			std::unique_lock<std::mutex> guard(lock);
+			while (!stop) {
+				cond.wait_for(guard, std::chrono::milliseconds(interval_ms), [&] { return stop; });
+				if (stop) break;
+				guard.unlock();
+				write_snapshot();
+				guard.lock();
+			}
+		}
+
+		/* stop the exporter thread and write the final snapshot */
+		void close()
+		{
+			if (closed) return;
+			closed = true;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stop = true;
+			}
+			cond.notify_all();
+			if (thread.joinable()) thread.join();
+			write_snapshot();
+			if (sock >= 0) ::close(sock);
+			sock = -1;
+		}
+
+		/* called by the exporter thread and by guests dumping a snapshot */
+		void write_snapshot()
+		{
+			std::lock_guard<std::mutex> write_guard(write_lock);
+			stats_totals t;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				for (auto &block : blocks) t.add(*block);
+			}
+			u64 *totals = t.val;
+			u64 now = host_cpu::get_instance().get_time_ns();
+			double elapsed = (now - start_ns) / 1e9, interval = (now - last_ns) / 1e9;
+			double mips = interval > 0 && totals[stats_instret] >= last_instret ?
+				(totals[stats_instret] - last_instret) / interval / 1e6 : 0;
+			double mips_avg = elapsed > 0 ? totals[stats_instret] / elapsed / 1e6 : 0;
+			last_ns = now;
+			last_instret = totals[stats_instret];
+			seq++;
+
+			std::string out = format == stats_format_json ?
+				format_json(t, elapsed, mips, mips_avg) :
+				format_prometheus(t, elapsed, mips, mips_avg);
+			if (target.compare(0, 5, "unix:") == 0) {
+				write_socket(target.substr(5), out);
+			} else {
+				write_file(out);
+			}
+		}
+
+		static double ratio(u64 n, u64 d) { return d ? double(n) / d : 0; }
+
+		/* syscall slots that have been called */
+		template <typename F> void each_syscall(stats_totals &t, F fn)
+		{
+			for (size_t i = 0; i < syscall_names.size() && i < stats_syscall_slots; i++) {
+				if (t.syscall[i][stats_syscall_calls]) fn(i, syscall_names[i].c_str());
+			}
+		}
+
+		std::string format_json(stats_totals &t, double elapsed, double mips, double mips_avg)
+		{
+			u64 *totals = t.val, *phases = t.phase;
+			std::string out = format_string("{\"program\":\"%s\",\"seq\":%llu,\"time\":%.3f,\"threads\":%zu,"
+				"\"mips\":%.3f,\"mips_average\":%.3f", program.c_str(), seq, elapsed, t.threads,
+				mips, mips_avg);
+			for (size_t i = 0; i < stats_counter_count; i++) {
+				out += format_string(",\"%s\":%llu", stats_info(i).name, totals[i]);
+			}
+			if (phase_profile) {
+				out += ",\"phase_cycles\":{";
+				for (size_t i = 0; i < phase_count; i++) {
+					out += format_string("%s\"%s\":%llu", i ? "," : "", phase_counters::name(i), phases[i]);
+				}
+				out += "}";
+			}
+			if (syscall_names.size() > 0) {
+				bool first = true;
+				out += ",\"syscall\":{";
+				each_syscall(t, [&](size_t i, const char *name) {
+					out += format_string("%s\"%s\":{\"calls\":%llu,\"ns\":%llu,\"max_ns\":%llu,\"bytes\":%llu}",
+						first ? "" : ",", name, t.syscall[i][stats_syscall_calls],
+						t.syscall[i][stats_syscall_field_ns], t.syscall_max_ns[i],
+						t.syscall[i][stats_syscall_bytes]);
+					first = false;
+				});
+				out += "}";
+			}
+			out += format_string(",\"itlb_hit_rate\":%.6f,\"dtlb_hit_rate\":%.6f,\"syscall_ns_average\":%.1f}\n",
+				ratio(totals[stats_itlb_hits], totals[stats_itlb_hits] + totals[stats_itlb_misses]),
+				ratio(totals[stats_dtlb_hits], totals[stats_dtlb_hits] + totals[stats_dtlb_misses]),
+				ratio(totals[stats_syscall_ns], totals[stats_syscalls]));
+			return out;
+		}
+
+		std::string format_prometheus(stats_totals &t, double elapsed, double mips, double mips_avg)
+		{
+			u64 *totals = t.val, *phases = t.phase;
+			std::string out, label = format_string("{program=\"%s\"}", program.c_str());
+			auto gauge = [&](const char *name, const char *help, double val) {
+				out += format_string("# HELP rv8_%s %s\n# TYPE rv8_%s gauge\nrv8_%s%s %.6g\n",
+					name, help, name, name, label.c_str(), val);
+			};
+			for (size_t i = 0; i < stats_counter_count; i++) {
+				const char *name = stats_info(i).name;
+				out += format_string("# HELP rv8_%s_total %s\n# TYPE rv8_%s_total counter\nrv8_%s_total%s %llu\n",
+					name, stats_info(i).help, name, name, label.c_str(), totals[i]);
+			}
+			if (phase_profile) {
+				out += "# HELP rv8_phase_cycles_total Host cycles spent in each emulator phase\n"
+					"# TYPE rv8_phase_cycles_total counter\n";
+				for (size_t i = 0; i < phase_count; i++) {
+					out += format_string("rv8_phase_cycles_total{program=\"%s\",phase=\"%s\"} %llu\n",
+						program.c_str(), phase_counters::name(i), phases[i]);
+				}
+			}
+			if (syscall_names.size() > 0) {
+				static const char *series[][3] = {
+					{ "proxy_syscall_calls_total", "counter", "Proxied system calls by syscall" },
+					{ "proxy_syscall_ns_total", "counter", "Host nanoseconds spent in proxied system calls by syscall" },
+					{ "proxy_syscall_bytes_total", "counter", "Bytes transferred by proxied system calls by syscall" },
+					{ "proxy_syscall_max_ns", "gauge", "Maximum host nanoseconds of one proxied system call by syscall" },
+				};
+				for (size_t f = 0; f < 4; f++) {
+					out += format_string("# HELP rv8_%s %s\n# TYPE rv8_%s %s\n",
+						series[f][0], series[f][2], series[f][0], series[f][1]);
+					each_syscall(t, [&](size_t i, const char *name) {
+						out += format_string("rv8_%s{program=\"%s\",syscall=\"%s\"} %llu\n",
+							series[f][0], program.c_str(), name,
+							f < stats_syscall_field_count ? t.syscall[i][f] : t.syscall_max_ns[i]);
+					});
+				}
+			}
+			gauge("uptime_seconds", "Seconds since the emulator started", elapsed);
+			gauge("threads", "Guest threads or harts", t.threads);
+			gauge("mips", "Emulated million instructions per second over the last interval", mips);
+			gauge("mips_average", "Emulated million instructions per second since start", mips_avg);
+			gauge("itlb_hit_rate", "L1 instruction TLB hit rate",
+				ratio(totals[stats_itlb_hits], totals[stats_itlb_hits] + totals[stats_itlb_misses]));
+			gauge("dtlb_hit_rate", "L1 data TLB hit rate",
+				ratio(totals[stats_dtlb_hits], totals[stats_dtlb_hits] + totals[stats_dtlb_misses]));
+			return out;
+		}
+
+		/* replace the file so readers never see a partial snapshot */
+		void write_file(std::string &out)
+		{
+			std::string tmpname = target + ".tmp";
+			FILE *file = fopen(tmpname.c_str(), "w");
+			if (!file) {
+				debug("stats: can't open %s: %s", tmpname.c_str(), strerror(errno));
+				return;
+			}
+			fwrite(out.data(), 1, out.size(), file);
+			fclose(file);
+			if (rename(tmpname.c_str(), target.c_str()) < 0) {
+				debug("stats: can't rename %s: %s", tmpname.c_str(), strerror(errno));
+			}
+		}
+
+		/* stream to a listening socket, reconnecting after errors */
+		void write_socket(std::string path, std::string &out)
+		{
+			if (sock < 0) {
+				struct sockaddr_un addr;
+				memset(&addr, 0, sizeof(addr));
+				addr.sun_family = AF_UNIX;
+				strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+				sock = socket(AF_UNIX, SOCK_STREAM, 0);
+				if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+					if (!sock_error) debug("stats: can't connect to %s: %s", path.c_str(), strerror(errno));
+					sock_error = true;
+					if (sock >= 0) ::close(sock);
+					sock = -1;
+					return;
+				}
+				sock_error = false;
+			}
+			if (format == stats_format_prometheus) out += "\n";
+			if (send(sock, out.data(), out.size(), MSG_NOSIGNAL) != ssize_t(out.size())) {
+				::close(sock);
+				sock = -1;
+			}
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+//
+//  processor-syscall.h
+//
+
+#ifndef rv_processor_syscall_h
+#define rv_processor_syscall_h
+
+namespace riscv {
+
+	/*
+	 * Proxy syscall profiler
+	 *
+	 * Counts the calls, total and maximum host latency of each proxied
+	 * syscall, and the bytes returned by read, write, readv, writev, pread
+	 * and pwrite. Transfer sizes are counted in power of two buckets, and
+	 * the per thread report is printed on exit with --syscall-profile,
+	 * sorted by host time. Calls are counted before dispatch so exit and
+	 * execve, which don't return, are still counted.
+	 */
+
+	enum syscall_io_dir
+	{
+		syscall_io_none = -1,
+		syscall_io_read,
+		syscall_io_write
+	};
+
+	enum {
+		syscall_io_buckets = 65  /* 0, 1, 2-3, 4-7 ... 2^63- */
+	};
+
+	struct syscall_stat
+	{
+		u64 calls = 0;
+		u64 ns = 0;
+		u64 max_ns = 0;
+		u64 bytes = 0;
+	};
+
+	struct syscall_profile
+	{
+		syscall_stat stat[abi_syscall_count];
+		u64 io_size[2][syscall_io_buckets] = {};
+		u64 io_bytes[2] = {};
+		u64 start_ns = host_cpu::get_instance().get_time_ns();
+
+		static syscall_io_dir io_dir(u64 num)
+		{
+			switch (num) {
+				case abi_syscall_read:
+				case abi_syscall_readv:
+				case abi_syscall_pread:  return syscall_io_read;
+				case abi_syscall_write:
+				case abi_syscall_writev:
+				case abi_syscall_pwrite: return syscall_io_write;
+				default:                 return syscall_io_none;
+			}
+		}
+
+		static size_t bucket(u64 bytes) { return bytes ? 64 - __builtin_clzll(bytes) : 0; }
+
+		static u64 bucket_min(size_t b) { return b ? 1ULL << (b - 1) : 0; }
+
+		void enter(int slot)
+		{
+			if (slot >= 0) stat[slot].calls++;
+		}
+
+		/* ret is the signed syscall result, negative on error */
+		void leave(int slot, u64 ns, s64 ret)
+		{
+			if (slot < 0) return;
+			syscall_stat &s = stat[slot];
+			s.ns += ns;
+			if (ns > s.max_ns) s.max_ns = ns;
+			syscall_io_dir dir = io_dir(abi_syscall_table()[slot].num);
+			if (dir == syscall_io_none || ret < 0) return;
+			s.bytes += ret;
+			io_bytes[dir] += ret;
+			io_size[dir][bucket(ret)]++;
+		}
+
+		void print(std::string title, bool histogram)
+		{
+			u64 calls = 0, ns = 0;
+			std::vector<size_t> slots;
+			for (size_t i = 0; i < abi_syscall_count; i++) {
+				if (stat[i].calls == 0) continue;
+				calls += stat[i].calls;
+				ns += stat[i].ns;
+				slots.push_back(i);
+			}
+			std::sort(slots.begin(), slots.end(), [&](size_t a, size_t b) {
+				return stat[a].ns > stat[b].ns;
+			});
+			u64 elapsed = host_cpu::get_instance().get_time_ns() - start_ns;
+			printf("\n");
+			printf("%s syscall profile: %llu calls %.3f ms (%.2f%% of %.3f s) read %llu bytes written %llu bytes\n",
+				title.c_str(), calls, ns / 1e6, elapsed ? ns * 100.0 / elapsed : 0.0, elapsed / 1e9,
+				io_bytes[syscall_io_read], io_bytes[syscall_io_write]);
+			printf("%-16s %12s %12s %10s %10s %7s %16s\n",
+				"syscall", "calls", "total us", "mean us", "max us", "percent", "bytes");
+			for (size_t i : slots) {
+				syscall_stat &s = stat[i];
+				printf("%-16s %12llu %12.1f %10.2f %10.1f %6.2f%% %16llu\n",
+					abi_syscall_table()[i].name, s.calls, s.ns / 1e3, s.ns / 1e3 / s.calls,
+					s.max_ns / 1e3, ns ? s.ns * 100.0 / ns : 0.0, s.bytes);
+			}
+			if (!histogram) return;
+			printf("\n");
+			printf("%s syscall io sizes\n", title.c_str());
+			printf("%-24s %12s %12s\n", "bytes", "reads", "writes");
+			for (size_t b = 0; b < syscall_io_buckets; b++) {
+				if (!io_size[0][b] && !io_size[1][b]) continue;
+				std::string range = b < 2 ? format_string("%llu", bucket_min(b)) :
+					format_string("%llu-%llu", bucket_min(b), bucket_min(b) * 2 - 1);
+				printf("%-24s %12llu %12llu\n", range.c_str(), io_size[0][b], io_size[1][b]);
+			}
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,579 @@
+//
+//  processor-trace.h
+//
+
+#ifndef rv_processor_trace_h
+#define rv_processor_trace_h
+
+namespace riscv {
+
+	/*
+	 * Binary trace file layout
+	 *
+	 *   trace_header
+	 *   trace_chunk_header, chunk data (comp_size bytes)
+	 *   ...
+	 *
+	 * Each retired instruction is a record starting with a flags byte
+	 * followed by the fields selected by the flags, in this order:
+	 *
+	 *   trace_gap    varint count of untraced instructions since the
+	 *                previous record
+	 *   trace_pc     zigzag varint delta of the pc from the fall through
+	 *                address of the previous record
+	 *   trace_inst   instruction word (2 or 4 bytes), otherwise the word
+	 *                is the one last seen in the same pc cache slot
+	 *   trace_ireg   integer register number and zigzag varint delta from
+	 *                the previous value written to the register
+	 *   trace_freg   floating point register number and varint bits
+	 *   trace_addr   zigzag varint delta of the load or store effective
+	 *                address from the previous effective address
+	 *
+	 * Records are encoded on the emulator thread into one of two chunk
+	 * buffers. Full chunks are handed to a writer thread that compresses
+	 * them and appends them to the file while the emulator fills the other
+	 * buffer. Encoder state is reset at the start of each chunk so chunks
+	 * can be skipped or decoded independently.
+	 *
+	 * Chunks are compressed with a small LZ77 coder: a sequence is a token
+	 * with literal and match length nibbles, literals, a 16-bit match offset
+	 * and match length extension bytes. The last sequence has no match.
+	 * Chunks that do not compress are stored with comp_size == raw_size.
+	 */
+
+	enum {
+		trace_version = 1,
+		trace_chunk_size = 1 << 20,
+		trace_record_max = 64,
+		trace_inst_cache_size = 1024
+	};
+
+	enum {
+		trace_gap =  1<<0,
+		trace_pc =   1<<1,
+		trace_inst = 1<<2,
+		trace_ireg = 1<<3,
+		trace_freg = 1<<4,
+		trace_addr = 1<<5
+	};
+
+	static const char trace_magic[8] = { 'R', 'V', '8', 'T', 'R', 'A', 'C', 'E' };
+
+	struct trace_header
+	{
+		char magic[8];
+		u32  version;
+		u32  xlen;
+		u64  hart_id;
+	};
+
+	struct trace_chunk_header
+	{
+		u32  raw_size;
+		u32  comp_size;
+		u64  count;        /* records in the chunk */
+		u64  instret;      /* instret of the first record */
+		u64  instret_end;  /* instret after the last record */
+		u64  pc;           /* pc of the first record */
+	};
+
+	struct trace_record
+	{
+		u64    instret;
+		u64    pc;
+		inst_t inst;
+		u8     flags;
+		u8     rd;
+		u64    val;
+		u64    addr;
+	};
+
+	/* opcode properties used to find writebacks and effective addresses */
+	enum {
+		trace_op_mem =    1<<0,    /* load, store or atomic with base in rs1 */
+		trace_op_offset = 1<<1,    /* effective address adds the immediate */
+		trace_op_ireg =   1<<2,    /* writes an integer register */
+		trace_op_freg =   1<<3     /* writes a floating point register */
+	};
+
+	inline const u8* trace_op_info()
+	{
+		static u8 info[1024];
+		static std::once_flag once;
+		std::call_once(once, [] {
+			for (size_t op = 0; op <= rv_op_fsflagsi; op++) {
+				const char *fmt = rv_inst_format[op];
+				if (fmt == rv_fmt_rd_offset_rs1 || fmt == rv_fmt_frd_offset_rs1 ||
+					fmt == rv_fmt_rs2_offset_rs1 || fmt == rv_fmt_frs2_offset_rs1)
+				{
+					info[op] |= trace_op_mem | trace_op_offset;
+				} else if (fmt == rv_fmt_aqrl_rd_rs2_rs1 || fmt == rv_fmt_aqrl_rd_rs1) {
+					info[op] |= trace_op_mem;
+				}
+				const rv_operand_data *operand_data = rv_inst_operand_data[op];
+				while (operand_data && operand_data->type != rv_type_none) {
+					if (operand_data->operand_name == rv_operand_name_rd) info[op] |= trace_op_ireg;
+					if (operand_data->operand_name == rv_operand_name_frd) info[op] |= trace_op_freg;
+					operand_data++;
+				}
+			}
+		});
+		return info;
+	}
+
+	/* LZ77 block coder */
+
+	inline void trace_compress(const u8 *src, size_t len, std::vector<u8> &out)
+	{
+		static const int hash_bits = 14;
+		std::vector<u32> table(1 << hash_bits, u32(-1));
+		out.resize(len + len / 255 + 16);
+		u8 *op = out.data();
+		size_t anchor = 0, i = 0;
+
+		auto put_len = [&](size_t n) {
+			while (n >= 255) { *op++ = 255; n -= 255; }
+			*op++ = u8(n);
+		};
+		auto put_seq = [&](size_t lit, size_t offset, size_t match) {
+			size_t m = match ? match - 4 : 0;
+			*op++ = u8(((lit < 15 ? lit : 15) << 4) | (m < 15 ? m : 15));
+			if (lit >= 15) put_len(lit - 15);
+			memcpy(op, src + anchor, lit);
+			op += lit;
+			if (match) {
+				*op++ = u8(offset);
+				*op++ = u8(offset >> 8);
+				if (m >= 15) put_len(m - 15);
+			}
+		};
+
+		/* the last bytes are always literals */
+		while (i + 12 <= len) {
+			u32 v, w;
+			memcpy(&v, src + i, 4);
+			u32 h = (v * 2654435761U) >> (32 - hash_bits);
+			u32 cand = table[h];
+			table[h] = u32(i);
+			if (cand != u32(-1) && i - cand <= 0xffff &&
+				(memcpy(&w, src + cand, 4), w == v))
+			{
+				size_t m = 4;
+				while (i + m < len && src[cand + m] == src[i + m]) m++;
+				put_seq(i - anchor, i - cand, m);
+				i += m;
+				anchor = i;
+			} else {
+				i++;
+			}
+		}
+		put_seq(len - anchor, 0, 0);
+		out.resize(op - out.data());
+	}
+
+	inline bool trace_decompress(const u8 *src, size_t len, u8 *dst, size_t dst_len)
+	{
+		const u8 *ip = src, *end = src + len;
+		u8 *op = dst, *oend = dst + dst_len;
+
+		auto get_len = [&](size_t &n) {
+			u8 b;
+			do {
+				if (ip == end) return false;
+				n += (b = *ip++);
+			} while (b == 255);
+			return true;
+		};
+
+		while (ip < end) {
+			u8 token = *ip++;
+			size_t lit = token >> 4, m = token & 15;
+			if (lit == 15 && !get_len(lit)) return false;
+			if (lit > size_t(end - ip) || lit > size_t(oend - op)) return false;
+			memcpy(op, ip, lit);
+			ip += lit;
+			op += lit;
+			if (ip == end) break;
+			if (end - ip < 2) return false;
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			if (m == 15 && !get_len(m)) return false;
+			m += 4;
+			if (offset == 0 || offset > size_t(op - dst) || m > size_t(oend - op)) return false;
+			const u8 *mp = op - offset;
+			while (m--) *op++ = *mp++;
+		}
+		return op == oend;
+	}
+
+	/* streaming trace writer with a compression and I/O thread */
+	struct trace_writer
+	{
+		struct chunk
+		{
+			trace_chunk_header hdr;
+			std::vector<u8> buf;
+		};
+
+		std::string filename;
+		int fd;
+		chunk chunks[2];
+		size_t cur;
+		u8 *p;
+		u8 *limit;
+
+		/* encoder state */
+		u64 next_pc;
+		u64 next_instret;
+		u64 last_addr;
+		u64 ireg[32];
+		inst_t inst_cache[trace_inst_cache_size];
+
+		/* writer thread */
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable cond;
+		chunk *pending;
+		bool stop;
+
+		/* statistics, updated by the writer thread */
+		u64 records;
+		u64 raw_bytes;
+		u64 file_bytes;
+
+		trace_writer(std::string filename, u32 xlen, u64 hart_id)
+			: filename(filename), fd(-1), cur(0), pending(nullptr), stop(false),
+			  records(0), raw_bytes(0), file_bytes(0)
+		{
+			if ((fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+				panic("trace: error: open: %s: %s", filename.c_str(), strerror(errno));
+			}
+			trace_header hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			memcpy(hdr.magic, trace_magic, sizeof(trace_magic));
+			hdr.version = trace_version;
+			hdr.xlen = xlen;
+			hdr.hart_id = hart_id;
+			write_all(&hdr, sizeof(hdr));
+			for (auto &c : chunks) {
+				c.buf.resize(trace_chunk_size + trace_record_max);
+			}
+			reset();
+			thread = std::thread(&trace_writer::mainloop, this);
+		}
+
+		~trace_writer() { close(); }
+
+		trace_writer(const trace_writer&) = delete;
+		trace_writer& operator=(const trace_writer&) = delete;
+
+		void write_all(const void *buf, size_t len)
+		{
+			const u8 *b = static_cast<const u8*>(buf);
+			while (len > 0) {
+				ssize_t ret = ::write(fd, b, len);
+				if (ret < 0) {
+					if (errno == EINTR) continue;
+					panic("trace: error: write: %s: %s", filename.c_str(), strerror(errno));
+				}
+				b += ret;
+				len -= ret;
+				file_bytes += ret;
+			}
+		}
+
+		void put_varint(u64 v)
+		{
+			while (v >= 0x80) {
+				*p++ = u8(v) | 0x80;
+				v >>= 7;
+			}
+			*p++ = u8(v);
+		}
+
+		void put_svarint(s64 v)
+		{
+			put_varint((u64(v) << 1) ^ u64(v >> 63));
+		}
+
+		/* start a chunk in the current buffer with fresh encoder state */
+		void reset()
+		{
+			chunk &c = chunks[cur];
+			memset(&c.hdr, 0, sizeof(c.hdr));
+			p = c.buf.data();
+			limit = p + trace_chunk_size;
+			last_addr = 0;
+			memset(ireg, 0, sizeof(ireg));
+			memset(inst_cache, 0, sizeof(inst_cache));
+		}
+
+		/* encode one retired instruction, flags selects the writeback and address */
+		void record(u64 pc, u64 instret, inst_t inst, u8 flags, u8 rd, u64 val, u64 addr)
+		{
+			chunk &c = chunks[cur];
+			if (c.hdr.count == 0) {
+				c.hdr.pc = next_pc = pc;
+				c.hdr.instret = next_instret = instret;
+			}
+			u8 *rec = p++;
+			if (instret != next_instret) {
+				flags |= trace_gap;
+				put_varint(instret - next_instret);
+			}
+			if (pc != next_pc) {
+				flags |= trace_pc;
+				put_svarint(s64(pc - next_pc));
+			}
+			size_t len = inst_length(inst);
+			inst_t &slot = inst_cache[(pc >> 1) & (trace_inst_cache_size - 1)];
+			if (slot != inst) {
+				slot = inst;
+				flags |= trace_inst;
+				for (size_t i = 0; i < len; i++) *p++ = u8(inst >> (i << 3));
+			}
+			if (flags & trace_ireg) {
+				*p++ = rd;
+				put_svarint(s64(val - ireg[rd]));
+				ireg[rd] = val;
+			} else if (flags & trace_freg) {
+				*p++ = rd;
+				put_varint(val);
+			}
+			if (flags & trace_addr) {
+				put_svarint(s64(addr - last_addr));
+				last_addr = addr;
+			}
+			*rec = flags;
+			next_pc = pc + len;
+			next_instret = instret + 1;
+			c.hdr.count++;
+			if (p >= limit) submit();
+		}
+
+		/* hand the current chunk to the writer thread and switch buffers */
+		void submit()
+		{
+			chunk &c = chunks[cur];
+			c.hdr.raw_size = u32(p - c.buf.data());
+			c.hdr.instret_end = next_instret;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cond.wait(lock, [&] { return pending == nullptr; });
+				pending = &c;
+			}
+			cond.notify_all();
+			cur ^= 1;
+			reset();
+		}
+
+		void mainloop()
+		{
+			std::vector<u8> out;
+			for (;;) {
+				chunk *c;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cond.wait(lock, [&] { return pending != nullptr || stop; });
+					if (!pending) return;
+					c = pending;
+				}
+				trace_compress(c->buf.data(), c->hdr.raw_size, out);
+				const u8 *data = out.data();
+				c->hdr.comp_size = u32(out.size());
+				if (out.size() >= c->hdr.raw_size) {
+					data = c->buf.data();
+					c->hdr.comp_size = c->hdr.raw_size;
+				}
+				write_all(&c->hdr, sizeof(c->hdr));
+				write_all(data, c->hdr.comp_size);
+				records += c->hdr.count;
+				raw_bytes += c->hdr.raw_size;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					pending = nullptr;
+				}
+				cond.notify_all();
+			}
+		}
+
+		/* write the last chunk, stop the writer thread and close the file */
+		void close()
+		{
+			if (fd < 0) return;
+			if (chunks[cur].hdr.count > 0) submit();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			cond.notify_all();
+			thread.join();
+			::close(fd);
+			fd = -1;
+		}
+	};
+
+	/* trace reader */
+	struct trace_reader
+	{
+		std::string filename;
+		int fd;
+		trace_header hdr;
+		trace_chunk_header chunk;
+		bool loaded;
+		u64 remaining;
+		std::vector<u8> comp;
+		std::vector<u8> raw;
+		const u8 *p;
+		const u8 *end;
+
+		/* decoder state */
+		u64 next_pc;
+		u64 next_instret;
+		u64 last_addr;
+		u64 ireg[32];
+		inst_t inst_cache[trace_inst_cache_size];
+
+		trace_reader(std::string filename)
+			: filename(filename), fd(-1), hdr(), chunk(), loaded(true), remaining(0),
+			  p(nullptr), end(nullptr)
+		{
+			if ((fd = open(filename.c_str(), O_RDONLY)) < 0) {
+				panic("trace: error: open: %s: %s", filename.c_str(), strerror(errno));
+			}
+			if (read_all(&hdr, sizeof(hdr)) != sizeof(hdr) ||
+				memcmp(hdr.magic, trace_magic, sizeof(trace_magic)) != 0 ||
+				hdr.version != trace_version)
+			{
+				panic("trace: error: invalid trace: %s", filename.c_str());
+			}
+		}
+
+		~trace_reader() { if (fd >= 0) ::close(fd); }
+
+		trace_reader(const trace_reader&) = delete;
+		trace_reader& operator=(const trace_reader&) = delete;
+
+		size_t read_all(void *buf, size_t len)
+		{
+			u8 *b = static_cast<u8*>(buf);
+			size_t total = 0;
+			while (total < len) {
+				ssize_t ret = ::read(fd, b + total, len - total);
+				if (ret < 0) {
+					if (errno == EINTR) continue;
+					panic("trace: error: read: %s: %s", filename.c_str(), strerror(errno));
+				}
+				if (ret == 0) break;
+				total += ret;
+			}
+			return total;
+		}
+
+		/* read the next chunk header, false at the end of the trace */
+		bool next_chunk()
+		{
+			if (!loaded && lseek(fd, chunk.comp_size, SEEK_CUR) < 0) {
+				panic("trace: error: seek: %s: %s", filename.c_str(), strerror(errno));
+			}
+			size_t len = read_all(&chunk, sizeof(chunk));
+			if (len == 0) return false;
+			if (len != sizeof(chunk) || chunk.comp_size > chunk.raw_size) {
+				panic("trace: error: truncated chunk: %s", filename.c_str());
+			}
+			loaded = false;
+			remaining = 0;
+			return true;
+		}
+
+		/* read and decompress the current chunk */
+		void load_chunk()
+		{
+			raw.resize(chunk.raw_size);
+			if (chunk.comp_size == chunk.raw_size) {
+				if (read_all(raw.data(), raw.size()) != raw.size()) {
+					panic("trace: error: truncated chunk: %s", filename.c_str());
+				}
+			} else {
+				comp.resize(chunk.comp_size);
+				if (read_all(comp.data(), comp.size()) != comp.size() ||
+					!trace_decompress(comp.data(), comp.size(), raw.data(), raw.size()))
+				{
+					panic("trace: error: corrupt chunk: %s", filename.c_str());
+				}
+			}
+			loaded = true;
+			remaining = chunk.count;
+			p = raw.data();
+			end = p + raw.size();
+			next_pc = chunk.pc;
+			next_instret = chunk.instret;
+			last_addr = 0;
+			memset(ireg, 0, sizeof(ireg));
+			memset(inst_cache, 0, sizeof(inst_cache));
+		}
+
+		u8 get_byte()
+		{
+			if (p == end) panic("trace: error: corrupt record: %s", filename.c_str());
+			return *p++;
+		}
+
+		u64 get_varint()
+		{
+			u64 v = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				u8 b = get_byte();
+				v |= u64(b & 0x7f) << shift;
+				if (!(b & 0x80)) break;
+			}
+			return v;
+		}
+
+		s64 get_svarint()
+		{
+			u64 v = get_varint();
+			return s64((v >> 1) ^ -(v & 1));
+		}
+
+		/* decode the next record in the loaded chunk, false at the end of the chunk */
+		bool next(trace_record &r)
+		{
+			if (remaining == 0) return false;
+			remaining--;
+			r.flags = get_byte();
+			r.instret = next_instret;
+			r.pc = next_pc;
+			r.rd = 0;
+			r.val = 0;
+			r.addr = 0;
+			if (r.flags & trace_gap) r.instret += get_varint();
+			if (r.flags & trace_pc) r.pc += get_svarint();
+			inst_t &slot = inst_cache[(r.pc >> 1) & (trace_inst_cache_size - 1)];
+			if (r.flags & trace_inst) {
+				inst_t inst = get_byte();
+				inst |= inst_t(get_byte()) << 8;
+				size_t len = inst_length(inst);
+				for (size_t i = 2; i < len; i++) inst |= inst_t(get_byte()) << (i << 3);
+				slot = inst;
+			}
+			r.inst = slot;
+			if (r.flags & trace_ireg) {
+				r.rd = get_byte() & 31;
+				r.val = ireg[r.rd] += get_svarint();
+			} else if (r.flags & trace_freg) {
+				r.rd = get_byte() & 31;
+				r.val = get_varint();
+			}
+			if (r.flags & trace_addr) {
+				r.addr = last_addr += get_svarint();
+			}
+			next_pc = r.pc + inst_length(r.inst);
+			next_instret = r.instret + 1;
+			return true;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,286 @@
+//
+//  processor-window.h
+//
+
+#ifndef rv_processor_window_h
+#define rv_processor_window_h
+
+namespace riscv {
+
+	/*
+	 * Logging window
+	 *
+	 * Triggers open and close a window in which the per instruction
+	 * logging flags (instruction and trap log, register dumps, histograms,
+	 * the binary trace and the profiler) are set in the processor log mask:
+	 *
+	 *   instret:<n>     instructions retired reaches n
+	 *   pc:<addr>       program counter reaches addr
+	 *   entry:<symbol>  entry to a function (symbol or address)
+	 *   exit:<symbol>   return from the outermost active call of a function
+	 *   marker:<n>      guest executes the marker instruction slti zero,zero,n
+	 *
+	 * Outside the window the run loop uses the unlogged step loop. Instret
+	 * triggers end a step and pc triggers are tested against a small
+	 * filter of trigger, entry and pending return addresses, so the loop
+	 * only checks the program counter when a pc trigger is armed.
+	 */
+
+	enum log_trigger_type
+	{
+		log_trigger_instret,
+		log_trigger_pc,
+		log_trigger_entry,
+		log_trigger_exit,
+		log_trigger_marker
+	};
+
+	enum : u32 {
+		proc_log_window_mask = proc_log_inst | proc_log_operands | proc_log_trap | proc_log_int_reg |
+			proc_log_hist_reg | proc_log_hist_pc | proc_log_hist_inst | proc_log_trace | proc_log_profile
+	};
+
+	/* slti zero, zero, <n> */
+	inline bool log_marker_inst(inst_t inst) { return (inst & 0xfffff) == 0x2013; }
+	inline u32 log_marker_num(inst_t inst) { return u32(inst >> 20) & 0xfff; }
+
+	struct log_trigger
+	{
+		log_trigger_type type;
+		bool on;
+		u64 value;
+		std::string spec;
+	};
+
+	struct log_return
+	{
+		u64 ra;
+		u64 entry;
+	};
+
+	struct log_window
+	{
+		static const size_t pc_filter_size = 1024;
+
+		std::vector<log_trigger> triggers;
+		std::vector<log_return> returns;
+		std::function<bool(std::string,addr_t&)> resolve;
+		u32 flags = 0;
+		bool open = true;
+		bool pc_armed = false;
+		u64 next_instret = u64(-1);
+		u64 instret_done = u64(-1);
+		u64 pc_done = u64(-1);
+		u64 pc_done_pc = 0;
+		u8 pc_filter[pc_filter_size] = {};
+
+		static size_t filter_index(u64 pc) { return (pc >> 1) & (pc_filter_size - 1); }
+
+		bool pc_check(u64 pc) { return pc_filter[filter_index(pc)]; }
+
+		/* parse and add a trigger, returns false with a message on error */
+		bool add(std::string spec, bool on, std::string &err)
+		{
+			static const std::pair<const char*,log_trigger_type> types[] = {
+				{ "instret", log_trigger_instret },
+				{ "pc", log_trigger_pc },
+				{ "entry", log_trigger_entry },
+				{ "exit", log_trigger_exit },
+				{ "marker", log_trigger_marker },
+			};
+			size_t colon = spec.find(':');
+			if (colon == std::string::npos) {
+				err = "trigger must be <type>:<value>";
+				return false;
+			}
+			std::string type = spec.substr(0, colon), arg = spec.substr(colon + 1);
+			for (auto &t : types) {
+				if (type != t.first) continue;
+				char *end;
+				addr_t value = strtoull(arg.c_str(), &end, 0);
+				if (arg.size() == 0 || *end != '\0') {
+					if (t.second != log_trigger_entry && t.second != log_trigger_exit) {
+						err = "invalid number: " + arg;
+						return false;
+					}
+					if (!resolve || !resolve(arg, value)) {
+						err = "unknown symbol: " + arg;
+						return false;
+					}
+				}
+				triggers.push_back(log_trigger{ t.second, on, u64(value), spec });
+				update();
+				return true;
+			}
+			err = "unknown trigger type: " + type;
+			return false;
+		}
+
+		/* add command line triggers and close the window if any turn logging on */
+		void init(std::vector<std::pair<std::string,bool>> &specs, u32 &log)
+		{
+			std::string err;
+			for (auto &spec : specs) {
+				if (!add(spec.first, spec.second, err)) {
+					panic("--log-%s: %s: %s", spec.second ? "on" : "off",
+						spec.first.c_str(), err.c_str());
+				}
+			}
+			if (flags == 0) flags = log & proc_log_window_mask;
+			for (auto &t : triggers) {
+				if (t.on) open = false;
+			}
+			sync(log);
+		}
+
+		/* apply the window state to a log mask */
+		void sync(u32 &log)
+		{
+			if (open) log |= flags;
+			else log &= ~flags;
+		}
+
+		void clear(u32 &log)
+		{
+			triggers.clear();
+			returns.clear();
+			open = true;
+			update();
+			sync(log);
+		}
+
+		/* default to the instruction log when the window is set from the debugger */
+		void default_flags()
+		{
+			if (flags == 0) flags = proc_log_inst | proc_log_trap;
+		}
+
+		void set(bool on, u32 &log)
+		{
+			default_flags();
+			open = on;
+			sync(log);
+		}
+
+		/* rebuild the pc filter and the next instret trigger */
+		void update()
+		{
+			memset(pc_filter, 0, sizeof(pc_filter));
+			pc_armed = false;
+			for (auto &t : triggers) {
+				switch (t.type) {
+					case log_trigger_pc:
+					case log_trigger_entry:
+					case log_trigger_exit:
+						pc_filter[filter_index(t.value)] = 1;
+						pc_armed = true;
+						break;
+					default:
+						break;
+				}
+			}
+			for (auto &r : returns) {
+				pc_filter[filter_index(r.ra)] = 1;
+			}
+			next_instret = u64(-1);
+			for (auto &t : triggers) {
+				if (t.type == log_trigger_instret &&
+					(instret_done == u64(-1) || t.value > instret_done)) {
+					next_instret = std::min(next_instret, t.value);
+				}
+			}
+		}
+
+		bool pending(u64 entry)
+		{
+			for (auto &r : returns) {
+				if (r.entry == entry) return true;
+			}
+			return false;
+		}
+
+		bool fire(log_trigger_type type, u64 value, u64 pc, u64 instret, u32 &log)
+		{
+			bool was_open = open;
+			for (auto &t : triggers) {
+				if (t.type != type || t.value != value) continue;
+				if ((flags & proc_log_inst) && open != t.on) {
+					printf("LOG      :%s %s pc:0x%0llx instret:%llu\n",
+						t.on ? "on" : "off", t.spec.c_str(), pc, instret);
+				}
+				open = t.on;
+			}
+			sync(log);
+			return open != was_open;
+		}
+
+		/* instret reached or passed next_instret, returns true if the window changed */
+		bool instret_hit(u64 pc, u64 instret, u32 &log)
+		{
+			bool was_open = open;
+			/* a step can retire past a trigger, so fire every passed trigger in order */
+			while (next_instret != u64(-1) && instret >= next_instret) {
+				fire(log_trigger_instret, next_instret, pc, instret, log);
+				instret_done = next_instret;
+				update();
+			}
+			instret_done = instret;
+			update();
+			return open != was_open;
+		}
+
+		/* pc is in the filter, returns true if the window changed */
+		bool pc_hit(u64 pc, u64 instret, u64 ra, u32 &log)
+		{
+			/* the step loop restarts at the same instruction after a change */
+			if (instret == pc_done && pc == pc_done_pc) return false;
+			pc_done = instret;
+			pc_done_pc = pc;
+
+			bool was_open = open, returns_changed = false;
+			while (returns.size() > 0 && returns.back().ra == pc) {
+				u64 entry = returns.back().entry;
+				returns.pop_back();
+				returns_changed = true;
+				if (!pending(entry)) fire(log_trigger_exit, entry, pc, instret, log);
+			}
+			bool entry = false, exit = false;
+			for (auto &t : triggers) {
+				if (t.value != pc) continue;
+				if (t.type == log_trigger_entry) entry = true;
+				if (t.type == log_trigger_exit) exit = true;
+			}
+			if (entry || exit) {
+				bool active = pending(pc);
+				if (exit) {
+					returns.push_back(log_return{ ra, pc });
+					returns_changed = true;
+				}
+				if (entry && !active) fire(log_trigger_entry, pc, pc, instret, log);
+			}
+			fire(log_trigger_pc, pc, pc, instret, log);
+			if (returns_changed) update();
+			return open != was_open;
+		}
+
+		/* guest marker, returns true if the window changed */
+		bool marker(u32 n, u64 pc, u64 instret, u32 &log)
+		{
+			return fire(log_trigger_marker, n, pc, instret, log);
+		}
+
+		void print()
+		{
+			printf("log window %s flags 0x%x\n", open ? "open" : "closed", flags);
+			for (auto &t : triggers) {
+				printf("  %-3s %s (0x%llx)\n", t.on ? "on" : "off", t.spec.c_str(), t.value);
+			}
+			for (auto &r : returns) {
+				printf("  return 0x%llx from 0x%llx\n", r.ra, r.entry);
+			}
+		}
+	};
+
+}
+
+#endif
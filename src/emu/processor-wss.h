@@ -0,0 +1,274 @@
+//
+//  processor-wss.h
+//
+
+#ifndef rv_processor_wss_h
+#define rv_processor_wss_h
+
+namespace riscv {
+
+	/*
+	 * Working set profiler
+	 *
+	 * Instruction fetches, loads and stores set a bit in a page touch
+	 * bitmap. Bitmaps cover 2 MiB chunks of guest virtual (rv-sim, rv-jit)
+	 * or machine physical (rv-sys) addresses and are found with a small
+	 * direct mapped cache in front of a chunk index. At the end of each
+	 * interval of retired instructions the touched pages are counted and
+	 * written as one line of <prefix>.csv:
+	 *
+	 *   interval,instret,pages,bytes,new_pages,reused_pages,reuse_intervals,reuse_pages
+	 *
+	 * The reuse distance of a page touched again is the number of
+	 * intervals since it was last touched. It is estimated in pages as the
+	 * sum of the working sets of those intervals, an upper bound of the
+	 * distinct pages touched in between, and reported as the mean for the
+	 * interval and as a histogram on close. On close every touched page is
+	 * written to <prefix>-heat.csv with the region containing it and the
+	 * number of intervals it was touched in, and a summary per region is
+	 * printed. Regions are supplied by the emulator: ELF sections, the
+	 * stack, heap and ELF segments for proxy emulators and memory segments
+	 * for rv-sys.
+	 */
+
+	struct wss_region
+	{
+		std::string name;
+		u64 begin;
+		u64 end;
+	};
+
+	struct wss_chunk
+	{
+		static const size_t pages = 512;
+
+		u64 addr;                  /* address of the first page */
+		bool active = false;       /* touched in the current interval */
+		u64 touched[pages / 64] = {};
+		u32 first[pages] = {};     /* first interval touched + 1 */
+		u32 last[pages] = {};      /* last interval touched + 1 */
+		u32 intervals[pages] = {}; /* intervals touched */
+
+		wss_chunk(u64 addr) : addr(addr) {}
+	};
+
+	struct wss_cache_ent
+	{
+		u64 key;
+		wss_chunk *chunk;
+	};
+
+	struct guest_wss
+	{
+		typedef std::function<std::vector<wss_region>()> regions_fn;
+
+		static const size_t chunk_shift = page_shift + 9;
+		static const size_t cache_size = 16;
+		static const size_t reuse_buckets = 48;
+
+		std::string prefix;
+		u64 interval;
+		regions_fn regions;
+		FILE *file;
+
+		google::dense_hash_map<u64,size_t> chunk_index;
+		std::deque<wss_chunk> chunks; /* chunk addresses are cached */
+		std::vector<wss_chunk*> active;
+		wss_cache_ent cache[cache_size] = {};
+		std::vector<u64> wss_sum;     /* sum of the working sets of earlier intervals */
+		u64 reuse_hist[reuse_buckets] = {};
+		u64 next_instret;
+		u64 start_instret = 0;
+		u64 intervals = 0;
+		u64 max_pages = 0;
+
+		guest_wss(std::string prefix, u64 interval, regions_fn regions) :
+			prefix(prefix), interval(interval), regions(regions), next_instret(interval)
+		{
+			chunk_index.set_empty_key(-1);
+			wss_sum.push_back(0);
+			std::string filename = prefix + ".csv";
+			file = fopen(filename.c_str(), "w");
+			if (!file) {
+				panic("wss: can't open %s: %s", filename.c_str(), strerror(errno));
+			}
+			fprintf(file, "interval,instret,pages,bytes,new_pages,reused_pages,reuse_intervals,reuse_pages\n");
+		}
+
+		~guest_wss()
+		{
+			if (file) fclose(file);
+		}
+
+		/* working set of a new guest thread or hart with the same interval */
+		std::shared_ptr<guest_wss> fork(std::string prefix, u64 instret)
+		{
+			auto wss = std::make_shared<guest_wss>(prefix, interval, regions);
+			wss->start_instret = instret;
+			wss->next_instret = instret + interval;
+			return wss;
+		}
+
+		wss_chunk* chunk(u64 key)
+		{
+			auto ci = chunk_index.find(key);
+			if (ci != chunk_index.end()) return &chunks[ci->second];
+			chunk_index[key] = chunks.size();
+			chunks.emplace_back(key << chunk_shift);
+			return &chunks.back();
+		}
+
+		/* called for each instruction fetch, load and store */
+		void touch(u64 addr)
+		{
+			u64 key = addr >> chunk_shift;
+			wss_cache_ent &ent = cache[key & (cache_size - 1)];
+			if (ent.key != key || !ent.chunk) {
+				ent.key = key;
+				ent.chunk = chunk(key);
+			}
+			wss_chunk *c = ent.chunk;
+			size_t page = (addr >> page_shift) & (wss_chunk::pages - 1);
+			u64 bit = 1ULL << (page & 63);
+			if (c->touched[page >> 6] & bit) return;
+			c->touched[page >> 6] |= bit;
+			if (!c->active) {
+				c->active = true;
+				active.push_back(c);
+			}
+		}
+
+		/* called for each retired instruction */
+		void retire(u64 instret)
+		{
+			if (instret >= next_instret) {
+				write_interval(instret);
+				next_instret = instret + interval;
+			}
+		}
+
+		static size_t bucket(u64 n) { return n ? std::min(size_t(64 - __builtin_clzll(n)), reuse_buckets - 1) : 0; }
+
+		void write_interval(u64 instret)
+		{
+			u64 pages = 0, new_pages = 0, reused = 0, reuse_intervals = 0, reuse_pages = 0;
+			u32 now = u32(intervals + 1);
+			for (auto c : active) {
+				for (size_t w = 0; w < wss_chunk::pages / 64; w++) {
+					for (u64 bits = c->touched[w]; bits; bits &= bits - 1) {
+						size_t page = (w << 6) + __builtin_ctzll(bits);
+						u32 last = c->last[page];
+						if (last) {
+							u64 dist = wss_sum[intervals] - wss_sum[last - 1];
+							reused++;
+							reuse_intervals += now - last;
+							reuse_pages += dist;
+							reuse_hist[bucket(dist)]++;
+						} else {
+							c->first[page] = now;
+							new_pages++;
+						}
+						c->last[page] = now;
+						c->intervals[page]++;
+						pages++;
+					}
+					c->touched[w] = 0;
+				}
+				c->active = false;
+			}
+			active.clear();
+			fprintf(file, "%llu,%llu,%llu,%llu,%llu,%llu,%.2f,%.1f\n",
+				intervals, instret - start_instret, pages, pages << page_shift, new_pages, reused,
+				reused ? double(reuse_intervals) / reused : 0.0,
+				reused ? double(reuse_pages) / reused : 0.0);
+			wss_sum.push_back(wss_sum.back() + pages);
+			max_pages = std::max(max_pages, pages);
+			intervals++;
+		}
+
+		static const wss_region* find_region(std::vector<wss_region> &regions, u64 addr)
+		{
+			const wss_region *found = nullptr;
+			for (auto &r : regions) {
+				if (addr >= r.begin && addr < r.end &&
+					(!found || r.end - r.begin < found->end - found->begin)) found = &r;
+			}
+			return found;
+		}
+
+		void close(u64 instret)
+		{
+			if (active.size() > 0) write_interval(instret);
+			fclose(file);
+			file = nullptr;
+			write_heatmap();
+		}
+
+		size_t distinct_pages()
+		{
+			size_t n = 0;
+			for (auto &c : chunks) {
+				for (size_t page = 0; page < wss_chunk::pages; page++) n += c.last[page] != 0;
+			}
+			return n;
+		}
+
+		/* touched pages by address with their region, and totals per region */
+		void write_heatmap()
+		{
+			struct region_total { u64 pages = 0; u64 touches = 0; u64 hottest = 0; };
+			std::vector<wss_region> regs = regions ? regions() : std::vector<wss_region>();
+			std::map<std::string,region_total> totals;
+			std::vector<wss_chunk*> sorted;
+			for (auto &c : chunks) sorted.push_back(&c);
+			std::sort(sorted.begin(), sorted.end(), [](wss_chunk *a, wss_chunk *b) { return a->addr < b->addr; });
+
+			std::string filename = prefix + "-heat.csv";
+			FILE *heat = fopen(filename.c_str(), "w");
+			if (!heat) {
+				panic("wss: can't open %s: %s", filename.c_str(), strerror(errno));
+			}
+			fprintf(heat, "region,address,offset,intervals,first_interval,last_interval,heat\n");
+			u64 all_touches = 0;
+			for (auto c : sorted) {
+				for (size_t page = 0; page < wss_chunk::pages; page++) {
+					if (!c->last[page]) continue;
+					u64 addr = c->addr + (u64(page) << page_shift);
+					const wss_region *r = find_region(regs, addr);
+					std::string name = r ? r->name : std::string("unmapped");
+					fprintf(heat, "%s,0x%llx,0x%llx,%u,%u,%u,%.4f\n", name.c_str(), addr,
+						r ? addr - (r->begin & ~u64(page_size - 1)) : 0, c->intervals[page],
+						c->first[page] - 1, c->last[page] - 1,
+						intervals ? double(c->intervals[page]) / intervals : 0.0);
+					region_total &t = totals[name];
+					t.pages++;
+					t.touches += c->intervals[page];
+					t.hottest = std::max(t.hottest, u64(c->intervals[page]));
+					all_touches += c->intervals[page];
+				}
+			}
+			fclose(heat);
+
+			printf("\n");
+			printf("%s working set: intervals %llu of %llu instructions, max %llu pages, distinct %zu pages\n",
+				prefix.c_str(), intervals, interval, max_pages, distinct_pages());
+			printf("%-24s %12s %14s %10s %8s\n", "region", "pages", "mean intervals", "hottest", "percent");
+			for (auto &ent : totals) {
+				region_total &t = ent.second;
+				printf("%-24s %12llu %14.2f %10llu %7.2f%%\n", ent.first.c_str(), t.pages,
+					double(t.touches) / t.pages, t.hottest,
+					all_touches ? t.touches * 100.0 / all_touches : 0.0);
+			}
+			printf("%-24s %12s\n", "reuse distance pages", "reuses");
+			for (size_t b = 0; b < reuse_buckets; b++) {
+				if (!reuse_hist[b]) continue;
+				std::string range = b < 2 ? format_string("%llu", b ? 1ULL : 0ULL) :
+					format_string("%llu-%llu", 1ULL << (b - 1), (1ULL << b) - 1);
+				printf("%-24s %12llu\n", range.c_str(), reuse_hist[b]);
+			}
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,57 @@
+//
+//  scheduler.h
+//
+
+#ifndef rv_scheduler_h
+#define rv_scheduler_h
+
+namespace riscv {
+
+	/*
+	 * Device event scheduler
+	 *
+	 * Devices post events at a future time, or at time zero to be serviced
+	 * immediately, and the hart services its devices only when the earliest
+	 * event is due. The earliest deadline is atomic so the run loop can test
+	 * it without taking the lock and other threads can post events.
+	 *
+	 * Events are not cancelled. An event posted for a compare register that
+	 * is later reprogrammed causes one extra device service.
+	 */
+
+	struct event_scheduler
+	{
+		std::mutex lock;
+		std::priority_queue<u64,std::vector<u64>,std::greater<u64>> events;
+		std::atomic<u64> deadline;
+
+		event_scheduler() : deadline(std::numeric_limits<u64>::max()) {}
+
+		/* post an event at time */
+		void post(u64 time)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			events.push(time);
+			deadline = events.top();
+		}
+
+		/* time of the earliest event */
+		u64 next() { return deadline.load(std::memory_order_relaxed); }
+
+		/* check whether the earliest event is due */
+		bool due(u64 time) { return next() <= time; }
+
+		/* remove events that are due */
+		void expire(u64 time)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			while (!events.empty() && events.top() <= time) {
+				events.pop();
+			}
+			deadline = events.empty() ? std::numeric_limits<u64>::max() : events.top();
+		}
+	};
+
+}
+
+#endif
@@ -148,6 +148,20 @@ static void print_interp_h(rv_gen *gen)
 			inst = replace(inst, "frs2", "proc.freg[dec.rs2]");
 			inst = replace(inst, "frs3", "proc.freg[dec.rs3]");
 			inst = replace(inst, "fenv_setrm(rm)", "fenv_setrm((proc.fcsr >> 5) & 0b111)");
+			/* LR and SC go through the mmu, which holds the reservation and makes SC atomic */
+			inst = replace(inst, "proc.lr = proc.ireg[dec.rs1]; s32 t; proc.mmu.template load<P,s32>(",
+				"s32 t; proc.mmu.template lr<P,s32>(");
+			inst = replace(inst, "proc.lr = proc.ireg[dec.rs1]; s64 t; proc.mmu.template load<P,s64>(",
+				"s64 t; proc.mmu.template lr<P,s64>(");
+			inst = replace(inst, "ux res = 0; if (proc.lr != proc.ireg[dec.rs1]) res = 1; "
+				"else proc.mmu.template store<P,s32>(proc, proc.ireg[dec.rs1], proc.ireg[dec.rs2].r.w.val);",
+				"ux res; proc.mmu.template sc<P,s32>(proc, proc.ireg[dec.rs1], proc.ireg[dec.rs2].r.w.val, res);");
+			inst = replace(inst, "ux res = 0; if (proc.lr != proc.ireg[dec.rs1]) res = 1; "
+				"else proc.mmu.template store<P,s64>(proc, proc.ireg[dec.rs1], proc.ireg[dec.rs2].r.l.val);",
+				"ux res; proc.mmu.template sc<P,s64>(proc, proc.ireg[dec.rs1], proc.ireg[dec.rs2].r.l.val, res);");
+			if (inst.find("proc.lr") != std::string::npos) {
+				panic("%s: unrecognised LR/SC pseudocode", opcode->name.c_str());
+			}
 			printf("\t\t\tif (rv%c) {\n", opcode->extensions.front()->alpha_code);
 			printf("\t\t\t\t%s;\n",  inst.c_str());
 			printf("\t\t\t};\n");
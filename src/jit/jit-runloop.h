@@ -9,10 +9,10 @@ namespace riscv {
 
 	struct jit_singleton
 	{
-		static jit_singleton *current;
+		static thread_local jit_singleton *current;
 	};
 
-	jit_singleton* jit_singleton::current = nullptr;
+	thread_local jit_singleton* jit_singleton::current = nullptr;
 
 	struct jit_logger : Logger
 	{
@@ -171,12 +171,44 @@ namespace riscv {
 						return;
 				}
 				ex = step(count);
+				if (P::stats_counters) P::stats_publish();
 				if (P::debugging && ex == exit_cause_continue) {
 					ex = exit_cause_cli;
 				}
 			}
 		}
 
+		/* run until the program counter reaches addr, false if the processor stopped */
+		bool run_to(addr_t addr)
+		{
+			exit_cause ex;
+			P::breakpoint = addr;
+			while ((ex = step(inst_step)) == exit_cause_continue);
+			P::breakpoint = 0;
+			return ex == exit_cause_cli && P::pc == typename P::ux(addr);
+		}
+
+		/* markers decode as illegal so traces end before them and the interpreter retires them */
+		void inst_decode(typename P::decode_type &dec, inst_t inst)
+		{
+			P::inst_decode(dec, inst);
+			if (unlikely(log_marker_inst(inst))) dec.op = rv_op_illegal;
+		}
+
+		/* retire a log window or region of interest marker */
+		void step_marker(typename P::decode_type &dec, inst_t inst, typename P::ux pc_offset)
+		{
+			if (P::log & ~(proc_log_hist_pc | proc_log_jit_trap)) {
+				P::inst_decode(dec, inst);
+				P::print_log(dec, inst);
+			}
+			u32 num = log_marker_num(inst);
+			P::window.marker(num, P::pc, P::instret, P::log);
+			if (roi_marker(num)) P::roi_command(*this, num - roi_marker_base);
+			P::pc += pc_offset;
+			P::instret++;
+		}
+
 		typename P::ux inst_fence_i(typename P::decode_type &dec, typename P::ux pc_offset)
 		{
 			switch(dec.op) {
@@ -301,6 +333,8 @@ namespace riscv {
 				intptr_t entry_addr = r.i;
 				trace_cache_prolog[pc] = fn;
 				trace_cache_entry[pc] = r.fn;
+				P::jit_traces++;
+				P::jit_code_bytes += code.getCodeSize();
 				jit_apply_fixups(emitter, pc, entry_addr);
 				jit_stash_fixups(emitter, code, prolog_addr);
 			}
@@ -330,6 +364,8 @@ namespace riscv {
 
 			typename P::ux trace_pc = P::pc;
 			typename P::ux trace_instret = P::instret;
+			u64 start_ns = host_cpu::get_instance().get_time_ns();
+			phase_scope timer(P::phases, phase_jit_compile);
 
 			/* trace code and accumlate trace buffer */
 			P::log &= ~proc_log_jit_trap;
@@ -338,7 +374,7 @@ namespace riscv {
 				typename P::decode_type dec;
 				typename P::ux pc_offset, new_offset;
 				inst_t inst = P::mmu.inst_fetch(*this, P::pc, pc_offset);
-				P::inst_decode(dec, inst);
+				inst_decode(dec, inst);
 				dec.pc = P::pc;
 				dec.inst = inst;
 				if (tracer.emit(dec) == false) break;
@@ -381,6 +417,7 @@ namespace riscv {
 			else {
 				jit_cache(emitter, code, trace_pc);
 			}
+			P::jit_compile_ns += host_cpu::get_instance().get_time_ns() - start_ns;
 		}
 
 		void copy_reg(typename P::processor_type *dst, typename P::processor_type *src)
@@ -496,11 +533,15 @@ namespace riscv {
 
 			/* interrupt service routine */
 			P::time = cpu_cycle_clock();
-			P::isr();
+			{
+				phase_scope timer(P::phases, phase_isr);
+				P::isr();
+			}
 
 			/* trap return path */
 			int cause;
 			if (unlikely((cause = setjmp(P::env)) > 0)) {
+				if (phase_profile) P::phases.unwind();
 				cause -= P::internal_cause_offset;
 				switch(cause) {
 					case P::internal_cause_cli:
@@ -514,6 +555,8 @@ namespace riscv {
 					case P::internal_cause_hotspot:
 						jit_trace();
 						return exit_cause_continue;
+					case P::internal_cause_yield:
+						return exit_cause_continue;
 				}
 				P::trap(dec, cause);
 				if (!P::running) return exit_cause_poweroff;
@@ -521,21 +564,39 @@ namespace riscv {
 
 			/* step the processor */
 			while (P::instret != inststop) {
-				if ((P::log & proc_log_jit_trap) && jit_exec(*this, P::pc)) {
-					continue;
+				if (P::log & proc_log_jit_trap) {
+					typename P::ux trace_pc = P::pc, trace_instret = P::instret;
+					bool traced;
+					{
+						phase_scope timer(P::phases, phase_jit_exec);
+						traced = jit_exec(*this, P::pc);
+					}
+					if (traced) {
+						P::jit_exits++;
+						/* sample at trace boundaries */
+						if (P::log & proc_log_profile) {
+							P::profile->retire(trace_pc, P::instret - trace_instret);
+						}
+						continue;
+					}
 				}
 				if (P::pc == P::breakpoint && P::breakpoint != 0) {
 					return exit_cause_cli;
 				}
-				inst = P::mmu.inst_fetch(*this, P::pc, pc_offset);
+				{
+					phase_scope timer(P::phases, phase_fetch);
+					inst = P::mmu.inst_fetch(*this, P::pc, pc_offset);
+				}
 				inst_cache_key = inst % inst_cache_size;
 				if (inst_cache[inst_cache_key].inst == inst) {
 					dec = inst_cache[inst_cache_key].dec;
 				} else {
-					P::inst_decode(dec, inst);
+					phase_scope timer(P::phases, phase_decode);
+					inst_decode(dec, inst);
 					inst_cache[inst_cache_key].inst = inst;
 					inst_cache[inst_cache_key].dec = dec;
 				}
+				phase_scope timer(P::phases, phase_exec);
 				if (P::log & proc_log_jit_audit) {
 					jit_audit(dec, inst, pc_offset);
 				}
@@ -546,6 +607,8 @@ namespace riscv {
 					if (P::log & ~(proc_log_hist_pc | proc_log_jit_trap)) P::print_log(dec, inst);
 					P::pc += new_offset;
 					P::instret++;
+				} else if (log_marker_inst(inst)) {
+					step_marker(dec, inst, pc_offset);
 				} else {
 					P::raise(rv_cause_illegal_instruction, P::pc);
 				}
@@ -1,7 +1,7 @@
 /*
  *  mmap-core.c
  *
- *  mmap bitmap tracker
+ *  mmap free extent tracker
  */
 
 #include <stdio.h>
@@ -15,155 +15,339 @@
 
 #include "mmap-core.h"
 
-static _Bool map_inited = false;
+/*
+ * Free address space is kept as extents in treaps ordered by start address
+ * and augmented with the largest extent in each subtree, so the lowest free
+ * range of a given length is found in O(log n) regardless of fragmentation.
+ *
+ * The guest range is split into shards, each with its own lock and node pool.
+ * The first shard covers the low 4GiB so single threaded guests allocate from
+ * the bottom of the address space. Each thread allocates from its own shard
+ * first and falls back to the other shards in address order. Only shards
+ * below the caller's limit are used, so 32-bit guests allocate from the
+ * first shard. Frees and fixed mappings go to the shards that own the
+ * address range.
+ */
+
 static _Bool map_debug = false;
-static pthread_mutex_t meta_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t map_once = PTHREAD_ONCE_INIT;
 
 static const uintptr_t GUEST_MMAP_BASE = 0x40000000ULL;
-static const uintptr_t HOST_MMAP_BASE = 0x7fff00000000UL;
+static const uintptr_t GUEST_LOW_LIMIT = GUEST_MMAP_LIMIT_32;
+static const uintptr_t HOST_MMAP_BASE = GUEST_MMAP_LIMIT_64;
+static const uintptr_t HOST_MMAP_LIMIT = 0x800000000000UL;
 static const uintptr_t METADATA_BASE = 0x7f0000000000UL;
-static const uintptr_t PAGE_SHIFT = 12;
-static const uintptr_t PAGE_SIZE = (1ULL << 12);
 static const uintptr_t PAGE_MASK = ((1ULL << 12) - 1);
-static const uintptr_t LEVEL_SIZE = (1ULL << 12);
-static const uintptr_t LEVEL_BYTES = ((1ULL << 12) >> 3);
 static const int METADATA_PROT = PROT_READ | PROT_WRITE;
-static const int METADATA_FLAGS = MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE;
+static const int METADATA_FLAGS = MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE;
+
+enum {
+	GUEST_SHARDS = 8,
+	HOST_SHARD = GUEST_SHARDS,
+	NUM_SHARDS = GUEST_SHARDS + 1,
+	SHARD_NODES = 1 << 18
+};
+
+typedef struct extent extent;
+
+struct extent
+{
+	uintptr_t start;     /* free range start */
+	uintptr_t end;       /* free range end (exclusive) */
+	uintptr_t max_len;   /* largest free range in subtree */
+	uint32_t prio;       /* treap priority */
+	extent *left;
+	extent *right;
+};
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	uintptr_t base;
+	uintptr_t limit;
+	extent *root;
+	extent *pool_next;
+	extent *pool_end;
+	extent *free_list;
+	uint32_t seed;
+} shard;
+
+static shard shards[NUM_SHARDS];
+static uint32_t next_thread_shard = 0;
+static __thread int thread_shard = -1;
+
+/* extent nodes */
+
+static extent* node_alloc(shard *s, uintptr_t start, uintptr_t end)
+{
+	extent *n = s->free_list;
+	if (n) {
+		s->free_list = n->left;
+	} else if (s->pool_next < s->pool_end) {
+		n = s->pool_next++;
+	} else {
+		fprintf(stderr, "mmap tracker: out of extent nodes\n");
+		exit(1);
+	}
+	s->seed ^= s->seed << 13;
+	s->seed ^= s->seed >> 17;
+	s->seed ^= s->seed << 5;
+	n->start = start;
+	n->end = end;
+	n->max_len = end - start;
+	n->prio = s->seed;
+	n->left = n->right = NULL;
+	return n;
+}
+
+static void node_free(shard *s, extent *n)
+{
+	n->left = s->free_list;
+	s->free_list = n;
+}
+
+/* treap primitives */
+
+static void update(extent *n)
+{
+	uintptr_t max_len = n->end - n->start;
+	if (n->left && n->left->max_len > max_len) max_len = n->left->max_len;
+	if (n->right && n->right->max_len > max_len) max_len = n->right->max_len;
+	n->max_len = max_len;
+}
+
+static void split(extent *t, uintptr_t key, extent **l, extent **r)
+{
+	if (!t) {
+		*l = *r = NULL;
+	} else if (t->start < key) {
+		split(t->right, key, &t->right, r);
+		update(t);
+		*l = t;
+	} else {
+		split(t->left, key, l, &t->left);
+		update(t);
+		*r = t;
+	}
+}
+
+static extent* merge(extent *l, extent *r)
+{
+	if (!l) return r;
+	if (!r) return l;
+	if (l->prio > r->prio) {
+		l->right = merge(l->right, r);
+		update(l);
+		return l;
+	} else {
+		r->left = merge(l, r->left);
+		update(r);
+		return r;
+	}
+}
+
+static void tree_insert(shard *s, uintptr_t start, uintptr_t end)
+{
+	extent *l, *r;
+	split(s->root, start, &l, &r);
+	s->root = merge(merge(l, node_alloc(s, start, end)), r);
+}
+
+static void tree_remove(shard *s, uintptr_t start)
+{
+	extent *l, *m, *r;
+	split(s->root, start, &l, &r);
+	split(r, start + 1, &m, &r);
+	if (m) node_free(s, m);
+	s->root = merge(l, r);
+}
+
+/* find extent with the greatest start address below key */
+static extent* tree_floor(extent *t, uintptr_t key)
+{
+	extent *found = NULL;
+	while (t) {
+		if (t->start < key) {
+			found = t;
+			t = t->right;
+		} else {
+			t = t->left;
+		}
+	}
+	return found;
+}
+
+/* find the lowest addressed extent of at least len */
+static extent* tree_fit(extent *t, size_t len)
+{
+	while (t && t->max_len >= len) {
+		if (t->left && t->left->max_len >= len) {
+			t = t->left;
+		} else if (t->end - t->start >= len) {
+			return t;
+		} else {
+			t = t->right;
+		}
+	}
+	return NULL;
+}
 
-static void mark_used(uintptr_t start_of_range, size_t len);
-static void mark_free(uintptr_t start_of_range, size_t len);
-static _Bool page_present(uintptr_t addr);
+/* shard operations (called with shard lock held) */
+
+static void shard_mark_used(shard *s, uintptr_t start, uintptr_t end)
+{
+	extent *n;
+	while ((n = tree_floor(s->root, end)) && n->end > start) {
+		uintptr_t n_start = n->start, n_end = n->end;
+		tree_remove(s, n_start);
+		if (n_start < start) tree_insert(s, n_start, start);
+		if (n_end > end) tree_insert(s, end, n_end);
+	}
+}
+
+static void shard_mark_free(shard *s, uintptr_t start, uintptr_t end)
+{
+	extent *n;
+	shard_mark_used(s, start, end);
+	if ((n = tree_floor(s->root, start)) && n->end == start) {
+		start = n->start;
+		tree_remove(s, start);
+	}
+	if ((n = tree_floor(s->root, end + 1)) && n->start == end) {
+		end = n->end;
+		tree_remove(s, n->start);
+	}
+	tree_insert(s, start, end);
+}
+
+/* tracker */
+
+static void init_shard(shard *s, size_t i, uintptr_t base, uintptr_t limit)
+{
+	pthread_mutex_init(&s->lock, NULL);
+	s->base = base;
+	s->limit = limit;
+	s->pool_next = (extent*)METADATA_BASE + i * SHARD_NODES;
+	s->pool_end = s->pool_next + SHARD_NODES;
+	s->free_list = NULL;
+	s->seed = 0x9e3779b9 + (uint32_t)i;
+	s->root = node_alloc(s, base, limit);
+}
 
 static void init_mmap()
 {
-	if(map_inited) return;
-	if (mmap((void*)METADATA_BASE, 4096, METADATA_PROT, METADATA_FLAGS, -1, 0) == MAP_FAILED) {
+	size_t metadata_size = NUM_SHARDS * SHARD_NODES * sizeof(extent);
+	if (mmap((void*)METADATA_BASE, metadata_size, METADATA_PROT, METADATA_FLAGS, -1, 0) == MAP_FAILED) {
 		fprintf(stderr, "mmap failed: %s", strerror(errno));
 		exit(1);
 	}
-	map_inited = 1;
-}
-
-static uintptr_t level_bmap(size_t level, uintptr_t addr, uintptr_t *offset)
-{
-	uintptr_t bmap;
-	switch (level) {
-		case 3:
-			bmap = METADATA_BASE;
-			break;
-		case 2:
-			bmap = METADATA_BASE + LEVEL_BYTES + ((addr >> 36) & 0xfff) * LEVEL_BYTES;
-			break;
-		case 1:
-			bmap = METADATA_BASE + LEVEL_BYTES + (LEVEL_SIZE * LEVEL_BYTES) + ((addr >> 24) & 0xffffff) * LEVEL_BYTES;
-			break;
-		default:
-			bmap = -1;
-			break;
-	}
-	if (offset) {
-		*offset = ((addr >> (12 * level)) & PAGE_MASK);
-	}
-	return bmap;
-}
-
-static void reify_bmap(char *bmap)
-{
-	for (size_t level = 2; level > 0; level--) {
-		uintptr_t offset1;
-		char *bmap1 = (char*)level_bmap(level + 1, (uintptr_t)bmap, &offset1);
-		if ((bmap1[offset1 >> 3] & (1 << (offset1 & 7))) == 0) {
-			uintptr_t offset2;
-			char *bmap2 = (char*)level_bmap(level, (uintptr_t)bmap, &offset2);
-			void *rv, *map_addr = (void*)((uintptr_t)bmap2 & ~(PAGE_SIZE-1));
-			if (map_debug) {
-				printf("reifying addr=%p level=%zu %p:%zu -> %p:%zu mmap(%p,%p)\n",
-					bmap, level, bmap1, offset1, bmap2, offset2, map_addr, (void*)PAGE_SIZE);
-			}
-			if ((rv = mmap(map_addr, PAGE_SIZE, METADATA_PROT, METADATA_FLAGS, -1, 0)) == MAP_FAILED) {
-				fprintf(stderr, "mmap failed: %s\n", strerror(errno));
-				exit(1);
-			} else if (rv != map_addr) {
-				fprintf(stderr, "mmap failed: invalid address\n");
-				exit(1);
-			}
-			bmap1[offset1 >> 3] = 0xff;
-		}
+	uintptr_t shard_size = ((HOST_MMAP_BASE - GUEST_LOW_LIMIT) / (GUEST_SHARDS - 1)) & ~PAGE_MASK;
+	init_shard(&shards[0], 0, GUEST_MMAP_BASE, GUEST_LOW_LIMIT);
+	for (size_t i = 1; i < GUEST_SHARDS; i++) {
+		uintptr_t base = GUEST_LOW_LIMIT + (i - 1) * shard_size;
+		init_shard(&shards[i], i, base, i == GUEST_SHARDS - 1 ? HOST_MMAP_BASE : base + shard_size);
 	}
+	init_shard(&shards[HOST_SHARD], HOST_SHARD, HOST_MMAP_BASE, HOST_MMAP_LIMIT);
+}
+
+static uintptr_t round_len(size_t len)
+{
+	return (len + PAGE_MASK) & ~PAGE_MASK;
 }
 
-static _Bool page_present(uintptr_t addr)
+static int home_shard()
 {
-	for (size_t level = 3; level > 0; level--) {
-		uintptr_t offset;
-		char *bmap = (char*)level_bmap(level, addr, &offset);
-		_Bool is_present = bmap[offset >> 3] & 1 << (offset & 7);
-		if (!is_present) return false;
+	if (thread_shard < 0) {
+		thread_shard = __atomic_fetch_add(&next_thread_shard, 1, __ATOMIC_RELAXED) % GUEST_SHARDS;
 	}
-	return true;
+	return thread_shard;
 }
 
-static uintptr_t find_free(uintptr_t start, uintptr_t end, size_t len)
+static uintptr_t shard_find_free(shard *s, size_t len)
 {
-	if (map_debug) {
-		printf("find_free range=(%p-%p) len=%zu\n",
-			(void*)start, (void*)end, len);
-	}
-	uintptr_t start_of_range;
-	for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE) {
-		start_of_range = addr;
-		reify_bmap((char*)addr);
-		for (; addr < end && !page_present(addr); addr += PAGE_SIZE) {
-			if (addr - start_of_range >= len) {
-				if (map_debug) {
-					printf("find_free found=(%p-%p) scanned=%zu\n",
-						(void*)start_of_range, (void*)(start_of_range + len),
-						(start_of_range - start) >> PAGE_SHIFT);
-				}
-				return start_of_range;
-			}
-		}
+	uintptr_t addr = 0;
+	pthread_mutex_lock(&s->lock);
+	extent *n = tree_fit(s->root, len);
+	if (n) {
+		addr = n->start;
+		shard_mark_used(s, addr, addr + len);
 	}
-	return 0;
+	pthread_mutex_unlock(&s->lock);
+	return addr;
 }
 
-static void mark_used(uintptr_t start_of_range, size_t len)
+static uintptr_t find_free(_Bool guest, size_t len, uintptr_t limit)
 {
-	if (map_debug) {
-		printf("mark_used range=(%p-%p) len=%zu\n",
-			(void*)start_of_range, (void*)(start_of_range + len), len);
+	uintptr_t addr = 0;
+	if (!guest) {
+		addr = shard_find_free(&shards[HOST_SHARD], len);
+	} else {
+		int home = home_shard();
+		if (shards[home].limit <= limit) {
+			addr = shard_find_free(&shards[home], len);
+		}
+		for (int i = 0; !addr && i < GUEST_SHARDS && shards[i].limit <= limit; i++) {
+			if (i != home) addr = shard_find_free(&shards[i], len);
+		}
 	}
-	for (uintptr_t addr = start_of_range; addr < start_of_range + len; addr += PAGE_SIZE) {
-		reify_bmap((char*)addr);
-		uintptr_t offset;
-		char *bmap = (char*)level_bmap(1, addr, &offset);
-		bmap[offset >> 3] |= 1 << (offset & 7);
+	if (map_debug) {
+		printf("find_free %s len=%zu found=%p\n", guest ? "guest" : "host", len, (void*)addr);
 	}
+	return addr;
 }
 
-static void mark_free(uintptr_t start_of_range, size_t len)
+static void mark_range(uintptr_t start_of_range, size_t len, _Bool used)
 {
 	if (map_debug) {
-		printf("mark_free range=(%p-%p) len=%zu\n",
+		printf("%s range=(%p-%p) len=%zu\n", used ? "mark_used" : "mark_free",
 			(void*)start_of_range, (void*)(start_of_range + len), len);
 	}
-	for (uintptr_t addr = start_of_range; addr < start_of_range + len; addr += PAGE_SIZE) {
-		reify_bmap((char*)addr);
-		uintptr_t offset;
-		char *bmap = (char*)level_bmap(1, addr, &offset);
-		bmap[offset >> 3] &= ~(1 << (offset & 7));
+	uintptr_t end_of_range = start_of_range + round_len(len);
+	for (size_t i = 0; i < NUM_SHARDS; i++) {
+		shard *s = &shards[i];
+		uintptr_t start = start_of_range > s->base ? start_of_range : s->base;
+		uintptr_t end = end_of_range < s->limit ? end_of_range : s->limit;
+		if (start >= end) continue;
+		pthread_mutex_lock(&s->lock);
+		if (used) {
+			shard_mark_used(s, start, end);
+		} else {
+			shard_mark_free(s, start, end);
+		}
+		pthread_mutex_unlock(&s->lock);
 	}
 }
 
 static int __munmap(munmap_fn munmap, void *addr, size_t len)
 {
-	pthread_mutex_lock(&meta_lock);
-	init_mmap();
+	pthread_once(&map_once, init_mmap);
 	int rv = munmap(addr, len);
 	if (rv == 0) {
-		mark_free((uintptr_t)addr, len);
+		mark_range((uintptr_t)addr, len, false);
+	}
+	return rv;
+}
+
+static void* __mmap(mmap_fn mmap, _Bool guest, void *addr, size_t len, int prot, int flags, int fd, off_t offset, uintptr_t limit)
+{
+	pthread_once(&map_once, init_mmap);
+	if (addr == NULL) {
+		/* the range is reserved in the tracker before it is mapped */
+		addr = (void*)find_free(guest, round_len(len), limit);
+		if (!addr) {
+			errno = ENOMEM;
+			return MAP_FAILED;
+		}
+		void *rv = mmap(addr, len, prot, flags | MAP_FIXED, fd, offset);
+		if (rv == MAP_FAILED) {
+			mark_range((uintptr_t)addr, len, false);
+		}
+		return rv;
+	}
+	void *rv = mmap(addr, len, prot, flags, fd, offset);
+	if (rv != MAP_FAILED) {
+		mark_range((uintptr_t)rv, len, true);
 	}
-	pthread_mutex_unlock(&meta_lock);
 	return rv;
 }
 
@@ -190,49 +374,23 @@ void* __host_mmap(mmap_fn mmap, void *addr, size_t len, int prot, int flags, int
 	if (addr && (uintptr_t)addr < HOST_MMAP_BASE) {
 		return MAP_FAILED;
 	}
-	pthread_mutex_lock(&meta_lock);
-	init_mmap();
-	if (addr == NULL) {
-		addr = (void*)find_free(HOST_MMAP_BASE, -1, len);
-		if (!addr) {
-			pthread_mutex_unlock(&meta_lock);
-			return addr;
-		}
-		flags |= MAP_FIXED;
-	}
-	void *rv = mmap((void*)addr, len, prot, flags, fd, offset);
+	void *rv = __mmap(mmap, false, addr, len, prot, flags, fd, offset, HOST_MMAP_LIMIT);
 	if (map_debug) {
 		printf("host_mmap addr=%p len=%zu result=%p\n", addr, len, rv);
 	}
-	if (rv != MAP_FAILED) {
-		mark_used((uintptr_t)rv, len);
-	}
-	pthread_mutex_unlock(&meta_lock);
 	return rv;
 }
 
-void* __guest_mmap(mmap_fn mmap, void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+void* __guest_mmap(mmap_fn mmap, void *addr, size_t len, int prot, int flags, int fd, off_t offset, uintptr_t limit)
 {
-	if ((uintptr_t)(addr + len) > HOST_MMAP_BASE) {
+	if (limit > HOST_MMAP_BASE) limit = HOST_MMAP_BASE;
+	if ((uintptr_t)addr + len > limit) {
+		errno = ENOMEM;
 		return MAP_FAILED;
 	}
-	pthread_mutex_lock(&meta_lock);
-	init_mmap();
-	if (addr == NULL) {
-		addr = (void*)find_free(GUEST_MMAP_BASE, HOST_MMAP_BASE, len);
-		if (!addr) {
-			pthread_mutex_unlock(&meta_lock);
-			return addr;
-		}
-		flags |= MAP_FIXED;
-	}
-	void *rv = mmap((void*)addr, len, prot, flags, fd, offset);
+	void *rv = __mmap(mmap, true, addr, len, prot, flags, fd, offset, limit);
 	if (map_debug) {
 		printf("guest_mmap addr=%p len=%zu result=%p\n", addr, len, rv);
 	}
-	if (rv != MAP_FAILED) {
-		mark_used((uintptr_t)rv, len);
-	}
-	pthread_mutex_unlock(&meta_lock);
 	return rv;
 }
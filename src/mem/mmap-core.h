@@ -1,7 +1,7 @@
 /*
  *  mmap-core.h
  *
- *  mmap bitmap tracker
+ *  mmap free extent tracker
  */
 
 #ifndef _mmap_core_h
@@ -11,16 +11,20 @@
 extern "C" {
 #endif
 
+/* guest mappings must end below the limit of the guest address width */
+#define GUEST_MMAP_LIMIT_32 0x100000000ULL
+#define GUEST_MMAP_LIMIT_64 0x7fff00000000ULL
+
 typedef int (*munmap_fn)(void *addr, size_t len);
 typedef void* (*mmap_fn)(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
 
 int guest_munmap(void *addr, size_t len);
-void* guest_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+void* guest_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset, uintptr_t limit);
 
 int __host_munmap(munmap_fn munmap, void *addr, size_t len);
 int __guest_munmap(munmap_fn munmap, void *addr, size_t len);
 void* __host_mmap(mmap_fn mmap, void *addr, size_t len, int prot, int flags, int fd, off_t offset);
-void* __guest_mmap(mmap_fn mmap, void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+void* __guest_mmap(mmap_fn mmap, void *addr, size_t len, int prot, int flags, int fd, off_t offset, uintptr_t limit);
 
 #ifdef __cplusplus
 }
@@ -30,12 +30,12 @@ int guest_munmap(void *addr, size_t len)
 	return __guest_munmap(munmap, addr, len);
 }
 
-void* guest_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+void* guest_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset, uintptr_t limit)
 {
 	if (!real_mmap) {
 		*(void **)(&real_mmap) = dlsym(RTLD_NEXT, "mmap");
 	}
-	return __guest_mmap(real_mmap, addr, len, prot, flags, fd, offset);
+	return __guest_mmap(real_mmap, addr, len, prot, flags, fd, offset, limit);
 }
 
 void* mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
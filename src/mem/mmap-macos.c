@@ -28,9 +28,9 @@ int guest_munmap(void *addr, size_t len)
 	return __guest_munmap(munmap, addr, len);
 }
 
-void* guest_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+void* guest_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset, uintptr_t limit)
 {
-	return __guest_mmap(mmap, addr, len, prot, flags, fd, offset);
+	return __guest_mmap(mmap, addr, len, prot, flags, fd, offset, limit);
 }
 
 static void*
@@ -0,0 +1,54 @@
+//
+//  roi.h
+//
+//  Region of interest markers for guest programs running on rv8
+//
+//  Markers are nops outside rv8, so annotated programs run unchanged on
+//  hardware and other simulators. Linux returns -ENOSYS for the ecall.
+//
+
+#ifndef rv8_roi_h
+#define rv8_roi_h
+
+#define RV8_ROI_BEGIN         0   /* start collecting statistics */
+#define RV8_ROI_END           1   /* stop collecting statistics */
+#define RV8_ROI_RESET         2   /* reset counters, histograms and region totals */
+#define RV8_ROI_DETAIL        3   /* open the logging window, interpreting JIT code */
+#define RV8_ROI_FAST          4   /* close the logging window, resuming the JIT */
+#define RV8_ROI_DUMP          5   /* print region totals and write a statistics snapshot */
+
+#define RV8_ROI_MARKER_BASE   0x7f0
+#define RV8_ROI_ECALL         0x09524f49
+#define RV8_ROI_HTIF_DEVICE   2
+
+#ifndef __ASSEMBLER__
+
+/* slti zero, zero, 0x7f0 + <cmd> */
+#define rv8_roi_marker(cmd) \
+	__asm__ __volatile__ ("slti zero, zero, %0" : : "i" (RV8_ROI_MARKER_BASE + (cmd)) : "memory")
+
+#define rv8_roi_begin()       rv8_roi_marker(RV8_ROI_BEGIN)
+#define rv8_roi_end()         rv8_roi_marker(RV8_ROI_END)
+#define rv8_roi_reset()       rv8_roi_marker(RV8_ROI_RESET)
+#define rv8_roi_detail()      rv8_roi_marker(RV8_ROI_DETAIL)
+#define rv8_roi_fast()        rv8_roi_marker(RV8_ROI_FAST)
+#define rv8_roi_dump()        rv8_roi_marker(RV8_ROI_DUMP)
+
+/* ecall with a7=RV8_ROI_ECALL, returns zero if the command was accepted */
+static inline long rv8_roi_ecall(long cmd)
+{
+	register long a0 __asm__("a0") = cmd;
+	register long a7 __asm__("a7") = RV8_ROI_ECALL;
+	__asm__ __volatile__ ("ecall" : "+r" (a0) : "r" (a7) : "memory");
+	return a0;
+}
+
+/* HTIF tohost command for bare metal programs on rv-sys */
+static inline void rv8_roi_htif(volatile unsigned long long *tohost, unsigned long long cmd)
+{
+	*tohost = ((unsigned long long)RV8_ROI_HTIF_DEVICE << 56) | (cmd << 48);
+}
+
+#endif
+
+#endif
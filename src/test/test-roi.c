@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <assert.h>
+
+#include "roi.h"
+
+static long fib(long n)
+{
+	long first = 0, second = 1, next = 0;
+	for (long i = 0; i < n; i++) {
+		next = first + second;
+		first = second;
+		second = next;
+	}
+	return next;
+}
+
+int main()
+{
+	/* setup is outside the region */
+	long setup = fib(10000);
+
+	rv8_roi_reset();
+	rv8_roi_begin();
+	long work = fib(90);
+	rv8_roi_end();
+	rv8_roi_dump();
+
+	/* the same commands through the ecall interface */
+	assert(rv8_roi_ecall(RV8_ROI_BEGIN) == 0);
+	work += fib(90);
+	assert(rv8_roi_ecall(RV8_ROI_END) == 0);
+	assert(rv8_roi_ecall(RV8_ROI_DUMP) == 0);
+
+	printf("setup=%ld work=%ld\n", setup, work);
+	return 0;
+}
@@ -15,6 +15,7 @@ CXX = ${RISCV}/bin/${TARGET}-g++
 AS = ${RISCV}/bin/${TARGET}-as
 LD = ${RISCV}/bin/${TARGET}-ld
 STRIP = ${RISCV}/bin/${TARGET}-strip
+OBJCOPY = ${RISCV}/bin/${TARGET}-objcopy
 PK = ${RISCV}/${TARGET}/bin/pk
 
 TARGET_DIR = $(TARGET)
@@ -79,13 +80,16 @@ PROGRAMS = \
 	$(BIN_DIR)/test-fpu-printf \
 	$(BIN_DIR)/test-infinite-loop \
 	$(BIN_DIR)/test-int-fib \
+	$(BIN_DIR)/test-roi \
 	$(BIN_DIR)/test-int-mul \
 	$(BIN_DIR)/test-jump-tables-yes \
 	$(BIN_DIR)/test-jump-tables-no \
 	$(BIN_DIR)/test-large-imm \
 	$(BIN_DIR)/test-reloc-imm \
 	$(BIN_DIR)/test-sbi-info \
-	$(BIN_DIR)/test-sbi-timer
+	$(BIN_DIR)/test-sbi-timer \
+	$(BIN_DIR)/test-thread \
+	$(BIN_DIR)/test-thread-mmap
 
 HOST_PROGRAMS = \
 	$(HOST_BIN_DIR)/test-aes \
@@ -94,19 +98,26 @@ HOST_PROGRAMS = \
 	$(HOST_BIN_DIR)/test-norx \
 	$(HOST_BIN_DIR)/test-sha512 \
 	$(HOST_BIN_DIR)/test-primes \
-	$(HOST_BIN_DIR)/test-qsort
+	$(HOST_BIN_DIR)/test-qsort \
+	$(HOST_BIN_DIR)/test-nbody \
+	$(HOST_BIN_DIR)/test-int-fib
 
 ifeq ($(TARGET),riscv64-unknown-elf)
 PROGRAMS += \
 	$(BIN_DIR)/test-bswap \
+	$(BIN_DIR)/test-m-binary.bin \
 	$(BIN_DIR)/test-m-ecall-trap \
 	$(BIN_DIR)/test-m-hartid \
+	$(BIN_DIR)/test-m-litmus \
 	$(BIN_DIR)/test-m-mret-user \
 	$(BIN_DIR)/test-m-mmio-htif \
 	$(BIN_DIR)/test-m-mmio-timer \
 	$(BIN_DIR)/test-m-mmio-uart \
 	$(BIN_DIR)/test-m-poll-uart \
-	$(BIN_DIR)/test-m-sv39
+	$(BIN_DIR)/test-m-sv39 \
+	$(BIN_DIR)/test-m-virtio-blk \
+	$(BIN_DIR)/test-m-sbi-calls \
+	$(BIN_DIR)/test-m-hpm
 endif
 
 all: dirs $(ASSEMBLY) $(PROGRAMS) $(HOST_PROGRAMS)
@@ -123,15 +134,35 @@ test-sim: all
 	$(EMULATOR) $(BIN_DIR)/test-malloc
 	$(EMULATOR) $(BIN_DIR)/test-open README.md
 	$(EMULATOR) $(BIN_DIR)/test-int-fib
+	$(EMULATOR) $(BIN_DIR)/test-roi
+	$(EMULATOR) --roi $(BIN_DIR)/test-roi > $(GEN_DIR)/test-roi.out
+	awk '/^roi: dump: regions 1 / { a = $$6 } /^roi: dump: regions 2 / { b = $$6 } \
+		/^roi: thread [0-9]+: regions 2 / { t = $$7 } END { exit !(a > 0 && b > a && t == b) }' $(GEN_DIR)/test-roi.out
+	$(EMULATOR) $(BIN_DIR)/test-thread
+	$(EMULATOR) $(BIN_DIR)/test-thread-mmap
 	$(EMULATOR) $(BIN_DIR)/test-int-mul
 	$(EMULATOR) $(BIN_DIR)/test-fpu-printf
 	$(EMULATOR) $(BIN_DIR)/test-jump-tables-yes 11
 	$(EMULATOR) $(BIN_DIR)/test-jump-tables-no 11
+	$(EMULATOR) --bbv 1000 --bbv-file $(GEN_DIR)/hello-world-libc.bb $(BIN_DIR)/hello-world-libc
+	awk -F '[: ]+' '!/^T(:[0-9]+:[0-9]+ )+$$/ || (NR > 1 && n < 1000) { bad = 1; exit } \
+		{ n = 0; for (i = 3; i < NF; i += 2) n += $$i } END { exit bad || NR < 2 }' $(GEN_DIR)/hello-world-libc.bb
 
 test-sys: all
 	$(EMULATOR) $(BIN_DIR)/test-m-ecall-trap
 	$(EMULATOR) $(BIN_DIR)/test-m-mmio-timer
 	$(EMULATOR) $(BIN_DIR)/test-m-sv39
+	$(EMULATOR) --harts 4 $(BIN_DIR)/test-m-litmus
+	dd if=/dev/zero of=$(GEN_DIR)/test-m-virtio-blk.img bs=4096 count=4096
+	$(EMULATOR) --disk $(GEN_DIR)/test-m-virtio-blk.img $(BIN_DIR)/test-m-virtio-blk
+	$(EMULATOR) $(BIN_DIR)/test-m-sbi-calls
+	$(EMULATOR) --native-sbi $(BIN_DIR)/test-m-sbi-calls
+	$(EMULATOR) --harts 2 --native-sbi $(BIN_DIR)/test-m-sbi-calls
+	$(EMULATOR) $(BIN_DIR)/test-m-hpm
+	{ head -c 4096 /dev/zero; printf rv8-load; } > $(GEN_DIR)/test-m-binary.blob
+	$(EMULATOR) --binary 64 --load $(GEN_DIR)/test-m-binary.blob@0x80200000 $(BIN_DIR)/test-m-binary.bin
+	{ head -c 4096 /dev/zero; printf rv8-load; } | cmp - $(GEN_DIR)/test-m-binary.blob
+	! $(EMULATOR) --binary 64 --load $(GEN_DIR)/test-m-binary.blob@0x80200800 $(BIN_DIR)/test-m-binary.bin
 
 # host benchmarks
 
@@ -156,6 +187,12 @@ $(HOST_BIN_DIR)/test-primes: $(HOST_OBJ_DIR)/test-primes.o ; cc -O3 $^ -o $@
 $(HOST_OBJ_DIR)/test-qsort.o: $(SRC_DIR)/test-qsort.c ; cc -O3 -c $^ -o $@
 $(HOST_BIN_DIR)/test-qsort: $(HOST_OBJ_DIR)/test-qsort.o ; cc -O3 $^ -o $@
 
+$(HOST_OBJ_DIR)/test-nbody.o: $(SRC_DIR)/test-nbody.c ; cc -O3 -c $^ -o $@
+$(HOST_BIN_DIR)/test-nbody: $(HOST_OBJ_DIR)/test-nbody.o ; cc -O3 $^ -lm -o $@
+
+$(HOST_OBJ_DIR)/test-int-fib.o: $(SRC_DIR)/test-int-fib.c ; cc -O3 -c $^ -o $@
+$(HOST_BIN_DIR)/test-int-fib: $(HOST_OBJ_DIR)/test-int-fib.o ; cc -O3 $^ -o $@
+
 $(HOST_OBJ_DIR)/test-args.o: $(SRC_DIR)/test-args.c ; cc -O3 -c $^ -o $@
 $(HOST_BIN_DIR)/test-args: $(HOST_OBJ_DIR)/test-args.o ; cc -O3 $^ -o $@
 
@@ -251,6 +288,9 @@ $(BIN_DIR)/test-infinite-loop: $(OBJ_DIR)/test-infinite-loop.o ; $(LD) $^ -o $@
 $(OBJ_DIR)/test-int-fib.o: $(SRC_DIR)/test-int-fib.c ; $(CC) $(CFLAGS) -c $^ -o $@
 $(BIN_DIR)/test-int-fib: $(OBJ_DIR)/test-int-fib.o ; $(CC) $(CFLAGS) $^ -o $@
 
+$(OBJ_DIR)/test-roi.o: $(SRC_DIR)/test-roi.c ; $(CC) $(CFLAGS) -c $^ -o $@
+$(BIN_DIR)/test-roi: $(OBJ_DIR)/test-roi.o ; $(CC) $(CFLAGS) $^ -o $@
+
 $(OBJ_DIR)/test-int-mul.o: $(SRC_DIR)/test-int-mul.c ; $(CC) $(CFLAGS) -c $^ -o $@
 $(BIN_DIR)/test-int-mul: $(OBJ_DIR)/test-int-mul.o ; $(CC) $(CFLAGS) $^ -o $@
 
@@ -268,12 +308,21 @@ $(BIN_DIR)/test-large-imm: $(OBJ_DIR)/test-large-imm.o ; $(LD) $^ -o $@
 $(OBJ_DIR)/test-reloc-imm.o: $(SRC_DIR)/test-reloc-imm.S ; $(CC) -c $^ -o $@
 $(BIN_DIR)/test-reloc-imm: $(OBJ_DIR)/test-reloc-imm.o ; $(LD) $^ -o $@
 
+$(OBJ_DIR)/test-thread.o: $(SRC_DIR)/test-thread.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-thread: $(OBJ_DIR)/test-thread.o ; $(LD) $^ -o $@
+
+$(OBJ_DIR)/test-thread-mmap.o: $(SRC_DIR)/test-thread-mmap.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-thread-mmap: $(OBJ_DIR)/test-thread-mmap.o ; $(LD) $^ -o $@
+
 $(OBJ_DIR)/test-m-ecall-trap.o: $(SRC_DIR)/test-m-ecall-trap.S ; $(CC) -c $^ -o $@
 $(BIN_DIR)/test-m-ecall-trap: $(OBJ_DIR)/test-m-ecall-trap.o ; $(LD) $^ -o $@
 
 $(OBJ_DIR)/test-m-hartid.o: $(SRC_DIR)/test-m-hartid.S ; $(CC) -c $^ -o $@
 $(BIN_DIR)/test-m-hartid: $(OBJ_DIR)/test-m-hartid.o ; $(LD) $^ -o $@
 
+$(OBJ_DIR)/test-m-litmus.o: $(SRC_DIR)/test-m-litmus.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-m-litmus: $(OBJ_DIR)/test-m-litmus.o ; $(LD) $^ -o $@
+
 $(OBJ_DIR)/test-m-mmio-htif.o: $(SRC_DIR)/test-m-mmio-htif.S ; $(CC) -c $^ -o $@
 $(BIN_DIR)/test-m-mmio-htif: $(OBJ_DIR)/test-m-mmio-htif.o ; $(LD) $^ -o $@
 
@@ -292,6 +341,19 @@ $(BIN_DIR)/test-m-mret-user: $(OBJ_DIR)/test-m-mret-user.o ; $(LD) $^ -o $@
 $(OBJ_DIR)/test-m-sv39.o: $(SRC_DIR)/test-m-sv39.S ; $(CC) -c $^ -o $@
 $(BIN_DIR)/test-m-sv39: $(OBJ_DIR)/test-m-sv39.o ; $(LD) $^ -o $@
 
+$(OBJ_DIR)/test-m-virtio-blk.o: $(SRC_DIR)/test-m-virtio-blk.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-m-virtio-blk: $(OBJ_DIR)/test-m-virtio-blk.o ; $(LD) $^ -o $@
+
+$(OBJ_DIR)/test-m-sbi-calls.o: $(SRC_DIR)/test-m-sbi-calls.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-m-sbi-calls: $(OBJ_DIR)/test-m-sbi-calls.o ; $(LD) $^ -o $@
+
+$(OBJ_DIR)/test-m-hpm.o: $(SRC_DIR)/test-m-hpm.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-m-hpm: $(OBJ_DIR)/test-m-hpm.o ; $(LD) $^ -o $@
+
+$(OBJ_DIR)/test-m-binary.o: $(SRC_DIR)/test-m-binary.S ; $(CC) -c $^ -o $@
+$(BIN_DIR)/test-m-binary: $(OBJ_DIR)/test-m-binary.o ; $(LD) $^ -o $@
+$(BIN_DIR)/test-m-binary.bin: $(BIN_DIR)/test-m-binary ; $(OBJCOPY) -O binary -j .text $^ $@
+
 $(OBJ_DIR)/test-sbi-info.o: $(SRC_DIR)/test-sbi-info.c ; $(CC) -fPIC -O3 -c $^ -o $@
 $(BIN_DIR)/test-sbi-info: $(OBJ_DIR)/test-sbi-info.o ; $(CC) -Wl,--no-relax -nostartfiles $^ -o $@
 
@@ -59,7 +59,7 @@ namespace riscv {
     {
         uint32_t a, d;
     #if X86_USE_RDTSCP
-        __asm__ volatile ("rdtscp\n" : "=a" (a), "=d" (d));
+        __asm__ volatile ("rdtscp\n" : "=a" (a), "=d" (d) : : "ecx");
     #else
         __asm__ volatile ("lfence\n"
                           "rdtsc\n" : "=a" (a), "=d" (d));